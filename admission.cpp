@@ -0,0 +1,390 @@
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include "admission.h"
+
+namespace Admission
+{
+    namespace
+    {
+        auto const HEADER = "# sczr00 capacity: width height quality sampling median_ns max_ns";
+
+        // smallest reservation the kernel accepts
+        auto const MIN_RUNTIME_NS = 1024LL;
+
+        // gradient, texture and noise, the entropy coder sees many non-zero coefficients
+        void noisy_frame(std::vector<unsigned char> &pixels, int width, int height)
+        {
+            pixels.resize(size_t(width) * height * 3);
+            unsigned int seed = 12345;
+            for (int y = 0; y < height; y++)
+                for (int x = 0; x < width; x++)
+                    for (int c = 0; c < 3; c++)
+                    {
+                        seed = seed * 1103515245 + 12345;
+                        auto value = (x * (c + 1) + y * (3 - c)) % 256 + ((x / 3 + y / 5) % 7) * 12 + int(seed >> 27) - 52;
+                        pixels[(size_t(y) * width + x) * 3 + c] = (unsigned char) std::min(255, std::max(0, value));
+                    }
+        }
+
+        // linear interpolation of y at x, clamped to the first/last point; points are sorted by x
+        double interpolate(const std::vector<std::pair<double, double>> &points, double x)
+        {
+            if (x <= points.front().first)
+                return points.front().second;
+            if (x >= points.back().first)
+                return points.back().second;
+            size_t i = 1;
+            while (points[i].first < x)
+                i++;
+            auto &low = points[i - 1];
+            auto &high = points[i];
+            return low.second + (high.second - low.second) * (x - low.first) / (high.first - low.first);
+        }
+
+        std::string percent(double utilization)
+        {
+            char text[32];
+            snprintf(text, sizeof(text), "%.1f%%", utilization * 100);
+            return text;
+        }
+    }
+
+    bool parse_sampling(const std::string &text, TooJpeg::Sampling &sampling)
+    {
+        if (text != "444" && text != "422" && text != "420")
+            return false;
+        sampling = text == "444" ? TooJpeg::YCbCr444 : text == "422" ? TooJpeg::YCbCr422 : TooJpeg::YCbCr420;
+        return true;
+    }
+
+    std::string to_string(TooJpeg::Sampling sampling)
+    {
+        return sampling == TooJpeg::YCbCr444 ? "444" : sampling == TooJpeg::YCbCr422 ? "422" : "420";
+    }
+
+    bool parse_stream(const std::string &text, Stream &stream)
+    {
+        Stream parsed;
+        char *end = nullptr;
+        parsed.width = int(strtol(text.c_str(), &end, 10));
+        if (*end != 'x')
+            return false;
+        parsed.height = int(strtol(end + 1, &end, 10));
+        if (*end != '@')
+            return false;
+        parsed.fps = strtod(end + 1, &end);
+
+        // optional ":qQUALITY" and ":SAMPLING", in any order
+        std::string rest = end;
+        while (!rest.empty())
+        {
+            if (rest[0] != ':')
+                return false;
+            auto next = rest.find(':', 1);
+            auto field = rest.substr(1, next == std::string::npos ? std::string::npos : next - 1);
+            rest = next == std::string::npos ? std::string() : rest.substr(next);
+            if (!field.empty() && field[0] == 'q')
+            {
+                parsed.quality = int(strtol(field.c_str() + 1, &end, 10));
+                if (*end != 0 || field.size() == 1)
+                    return false;
+            }
+            else if (!parse_sampling(field, parsed.sampling))
+                return false;
+        }
+
+        if (parsed.width <= 0 || parsed.height <= 0 || parsed.width > 65535 || parsed.height > 65535 ||
+            parsed.fps < 0 || parsed.quality < 1 || parsed.quality > 100)
+            return false;
+        stream = parsed;
+        return true;
+    }
+
+    std::string to_string(const Stream &stream)
+    {
+        char fps[32];
+        snprintf(fps, sizeof(fps), "%g", stream.fps);
+        return std::to_string(stream.width) + "x" + std::to_string(stream.height) + "@" + fps +
+               ":q" + std::to_string(stream.quality) + ":" + to_string(stream.sampling);
+    }
+
+    bool Table::estimate(int width, int height, int quality, TooJpeg::Sampling sampling, long long &ns) const
+    {
+        // cost of each calibrated resolution at this quality
+        std::map<std::pair<int, int>, std::vector<std::pair<double, double>>> by_quality;
+        for (auto &cost : costs)
+            if (cost.sampling == sampling)
+                by_quality[{cost.width, cost.height}].push_back({double(cost.quality), double(cost.max_ns)});
+        if (by_quality.empty())
+            return false;
+
+        std::vector<std::pair<double, double>> by_pixels;
+        for (auto &resolution : by_quality)
+        {
+            auto &points = resolution.second;
+            std::sort(points.begin(), points.end());
+            by_pixels.push_back({double(resolution.first.first) * resolution.first.second, interpolate(points, quality)});
+        }
+        std::sort(by_pixels.begin(), by_pixels.end());
+
+        // beyond the calibrated sizes the cost per pixel of the nearest one is used
+        double pixels = double(width) * height;
+        if (pixels < by_pixels.front().first)
+            ns = (long long) (by_pixels.front().second * pixels / by_pixels.front().first);
+        else if (pixels > by_pixels.back().first)
+            ns = (long long) (by_pixels.back().second * pixels / by_pixels.back().first);
+        else
+            ns = (long long) interpolate(by_pixels, pixels);
+        return true;
+    }
+
+    bool Table::save(const std::string &path, std::string &error) const
+    {
+        auto file = fopen(path.c_str(), "w");
+        if (!file)
+        {
+            error = "cannot create " + path + ": " + strerror(errno);
+            return false;
+        }
+        fprintf(file, "%s\n", HEADER);
+        for (auto &cost : costs)
+            fprintf(file, "%d %d %d %s %lld %lld\n", cost.width, cost.height, cost.quality,
+                    to_string(cost.sampling).c_str(), cost.median_ns, cost.max_ns);
+        fclose(file);
+        return true;
+    }
+
+    bool Table::load(const std::string &path, std::string &error)
+    {
+        std::ifstream file(path);
+        if (!file)
+        {
+            error = "cannot open " + path + ": " + strerror(errno);
+            return false;
+        }
+
+        std::string line;
+        if (!std::getline(file, line) || line != HEADER)
+        {
+            error = path + " is not a capacity table";
+            return false;
+        }
+
+        std::vector<Cost> loaded;
+        for (auto number = 2; std::getline(file, line); number++)
+        {
+            if (line.empty() || line[0] == '#')
+                continue;
+            std::istringstream fields(line);
+            Cost cost{};
+            std::string sampling;
+            if (!(fields >> cost.width >> cost.height >> cost.quality >> sampling >> cost.median_ns >> cost.max_ns) ||
+                !parse_sampling(sampling, cost.sampling) || cost.width <= 0 || cost.height <= 0 || cost.max_ns <= 0)
+            {
+                error = path + ":" + std::to_string(number) + ": malformed cost";
+                return false;
+            }
+            loaded.push_back(cost);
+        }
+        if (loaded.empty())
+        {
+            error = path + " contains no costs";
+            return false;
+        }
+        costs = loaded;
+        return true;
+    }
+
+    Table calibrate(const Calibration &calibration, void (*progress)(const Cost &cost))
+    {
+        Table table;
+        std::vector<unsigned char> pixels;
+        std::vector<unsigned char> jpeg;
+        auto output = [&jpeg](unsigned char byte) { jpeg.push_back(byte); };
+        for (auto &resolution : calibration.resolutions)
+        {
+            noisy_frame(pixels, resolution.first, resolution.second);
+            for (auto sampling : calibration.samplings)
+                for (auto quality : calibration.qualities)
+                {
+                    // the first encode warms up caches and grows the output buffer
+                    std::vector<long long> times;
+                    for (int run = 0; run <= std::max(1, calibration.runs); run++)
+                    {
+                        jpeg.clear();
+                        auto start = std::chrono::steady_clock::now();
+                        TooJpeg::writeJpeg(output, pixels.data(), resolution.first, resolution.second, true, quality, sampling);
+                        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                std::chrono::steady_clock::now() - start).count();
+                        if (run > 0)
+                            times.push_back(ns);
+                    }
+                    std::sort(times.begin(), times.end());
+
+                    Cost cost{resolution.first, resolution.second, quality, sampling, times[times.size() / 2], times.back()};
+                    table.costs.push_back(cost);
+                    if (progress)
+                        progress(cost);
+                }
+        }
+        return table;
+    }
+
+    double kernel_bound()
+    {
+        long long runtime = 0, period = 0;
+        std::ifstream runtime_file("/proc/sys/kernel/sched_rt_runtime_us");
+        std::ifstream period_file("/proc/sys/kernel/sched_rt_period_us");
+        if (!(runtime_file >> runtime) || !(period_file >> period) || period <= 0)
+            return 0.95;
+        // -1: real-time tasks are not throttled
+        return runtime < 0 ? 1.0 : std::min(1.0, double(runtime) / period);
+    }
+
+    RealTime::Policy deadline_policy(long long cost_ns, double fps, double margin)
+    {
+        RealTime::Policy policy;
+        policy.policy = SCHED_DEADLINE;
+        policy.period_ns = fps > 0 ? (long long) (1e9 / fps) : DEFAULT_PERIOD_NS;
+        policy.deadline_ns = policy.period_ns;
+        // the kernel requires runtime <= deadline
+        policy.runtime_ns = std::min(policy.deadline_ns, std::max(MIN_RUNTIME_NS, (long long) std::ceil(cost_ns * margin)));
+        return policy;
+    }
+
+    std::string Decision::to_string() const
+    {
+        char cost[32];
+        snprintf(cost, sizeof(cost), "%.2f ms", cost_ns / 1e6);
+        switch (kind)
+        {
+            case ACCEPT:
+            case DEGRADE:
+                return std::string(kind == ACCEPT ? "accepted " : "degraded to ") + Admission::to_string(stream) +
+                       " (id " + std::to_string(id) + ", core " + std::to_string(core) + ", " + cost + " per frame, " +
+                       RealTime::to_string(policy) + ", " + percent(utilization) + " of a core)" +
+                       (reason.empty() ? "" : ": " + reason);
+            default:
+                return "rejected " + Admission::to_string(stream) + ": " + reason;
+        }
+    }
+
+    Controller::Controller(const Table &table, const Budget &budget)
+        : table(table), budget(budget), cores(size_t(std::max(1, budget.cpus)), 0.0)
+    {
+    }
+
+    bool Controller::place(const Stream &stream, Decision &decision, std::string &reason) const
+    {
+        long long cost_ns = 0;
+        if (!table.estimate(stream.width, stream.height, stream.quality, stream.sampling, cost_ns))
+        {
+            reason = "no calibrated cost for " + to_string(stream.sampling) + " sampling";
+            return false;
+        }
+        auto policy = deadline_policy(cost_ns, stream.fps, budget.margin);
+        // unclamped, the reservation itself never exceeds its period
+        auto utilization = cost_ns * budget.margin / policy.period_ns;
+        if (utilization > budget.core_bound)
+        {
+            reason = "needs " + percent(utilization) + " of a core, EDF bound " + percent(budget.core_bound);
+            return false;
+        }
+        if (total_utilization() + utilization > budget.cpu_share * budget.cpus)
+        {
+            reason = "needs " + percent(utilization) + " of a core, " +
+                     percent(budget.cpu_share * budget.cpus - total_utilization()) + " of the CPU budget left";
+            return false;
+        }
+
+        // best fit: the fullest core that still has room, keeps whole cores free for expensive streams
+        auto core = -1;
+        for (int i = 0; i < int(cores.size()); i++)
+            if (cores[i] + utilization <= budget.core_bound && (core < 0 || cores[i] > cores[core]))
+                core = i;
+        if (core < 0)
+        {
+            reason = "needs " + percent(utilization) + " of a core, no core has that much left";
+            return false;
+        }
+
+        decision.stream = stream;
+        decision.cost_ns = cost_ns;
+        decision.policy = policy;
+        decision.utilization = utilization;
+        decision.core = core;
+        return true;
+    }
+
+    Decision Controller::admit(const Stream &stream)
+    {
+        // as requested, then cheaper chroma subsampling, then lower quality in steps of 10
+        std::vector<Stream> candidates = {stream};
+        auto cheaper = stream;
+        if (cheaper.sampling == TooJpeg::YCbCr444)
+        {
+            cheaper.sampling = TooJpeg::YCbCr422;
+            candidates.push_back(cheaper);
+        }
+        if (cheaper.sampling != TooJpeg::YCbCr420)
+        {
+            cheaper.sampling = TooJpeg::YCbCr420;
+            candidates.push_back(cheaper);
+        }
+        for (auto quality = (stream.quality - 1) / 10 * 10; quality >= budget.min_quality; quality -= 10)
+        {
+            cheaper.quality = quality;
+            candidates.push_back(cheaper);
+        }
+
+        Decision decision;
+        decision.stream = stream;
+        std::string requested;
+        std::string reason;
+        for (size_t i = 0; i < candidates.size(); i++)
+        {
+            if (!place(candidates[i], decision, i == 0 ? requested : reason))
+                continue;
+            decision.kind = i == 0 ? Decision::ACCEPT : Decision::DEGRADE;
+            decision.reason = i == 0 ? "" : "requested " + to_string(stream) + " " + requested;
+            decision.id = next_id++;
+            cores[decision.core] += decision.utilization;
+            admitted.push_back(decision);
+            return decision;
+        }
+
+        decision.kind = Decision::REJECT;
+        decision.reason = requested;
+        if (candidates.size() > 1)
+            decision.reason += ", cheapest version " + to_string(candidates.back()) + " " + reason;
+        return decision;
+    }
+
+    bool Controller::release(int id)
+    {
+        for (auto i = admitted.begin(); i != admitted.end(); ++i)
+            if (i->id == id)
+            {
+                cores[i->core] = std::max(0.0, cores[i->core] - i->utilization);
+                admitted.erase(i);
+                return true;
+            }
+        return false;
+    }
+
+    double Controller::total_utilization() const
+    {
+        double total = 0;
+        for (auto utilization : cores)
+            total += utilization;
+        return total;
+    }
+}
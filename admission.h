@@ -0,0 +1,132 @@
+#include <string>
+#include <vector>
+#include "realtime.h"
+#include "toojpeg.h"
+
+#ifndef SCZR00_ADMISSION_H
+#define SCZR00_ADMISSION_H
+
+// Capacity model of this host and admission control of encoded streams. A calibration run times writeJpeg() over a
+// grid of resolutions, qualities and chroma samplings; the resulting cost table estimates the encode time of any
+// stream. The controller turns that estimate into a SCHED_DEADLINE reservation per stream (runtime = cost * margin,
+// period = deadline = frame interval) and places the reservations on cores with partitioned EDF: a stream is accepted
+// if a core stays within its utilisation bound and all streams stay within the total CPU budget, degraded (chroma
+// subsampling first, then quality) if only a cheaper version fits, and rejected otherwise.
+namespace Admission
+{
+    // period of a stream without a frame rate (frames as fast as possible)
+    auto const DEFAULT_PERIOD_NS = 30000000LL;
+
+    struct Stream
+    {
+        int width = 0;
+        int height = 0;
+        int quality = 90;
+        TooJpeg::Sampling sampling = TooJpeg::YCbCr444;
+        double fps = 0;
+    };
+
+    // "WxH@FPS[:qQUALITY][:444|422|420]", e.g. "1920x1080@30:q80:420"
+    bool parse_stream(const std::string &text, Stream &stream);
+    std::string to_string(const Stream &stream);
+
+    // "444", "422" or "420"
+    std::string to_string(TooJpeg::Sampling sampling);
+    bool parse_sampling(const std::string &text, TooJpeg::Sampling &sampling);
+
+    // calibrated encode time of one configuration
+    struct Cost
+    {
+        int width;
+        int height;
+        int quality;
+        TooJpeg::Sampling sampling;
+        long long median_ns;
+        long long max_ns;
+    };
+
+    class Table
+    {
+    public:
+        std::vector<Cost> costs;
+
+        // estimated (worst) encode time of a frame, interpolated between the calibrated qualities and pixel counts,
+        // scaled per pixel beyond them; returns false if the sampling was not calibrated
+        bool estimate(int width, int height, int quality, TooJpeg::Sampling sampling, long long &ns) const;
+
+        // text file, one "width height quality sampling median_ns max_ns" line per cost
+        bool save(const std::string &path, std::string &error) const;
+        bool load(const std::string &path, std::string &error);
+    };
+
+    struct Calibration
+    {
+        std::vector<std::pair<int, int>> resolutions = {{320, 240}, {640, 480}, {1280, 720}, {1920, 1080}};
+        std::vector<int> qualities = {50, 75, 90, 100};
+        std::vector<TooJpeg::Sampling> samplings = {TooJpeg::YCbCr444, TooJpeg::YCbCr422, TooJpeg::YCbCr420};
+        int runs = 5; // timed encodes per configuration, after one warm-up encode
+    };
+
+    // encodes a noisy synthetic frame (an expensive case for the entropy coder) with writeJpeg() on the calling thread,
+    // progress is called after each configuration
+    Table calibrate(const Calibration &calibration, void (*progress)(const Cost &cost) = nullptr);
+
+    struct Budget
+    {
+        int cpus = 1;              // cores available to the encoders
+        double cpu_share = 0.9;    // share of all cores the encoders may use together
+        double core_bound = 0.95;  // EDF utilisation bound per core, see kernel_bound()
+        double margin = 1.25;      // reservation runtime = estimated encode time * margin
+        int min_quality = 50;      // streams are not degraded below this quality
+    };
+
+    // the kernel's SCHED_DEADLINE admission limit: sched_rt_runtime_us / sched_rt_period_us (0.95 if unknown)
+    double kernel_bound();
+
+    // SCHED_DEADLINE reservation of one stream
+    RealTime::Policy deadline_policy(long long cost_ns, double fps, double margin);
+
+    struct Decision
+    {
+        enum Kind { ACCEPT, DEGRADE, REJECT };
+
+        Kind kind = REJECT;
+        int id = -1;               // registration, see Controller::release()
+        Stream stream;             // granted parameters, degraded if kind == DEGRADE
+        long long cost_ns = 0;     // estimated encode time of a granted frame
+        RealTime::Policy policy;   // reservation of the granted stream
+        double utilization = 0;    // runtime / period
+        int core = -1;
+        std::string reason;        // why a stream was degraded or rejected
+
+        std::string to_string() const;
+    };
+
+    // Not thread safe, streams are registered by a single thread
+    class Controller
+    {
+    public:
+        Controller(const Table &table, const Budget &budget);
+
+        // registers the stream unless it is rejected
+        Decision admit(const Stream &stream);
+
+        // unregisters an admitted stream, returns false for unknown ids
+        bool release(int id);
+
+        double total_utilization() const;
+        const std::vector<double> &core_utilization() const { return cores; }
+
+    private:
+        // estimate and place one candidate, false if it does not fit
+        bool place(const Stream &stream, Decision &decision, std::string &reason) const;
+
+        const Table &table;
+        Budget budget;
+        std::vector<double> cores;
+        std::vector<Decision> admitted;
+        int next_id = 0;
+    };
+}
+
+#endif //SCZR00_ADMISSION_H
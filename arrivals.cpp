@@ -0,0 +1,140 @@
+#include <time.h>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include "arrivals.h"
+
+namespace Arrivals
+{
+    long long monotonic_ns()
+    {
+        timespec now{};
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return now.tv_sec * 1000000000LL + now.tv_nsec;
+    }
+
+    Recorder::~Recorder()
+    {
+        if (file)
+            fclose(file);
+    }
+
+    bool Recorder::open(const std::string &path)
+    {
+        file = fopen(path.c_str(), "w");
+        if (!file)
+            return false;
+        fprintf(file, "%s\n", HEADER);
+        return true;
+    }
+
+    void Recorder::add(int width, int height, long bytes, const std::string &content)
+    {
+        if (!file)
+            return;
+        auto now = monotonic_ns();
+        if (start_ns < 0)
+            start_ns = now;
+        fprintf(file, "%lld %d %d %ld %s\n", now - start_ns, width, height, bytes, content.c_str());
+        fflush(file); // a crashed or killed run still leaves a usable trace
+    }
+
+    bool load(const std::string &path, std::vector<Arrival> &arrivals, std::string &error)
+    {
+        std::ifstream file(path);
+        if (!file)
+        {
+            error = "cannot open " + path + ": " + strerror(errno);
+            return false;
+        }
+
+        std::string line;
+        if (!std::getline(file, line) || line != HEADER)
+        {
+            error = path + " is not an arrival trace";
+            return false;
+        }
+
+        arrivals.clear();
+        for (auto number = 2; std::getline(file, line); number++)
+        {
+            if (line.empty() || line[0] == '#')
+                continue;
+            std::istringstream fields(line);
+            Arrival arrival;
+            if (!(fields >> arrival.offset_ns >> arrival.width >> arrival.height >> arrival.bytes >> arrival.content) ||
+                arrival.width <= 0 || arrival.height <= 0 || arrival.width > 65535 || arrival.height > 65535 ||
+                (!arrivals.empty() && arrival.offset_ns < arrivals.back().offset_ns))
+            {
+                error = path + ":" + std::to_string(number) + ": malformed arrival";
+                return false;
+            }
+            arrivals.push_back(arrival);
+        }
+        if (arrivals.empty())
+        {
+            error = path + " contains no arrivals";
+            return false;
+        }
+        return true;
+    }
+
+    bool Contents::load(const std::vector<Arrival> &arrivals, std::string &error)
+    {
+        for (auto &arrival : arrivals)
+        {
+            if (arrival.content == GRADIENT || raw.count(arrival.content))
+                continue;
+            if (arrival.content.compare(0, strlen(RAW_PREFIX), RAW_PREFIX) != 0)
+            {
+                error = "unknown content " + arrival.content;
+                return false;
+            }
+
+            auto path = arrival.content.substr(strlen(RAW_PREFIX));
+            std::ifstream file(path, std::ios_base::binary);
+            std::vector<unsigned char> pixels((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+            if (!file.is_open() || pixels.size() < size_t(arrival.width) * arrival.height * 3)
+            {
+                error = "cannot read " + std::to_string(arrival.width) + "x" + std::to_string(arrival.height) +
+                        " RGB frame from " + path;
+                return false;
+            }
+            raw[arrival.content] = std::move(pixels);
+        }
+        return true;
+    }
+
+    const unsigned char *Contents::find(const std::string &content) const
+    {
+        auto found = raw.find(content);
+        return found == raw.end() ? nullptr : found->second.data();
+    }
+
+    long long Replayer::wait(const Arrival &arrival)
+    {
+        if (start_ns < 0)
+            start_ns = monotonic_ns() - (long long) (arrival.offset_ns / speed);
+
+        auto due = start_ns + (long long) (arrival.offset_ns / speed);
+        timespec until{};
+        until.tv_sec = due / 1000000000LL;
+        until.tv_nsec = due % 1000000000LL;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, nullptr) == EINTR);
+
+        auto late = monotonic_ns() - due;
+        frames++;
+        total_late_ns += late;
+        if (late > max_late_ns)
+            max_late_ns = late;
+        return late;
+    }
+
+    std::string Replayer::to_string() const
+    {
+        return "frames: " + std::to_string(frames) + ", speed: " + std::to_string(speed) +
+               "x, mean wake-up lateness: " + std::to_string(frames ? total_late_ns / frames / 1000 : 0) + " us" +
+               ", max: " + std::to_string(max_late_ns / 1000) + " us";
+    }
+}
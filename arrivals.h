@@ -0,0 +1,84 @@
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+
+#ifndef SCZR00_ARRIVALS_H
+#define SCZR00_ARRIVALS_H
+
+// Frame arrival traces: the producer records when each frame arrived, its size and what it showed,
+// a later run replays the same traffic with the original timing (or scaled) to compare changes reproducibly.
+//
+// File format, one frame per line after the header:
+//   # sczr00 arrivals 1
+//   <offset ns since the first frame> <width> <height> <bytes> <content>
+// content is "gradient" (built-in test image) or "raw:<path>" (RGB file of width * height * 3 bytes)
+namespace Arrivals
+{
+    auto const HEADER = "# sczr00 arrivals 1";
+    auto const GRADIENT = "gradient";
+    auto const RAW_PREFIX = "raw:";
+
+    struct Arrival
+    {
+        long long offset_ns = 0;
+        int width = 0;
+        int height = 0;
+        long bytes = 0;
+        std::string content;
+    };
+
+    class Recorder
+    {
+    public:
+        ~Recorder();
+
+        bool open(const std::string &path);
+
+        // arrival time is taken now, the first frame defines offset 0
+        void add(int width, int height, long bytes, const std::string &content);
+
+    private:
+        FILE *file = nullptr;
+        long long start_ns = -1;
+    };
+
+    // returns false with a message if the file is missing or malformed
+    bool load(const std::string &path, std::vector<Arrival> &arrivals, std::string &error);
+
+    // Raw frames referenced by a trace, read once before the replay so that disk I/O does not disturb its timing
+    class Contents
+    {
+    public:
+        bool load(const std::vector<Arrival> &arrivals, std::string &error);
+
+        // pixels of a raw: reference, nullptr for built-in content
+        const unsigned char *find(const std::string &content) const;
+
+    private:
+        std::map<std::string, std::vector<unsigned char>> raw;
+    };
+
+    // Sleeps until each arrival is due (absolute CLOCK_MONOTONIC, no drift), speed 2 = twice as fast
+    class Replayer
+    {
+    public:
+        explicit Replayer(double speed) : speed(speed) {}
+
+        // returns how late the wake-up was in ns
+        long long wait(const Arrival &arrival);
+
+        std::string to_string() const;
+
+    private:
+        double speed;
+        long long start_ns = -1;
+        long frames = 0;
+        long long total_late_ns = 0;
+        long long max_late_ns = 0;
+    };
+
+    long long monotonic_ns();
+}
+
+#endif //SCZR00_ARRIVALS_H
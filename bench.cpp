@@ -0,0 +1,618 @@
+// Microbenchmarks for the JPEG encoder
+//
+// entropy:  replays the Huffman/codeword stream of real frames into the legacy 32 bit BitWriter
+//           and into the current 64 bit BitWriter, reports bits per cycle
+// sampling: file size and time of YCbCr 4:4:4, 4:2:2 and 4:2:0, and the scalar vs SIMD chroma box filter
+// sinks:    whole encodes into a function pointer callback vs inlined sinks (lambda, counting functor)
+// multi:    several qualities of one frame, separate writeJpeg() calls vs a single writeJpegs() pass
+// setup:    building the quantization, Huffman and codeword tables per call vs the compile-time tables
+// progressive: baseline vs progressive encodes, extra time and coefficient memory, bytes needed for the first preview
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "toojpeg.h"
+#include "toojpeg_internal.h"
+
+using namespace TooJpeg::Internal;
+
+namespace
+{
+    // ////////////////////////////////////////
+    // cycle counter (falls back to nanoseconds on non-x86 hosts)
+
+#if defined(__x86_64__) || defined(__i386__)
+    const char* const CYCLE_UNIT = "cycle";
+    inline unsigned long long cycles() { return __rdtsc(); }
+#else
+    const char* const CYCLE_UNIT = "ns";
+    inline unsigned long long cycles()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+#endif
+
+    // ////////////////////////////////////////
+    // output sink: plain memory, no bounds checks - the buffer is sized generously
+    std::vector<unsigned char> sinkBuffer;
+    unsigned char* sinkPos = nullptr;
+
+    void sink(unsigned char byte)
+    {
+        *sinkPos++ = byte;
+    }
+
+    void resetSink()
+    {
+        sinkPos = sinkBuffer.data();
+    }
+
+    size_t sinkSize()
+    {
+        return sinkPos - sinkBuffer.data();
+    }
+
+    // ////////////////////////////////////////
+    // BitWriter as it was before the 64 bit rewrite (one byte per loop iteration, 0xFF check per byte)
+    struct LegacyBitWriter
+    {
+        TooJpeg::WRITE_ONE_BYTE output;
+        explicit LegacyBitWriter(TooJpeg::WRITE_ONE_BYTE output_) : output(output_) {}
+
+        struct BitBuffer
+        {
+            int32_t data    = 0;
+            uint8_t numBits = 0;
+        } buffer;
+
+        LegacyBitWriter& operator<<(const BitCode& data)
+        {
+            buffer.numBits += data.numBits;
+            buffer.data   <<= data.numBits;
+            buffer.data    |= data.code;
+
+            while (buffer.numBits >= 8)
+            {
+                buffer.numBits -= 8;
+                auto oneByte = uint8_t(buffer.data >> buffer.numBits);
+                output(oneByte);
+                if (oneByte == 0xFF)
+                    output(0);
+            }
+            return *this;
+        }
+
+        void flush()
+        {
+            *this << BitCode(0x7F, 7);
+        }
+    };
+
+    // ////////////////////////////////////////
+    // records everything encodeBlock() emits so that it can be replayed later
+    struct Symbol
+    {
+        BitCode huffman;
+        BitCode value; // numBits == 0 if the Huffman code has no value bits
+    };
+
+    struct RecordingWriter
+    {
+        std::vector<Symbol> symbols;
+        unsigned long long numBits = 0;
+
+        RecordingWriter& operator<<(const BitCode& huffman)
+        {
+            symbols.push_back({ huffman, BitCode(0, 0) });
+            numBits += huffman.numBits;
+            return *this;
+        }
+
+        void write(const BitCode& huffman, const BitCode& value)
+        {
+            symbols.push_back({ huffman, value });
+            numBits += huffman.numBits + value.numBits;
+        }
+    };
+
+    // ////////////////////////////////////////
+    // test frames
+
+    // same gradient as generateImage() in main.cpp
+    void gradientImage(std::vector<unsigned char>& image, int width, int height)
+    {
+        image.resize(width * height * 3);
+        for (auto y = 0; y < height; y++)
+            for (auto x = 0; x < width; x++)
+            {
+                auto offset = (y * width + x) * 3;
+                image[offset]     = 255 * x / width;
+                image[offset + 1] = 255 * y / height;
+                image[offset + 2] = 127;
+            }
+    }
+
+    // "busy scene": gradient plus texture and pseudo-random noise, produces far more non-zero coefficients
+    void busyImage(std::vector<unsigned char>& image, int width, int height)
+    {
+        gradientImage(image, width, height);
+        unsigned int seed = 12345;
+        for (auto y = 0; y < height; y++)
+            for (auto x = 0; x < width; x++)
+            {
+                seed = seed * 1103515245 + 12345;
+                auto noise   = int((seed >> 16) & 0x3F) - 32;
+                auto texture = ((x / 3 + y / 5) % 7) * 12;
+                for (auto c = 0; c < 3; c++)
+                {
+                    auto offset = (y * width + x) * 3 + c;
+                    image[offset] = clamp(int(image[offset]) + noise + texture - 36, 0, 255);
+                }
+            }
+    }
+
+    // run colour conversion, DCT and quantization of a YCbCr 4:4:4 frame and record its entropy coder input
+    void recordStream(const std::vector<unsigned char>& pixels, int width, int height, uint8_t quality,
+                      RecordingWriter& recorder)
+    {
+        EncoderTables tables(quality);
+
+        int16_t lastDC[3] = { 0, 0, 0 };
+        processBlocks(pixels.data(), width, height, true, TooJpeg::YCbCr444, [&](int component, float block[8][8])
+        {
+            if (component == 0)
+                lastDC[0] = encodeBlock(recorder, block, tables.scaledLuminance, lastDC[0],
+                                        tables.huffmanLuminanceDC, tables.huffmanLuminanceAC, tables.codewords);
+            else
+                lastDC[component] = encodeBlock(recorder, block, tables.scaledChrominance, lastDC[component],
+                                                tables.huffmanChrominanceDC, tables.huffmanChrominanceAC, tables.codewords);
+        });
+    }
+
+    // replay a recorded stream, returns the best (lowest) number of cycles out of several repetitions
+    template <typename Replay>
+    unsigned long long measure(int repetitions, Replay replay)
+    {
+        unsigned long long best = ~0ULL;
+        for (auto i = 0; i < repetitions; i++)
+        {
+            resetSink();
+            auto start = cycles();
+            replay();
+            auto elapsed = cycles() - start;
+            if (elapsed < best)
+                best = elapsed;
+        }
+        return best;
+    }
+
+    int benchEntropy(int width, int height, int repetitions)
+    {
+        printf("entropy coder: %dx%d, best of %d runs, bits per %s (higher is better)\n",
+               width, height, repetitions, CYCLE_UNIT);
+        printf("%-10s %7s %12s %12s %10s %10s %8s\n",
+               "frame", "quality", "symbols", "bits", "legacy", "current", "speedup");
+
+        std::vector<unsigned char> image;
+        sinkBuffer.resize(width * height * 3 * 4 + 1024);
+        const uint8_t qualities[] = { 50, 90, 98 };
+
+        for (auto frame = 0; frame < 2; frame++)
+        {
+            if (frame == 0)
+                gradientImage(image, width, height);
+            else
+                busyImage(image, width, height);
+
+            for (auto quality : qualities)
+            {
+                RecordingWriter recorder;
+                recordStream(image, width, height, quality, recorder);
+                const auto& symbols = recorder.symbols;
+
+                auto legacyCycles = measure(repetitions, [&]()
+                {
+                    LegacyBitWriter writer(sink);
+                    for (const auto& symbol : symbols)
+                    {
+                        writer << symbol.huffman;
+                        if (symbol.value.numBits > 0)
+                            writer << symbol.value;
+                    }
+                    writer.flush();
+                });
+                std::vector<unsigned char> legacyBytes(sinkBuffer.data(), sinkPos);
+
+                auto currentCycles = measure(repetitions, [&]()
+                {
+                    BitWriter<TooJpeg::WRITE_ONE_BYTE> writer(sink);
+                    for (const auto& symbol : symbols)
+                    {
+                        if (symbol.value.numBits > 0)
+                            writer.write(symbol.huffman, symbol.value);
+                        else
+                            writer << symbol.huffman;
+                    }
+                    writer.flush();
+                });
+
+                // both writers must produce exactly the same bytes
+                if (legacyBytes.size() != sinkSize() ||
+                    memcmp(legacyBytes.data(), sinkBuffer.data(), legacyBytes.size()) != 0)
+                {
+                    fprintf(stderr, "bitstream mismatch (%s, quality %d)\n", frame == 0 ? "gradient" : "busy", quality);
+                    return 1;
+                }
+
+                auto bits = double(recorder.numBits);
+                printf("%-10s %7d %12zu %12.0f %10.3f %10.3f %7.2fx\n",
+                       frame == 0 ? "gradient" : "busy", quality, symbols.size(), bits,
+                       bits / legacyCycles, bits / currentCycles, double(legacyCycles) / currentCycles);
+            }
+        }
+        return 0;
+    }
+
+    // 4:2:0 chroma of every pair of source rows with the scalar and the SIMD kernel, false if they disagree
+    bool benchChromaRows(const std::vector<unsigned char>& image, int width, int height, int repetitions,
+                         unsigned long long& scalarCycles, unsigned long long& simdCycles)
+    {
+        const auto samples = size_t(height / 2) * (width / 16) * 8;
+        std::vector<float> expected(2 * samples), actual(2 * samples);
+        scalarCycles = measure(repetitions, [&]()
+        {
+            auto cb = expected.data(), cr = cb + samples;
+            for (auto y = 0; y + 1 < height; y += 2)
+                for (auto x = 0; x + 16 <= width; x += 16, cb += 8, cr += 8)
+                    chromaRowScalar(&image[(y * width + x) * 3], &image[((y + 1) * width + x) * 3], 0.25f, cb, cr);
+        });
+        simdCycles = measure(repetitions, [&]()
+        {
+            auto cb = actual.data(), cr = cb + samples;
+            for (auto y = 0; y + 1 < height; y += 2)
+                for (auto x = 0; x + 16 <= width; x += 16, cb += 8, cr += 8)
+                    chromaRow(&image[(y * width + x) * 3], &image[((y + 1) * width + x) * 3], 0.25f, cb, cr);
+        });
+        return memcmp(expected.data(), actual.data(), expected.size() * sizeof(float)) == 0;
+    }
+
+    int benchSampling(int width, int height, int repetitions)
+    {
+        printf("\nchroma sampling: %dx%d, best of %d runs, quality 90, time in M%ss per frame\n",
+               width, height, repetitions, CYCLE_UNIT);
+        printf("%-10s %6s %10s %7s %10s %10s\n", "frame", "mode", "bytes", "size", "convert", "encode");
+
+        std::vector<unsigned char> image;
+        const TooJpeg::Sampling modes[] = { TooJpeg::YCbCr444, TooJpeg::YCbCr422, TooJpeg::YCbCr420 };
+        const char* const modeNames[] = { "4:4:4", "4:2:0", "4:2:2" }; // indexed by TooJpeg::Sampling
+
+        for (auto frame = 0; frame < 2; frame++)
+        {
+            if (frame == 0)
+                gradientImage(image, width, height);
+            else
+                busyImage(image, width, height);
+
+            size_t fullSize = 0;
+            for (auto mode : modes)
+            {
+                // colour conversion and downsampling only
+                auto convertCycles = measure(repetitions, [&]()
+                {
+                    float checksum = 0;
+                    processBlocks(image.data(), width, height, true, mode, [&](int, float block[8][8]) { checksum += block[0][0]; });
+                    if (checksum == 12345.f) // keeps the compiler from dropping the conversion
+                        sink(0);
+                });
+                auto encodeCycles = measure(repetitions, [&]()
+                {
+                    TooJpeg::writeJpeg(sink, image.data(), width, height, true, 90, mode);
+                });
+                auto bytes = sinkSize();
+                if (mode == TooJpeg::YCbCr444)
+                    fullSize = bytes;
+
+                printf("%-10s %6s %10zu %6.1f%% %10.2f %10.2f\n",
+                       frame == 0 ? "gradient" : "busy", modeNames[mode], bytes, 100.0 * bytes / fullSize,
+                       convertCycles / 1e6, encodeCycles / 1e6);
+            }
+
+            unsigned long long scalarCycles, simdCycles;
+            if (!benchChromaRows(image, width, height, repetitions, scalarCycles, simdCycles))
+            {
+                fprintf(stderr, "chroma mismatch (%s)\n", frame == 0 ? "gradient" : "busy");
+                return 1;
+            }
+            printf("%-10s 2x2 box filter + CbCr: scalar %.2f, %s %.2f M%ss (%.2fx)\n", frame == 0 ? "gradient" : "busy",
+                   scalarCycles / 1e6,
+#ifdef __SSE2__
+                   "SSE2",
+#else
+                   "fallback",
+#endif
+                   simdCycles / 1e6, CYCLE_UNIT, double(scalarCycles) / simdCycles);
+        }
+        return 0;
+    }
+
+    // counts the bytes only, e.g. to find the size of a frame without storing it
+    struct CountingSink
+    {
+        size_t bytes = 0;
+        void operator()(unsigned char) { bytes++; }
+    };
+
+    int benchSinks(int width, int height, int repetitions)
+    {
+        printf("\noutput sinks: %dx%d, best of %d runs, quality 90, time in M%ss per frame\n",
+               width, height, repetitions, CYCLE_UNIT);
+        printf("%-10s %10s %10s %10s %10s\n", "frame", "bytes", "pointer", "lambda", "counting");
+
+        std::vector<unsigned char> image;
+        for (auto frame = 0; frame < 2; frame++)
+        {
+            if (frame == 0)
+                gradientImage(image, width, height);
+            else
+                busyImage(image, width, height);
+
+            // same buffer and the same work per byte, only the call differs
+            auto pointerCycles = measure(repetitions, [&]()
+            {
+                TooJpeg::writeJpeg(sink, image.data(), width, height, true, 90);
+            });
+            auto bytes = sinkSize();
+            std::vector<unsigned char> expected(sinkBuffer.data(), sinkPos);
+
+            auto lambdaCycles = measure(repetitions, [&]()
+            {
+                auto position = sinkBuffer.data();
+                TooJpeg::writeJpeg([&position](unsigned char byte) { *position++ = byte; }, image.data(), width, height, true, 90);
+                sinkPos = position;
+            });
+            if (sinkSize() != bytes || memcmp(expected.data(), sinkBuffer.data(), bytes) != 0)
+            {
+                fprintf(stderr, "sink output mismatch (%s)\n", frame == 0 ? "gradient" : "busy");
+                return 1;
+            }
+
+            CountingSink counter;
+            auto countingCycles = measure(repetitions, [&]()
+            {
+                counter.bytes = 0;
+                TooJpeg::writeJpeg(counter, image.data(), width, height, true, 90);
+            });
+            if (counter.bytes != bytes)
+            {
+                fprintf(stderr, "counting sink mismatch (%s)\n", frame == 0 ? "gradient" : "busy");
+                return 1;
+            }
+
+            printf("%-10s %10zu %10.2f %10.2f %10.2f\n", frame == 0 ? "gradient" : "busy", bytes,
+                   pointerCycles / 1e6, lambdaCycles / 1e6, countingCycles / 1e6);
+        }
+        return 0;
+    }
+
+    int benchRenditions(int width, int height, int repetitions)
+    {
+        printf("\nmulti-quality: %dx%d busy frame, best of %d runs, time in M%ss per frame\n",
+               width, height, repetitions, CYCLE_UNIT);
+        printf("%-24s %10s %10s %8s\n", "qualities", "separate", "one pass", "saved");
+
+        std::vector<unsigned char> image;
+        busyImage(image, width, height);
+
+        const std::vector<std::vector<int>> lists = { {90, 50}, {95, 75, 50, 25}, {90, 90, 90, 90, 90, 90, 90, 90} };
+        for (auto sampling : { TooJpeg::YCbCr444, TooJpeg::YCbCr420 })
+            for (auto& qualities : lists)
+            {
+                std::vector<TooJpeg::Rendition> renditions(qualities.size());
+                for (size_t i = 0; i < qualities.size(); i++)
+                {
+                    renditions[i].quality  = (unsigned char) qualities[i];
+                    renditions[i].sampling = sampling;
+                }
+
+                std::vector<std::vector<unsigned char>> separate(qualities.size());
+                auto separateCycles = measure(repetitions, [&]()
+                {
+                    for (size_t i = 0; i < qualities.size(); i++)
+                    {
+                        auto& jpeg = separate[i];
+                        jpeg.clear();
+                        TooJpeg::writeJpeg([&jpeg](unsigned char byte) { jpeg.push_back(byte); }, image.data(), width, height,
+                                           true, renditions[i].quality, sampling);
+                    }
+                });
+                auto onePassCycles = measure(repetitions, [&]()
+                {
+                    TooJpeg::writeJpegs(renditions, image.data(), width, height, true);
+                });
+                for (size_t i = 0; i < qualities.size(); i++)
+                    if (renditions[i].jpeg != separate[i])
+                    {
+                        fprintf(stderr, "multi-quality output mismatch (quality %d)\n", qualities[i]);
+                        return 1;
+                    }
+
+                auto name = std::string(sampling == TooJpeg::YCbCr444 ? "444:" : "420:");
+                for (auto quality : qualities)
+                    name += (name.back() == ':' ? "" : ",") + std::to_string(quality);
+                if (name.size() > 24)
+                    name = name.substr(0, 21) + "...";
+                printf("%-24s %10.2f %10.2f %7.0f%%\n", name.c_str(), separateCycles / 1e6, onePassCycles / 1e6,
+                       100 * (1 - double(onePassCycles) / separateCycles));
+            }
+        return 0;
+    }
+
+    // what every writeJpeg() call computed before the tables were generated at compile time
+    struct RuntimeTables
+    {
+        uint8_t quantLuminance[8*8];
+        uint8_t quantChrominance[8*8];
+        float   scaledLuminance[8*8];
+        float   scaledChrominance[8*8];
+        BitCode huffman[4][256];
+        BitCode codewords[2 * CodeWordLimit];
+
+        explicit RuntimeTables(uint8_t quality)
+        {
+            generateQuantTables(quality, quantLuminance, quantChrominance);
+            scaleQuantTable(quantLuminance,   scaledLuminance);
+            scaleQuantTable(quantChrominance, scaledChrominance);
+            generateHuffmanTable(DcLuminanceCodesPerBitsize,   DcLuminanceValues,   huffman[0]);
+            generateHuffmanTable(AcLuminanceCodesPerBitsize,   AcLuminanceValues,   huffman[1]);
+            generateHuffmanTable(DcChrominanceCodesPerBitsize, DcChrominanceValues, huffman[2]);
+            generateHuffmanTable(AcChrominanceCodesPerBitsize, AcChrominanceValues, huffman[3]);
+            generateCodewords(codewords);
+        }
+    };
+
+    bool sameCodes(const BitCode* a, const BitCode* b, int count)
+    {
+        for (auto i = 0; i < count; i++)
+            if (a[i].code != b[i].code || a[i].numBits != b[i].numBits)
+                return false;
+        return true;
+    }
+
+    int benchSetup(int repetitions)
+    {
+        const auto Calls = 1000;
+        printf("\ntable setup: best of %d runs, %ss per call (%d calls per run)\n", repetitions, CYCLE_UNIT, Calls);
+        printf("%-10s %10s %10s %10s\n", "quality", "bytes", "runtime", "constexpr");
+
+        for (auto quality : { 25, 50, 90, 100 })
+        {
+            // the compile-time tables must be exactly what the runtime generators produce
+            RuntimeTables expected(quality);
+            EncoderTables tables(quality);
+            if (memcmp(expected.quantLuminance,    tables.quantLuminance,    sizeof(expected.quantLuminance))    != 0 ||
+                memcmp(expected.quantChrominance,  tables.quantChrominance,  sizeof(expected.quantChrominance))  != 0 ||
+                memcmp(expected.scaledLuminance,   tables.scaledLuminance,   sizeof(expected.scaledLuminance))   != 0 ||
+                memcmp(expected.scaledChrominance, tables.scaledChrominance, sizeof(expected.scaledChrominance)) != 0 ||
+                !sameCodes(expected.huffman[0], tables.huffmanLuminanceDC,   256) ||
+                !sameCodes(expected.huffman[1], tables.huffmanLuminanceAC,   256) ||
+                !sameCodes(expected.huffman[2], tables.huffmanChrominanceDC, 256) ||
+                !sameCodes(expected.huffman[3], tables.huffmanChrominanceAC, 256) ||
+                !sameCodes(expected.codewords, tables.codewords - CodeWordLimit, 2 * CodeWordLimit))
+            {
+                fprintf(stderr, "compile-time tables differ (quality %d)\n", quality);
+                return 1;
+            }
+
+            // keep the results alive, otherwise the compiler may drop the work
+            volatile unsigned checksum = 0;
+            auto runtimeCycles = measure(repetitions, [&]()
+            {
+                for (auto call = 0; call < Calls; call++)
+                {
+                    RuntimeTables runtime(quality);
+                    checksum = checksum + runtime.codewords[call].code + runtime.quantLuminance[call % 64];
+                }
+            });
+            auto constexprCycles = measure(repetitions, [&]()
+            {
+                for (auto call = 0; call < Calls; call++)
+                {
+                    EncoderTables shared(quality);
+                    checksum = checksum + shared.codewords[call].code + shared.quantLuminance[call % 64];
+                }
+            });
+            printf("%-10d %10zu %10.0f %10.0f\n", quality, sizeof(RuntimeTables),
+                   double(runtimeCycles) / Calls, double(constexprCycles) / Calls);
+        }
+        return 0;
+    }
+
+    // offset behind the first scan's entropy coded data, a decoder can show the first preview once it has these bytes
+    size_t firstScanEnd(const std::vector<unsigned char>& jpeg)
+    {
+        size_t pos = 2; // skip SOI
+        while (pos + 4 <= jpeg.size() && jpeg[pos] == 0xFF)
+        {
+            auto marker = jpeg[pos + 1];
+            pos += 2 + ((jpeg[pos + 2] << 8) | jpeg[pos + 3]);
+            if (marker != 0xDA)
+                continue;
+            // entropy coded data ends at the first marker, 0xFF 0x00 is a stuffed 0xFF
+            while (pos + 1 < jpeg.size() && !(jpeg[pos] == 0xFF && jpeg[pos + 1] != 0x00))
+                pos++;
+            return pos;
+        }
+        return jpeg.size();
+    }
+
+    int benchProgressive(int width, int height, int repetitions)
+    {
+        printf("\nprogressive: %dx%d, best of %d runs, quality 90, 4:2:0, time in M%ss per frame\n",
+               width, height, repetitions, CYCLE_UNIT);
+        printf("%-10s %-12s %10s %10s %10s %12s %10s\n", "frame", "mode", "bytes", "time", "extra", "first scan", "extra MB");
+
+        // coefficient buffer of the progressive encoder, the baseline encoder needs none
+        auto extraMegabytes = QuantizedImage(width, height, true, TooJpeg::YCbCr420).bytes() / (1024.0 * 1024);
+
+        std::vector<unsigned char> image;
+        for (auto frame = 0; frame < 2; frame++)
+        {
+            if (frame == 0)
+                gradientImage(image, width, height);
+            else
+                busyImage(image, width, height);
+
+            unsigned long long baselineCycles = 0;
+            for (auto mode = 0; mode < 3; mode++)
+            {
+                auto scans = mode == 0 ? std::vector<TooJpeg::Scan>() : TooJpeg::progressiveScans(true, mode == 2);
+                std::vector<unsigned char> jpeg;
+                auto cycles = measure(repetitions, [&]()
+                {
+                    jpeg.clear();
+                    auto output = [&jpeg](unsigned char byte) { jpeg.push_back(byte); };
+                    if (scans.empty())
+                        TooJpeg::writeJpeg(output, image.data(), width, height, true, 90, TooJpeg::YCbCr420);
+                    else
+                        TooJpeg::writeProgressive(output, image.data(), width, height, scans, true, 90, TooJpeg::YCbCr420);
+                });
+                if (mode == 0)
+                    baselineCycles = cycles;
+
+                auto firstScan = firstScanEnd(jpeg);
+                printf("%-10s %-12s %10zu %10.2f %9.0f%% %11.1f%% %10.2f\n", frame == 0 ? "gradient" : "busy",
+                       mode == 0 ? "baseline" : mode == 1 ? "spectral" : "successive", jpeg.size(), cycles / 1e6,
+                       100 * (double(cycles) / baselineCycles - 1), 100.0 * firstScan / jpeg.size(),
+                       mode == 0 ? 0 : extraMegabytes);
+            }
+        }
+        return 0;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    auto width       = argc > 1 ? atoi(argv[1]) : 1920;
+    auto height      = argc > 2 ? atoi(argv[2]) : 1080;
+    auto repetitions = argc > 3 ? atoi(argv[3]) : 5;
+
+    auto result = benchEntropy(width, height, repetitions);
+    if (result == 0)
+        result = benchSampling(width, height, repetitions);
+    if (result == 0)
+        result = benchSinks(width, height, repetitions);
+    if (result == 0)
+        result = benchRenditions(width, height, repetitions);
+    if (result == 0)
+        result = benchSetup(repetitions);
+    if (result == 0)
+        result = benchProgressive(width, height, repetitions);
+    return result;
+}
@@ -0,0 +1,192 @@
+#include <sched.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "admission.h"
+
+// Usage: sczr00_capacity calibrate [--output=FILE] [--resolutions=WxH,...] [--qualities=Q,...]
+//                                  [--samplings=444,422,420] [--runs=N]
+//        sczr00_capacity admit TABLE [--cpus=N] [--cpu-share=F] [--core-bound=F] [--margin=X] [--min-quality=Q]
+//                                    STREAM...
+// calibrate times the encoder on this host and writes the cost table (default capacity.txt).
+// admit registers the streams ("WxH@FPS[:qQ][:444|422|420]") one after another, as a host would when they are added,
+// and prints the decision for each one; the exit code is 1 if any stream was rejected.
+
+namespace
+{
+    bool option(const char *arg, const std::string &name, std::string &value)
+    {
+        auto prefix = "--" + name + "=";
+        if (strncmp(arg, prefix.c_str(), prefix.size()) != 0)
+            return false;
+        value = arg + prefix.size();
+        return true;
+    }
+
+    std::vector<std::string> split(const std::string &list)
+    {
+        std::vector<std::string> items;
+        std::istringstream fields(list);
+        std::string item;
+        while (std::getline(fields, item, ','))
+            items.push_back(item);
+        return items;
+    }
+
+    void print_cost(const Admission::Cost &cost)
+    {
+        printf("%5dx%-5d %7d %8s %10.2f %10.2f\n", cost.width, cost.height, cost.quality,
+               Admission::to_string(cost.sampling).c_str(), cost.median_ns / 1e6, cost.max_ns / 1e6);
+        fflush(stdout);
+    }
+
+    int calibrate(int argc, char *argv[])
+    {
+        Admission::Calibration calibration;
+        std::string output = "capacity.txt";
+        for (int i = 2; i < argc; i++)
+        {
+            std::string value;
+            auto valid = true;
+            if (option(argv[i], "output", value))
+                output = value;
+            else if (option(argv[i], "resolutions", value))
+            {
+                calibration.resolutions.clear();
+                for (auto &item : split(value))
+                {
+                    int width = 0, height = 0;
+                    valid = valid && sscanf(item.c_str(), "%dx%d", &width, &height) == 2 && width > 0 && height > 0 &&
+                            width <= 65535 && height <= 65535;
+                    calibration.resolutions.push_back({width, height});
+                }
+            }
+            else if (option(argv[i], "qualities", value))
+            {
+                calibration.qualities.clear();
+                for (auto &item : split(value))
+                {
+                    auto quality = atoi(item.c_str());
+                    valid = valid && quality >= 1 && quality <= 100;
+                    calibration.qualities.push_back(quality);
+                }
+            }
+            else if (option(argv[i], "samplings", value))
+            {
+                calibration.samplings.clear();
+                for (auto &item : split(value))
+                {
+                    auto sampling = TooJpeg::YCbCr444;
+                    valid = valid && Admission::parse_sampling(item, sampling);
+                    calibration.samplings.push_back(sampling);
+                }
+            }
+            else if (option(argv[i], "runs", value))
+                valid = (calibration.runs = atoi(value.c_str())) > 0;
+            else
+            {
+                fprintf(stderr, "Unknown option: %s\n", argv[i]);
+                return 2;
+            }
+            if (!valid || calibration.resolutions.empty() || calibration.qualities.empty() || calibration.samplings.empty())
+            {
+                fprintf(stderr, "Invalid option: %s\n", argv[i]);
+                return 2;
+            }
+        }
+
+        printf("%11s %7s %8s %10s %10s\n", "resolution", "quality", "sampling", "median ms", "max ms");
+        auto table = Admission::calibrate(calibration, print_cost);
+        std::string error;
+        if (!table.save(output, error))
+        {
+            fprintf(stderr, "%s\n", error.c_str());
+            return 1;
+        }
+        printf("Wrote %zu costs to %s\n", table.costs.size(), output.c_str());
+        return 0;
+    }
+
+    int admit(int argc, char *argv[])
+    {
+        if (argc < 3)
+        {
+            fprintf(stderr, "admit: missing capacity table\n");
+            return 2;
+        }
+        Admission::Table table;
+        std::string error;
+        if (!table.load(argv[2], error))
+        {
+            fprintf(stderr, "%s\n", error.c_str());
+            return 1;
+        }
+
+        Admission::Budget budget;
+        auto allowed = RealTime::allowed_cpus();
+        budget.cpus = CPU_COUNT(&allowed);
+        budget.core_bound = Admission::kernel_bound();
+        std::vector<Admission::Stream> streams;
+        for (int i = 3; i < argc; i++)
+        {
+            std::string value;
+            Admission::Stream stream;
+            if (option(argv[i], "cpus", value))
+                budget.cpus = atoi(value.c_str());
+            else if (option(argv[i], "cpu-share", value))
+                budget.cpu_share = atof(value.c_str());
+            else if (option(argv[i], "core-bound", value))
+                budget.core_bound = atof(value.c_str());
+            else if (option(argv[i], "margin", value))
+                budget.margin = atof(value.c_str());
+            else if (option(argv[i], "min-quality", value))
+                budget.min_quality = atoi(value.c_str());
+            else if (Admission::parse_stream(argv[i], stream))
+                streams.push_back(stream);
+            else
+            {
+                fprintf(stderr, "Invalid stream or option: %s\n", argv[i]);
+                return 2;
+            }
+        }
+        if (budget.cpus < 1 || budget.cpu_share <= 0 || budget.core_bound <= 0 || budget.margin <= 0)
+        {
+            fprintf(stderr, "Invalid budget\n");
+            return 2;
+        }
+
+        printf("Budget: %d cpus, %.0f%% CPU share, EDF bound %.0f%% per core, runtime margin %.2f\n",
+               budget.cpus, budget.cpu_share * 100, budget.core_bound * 100, budget.margin);
+        Admission::Controller controller(table, budget);
+        auto rejected = 0;
+        for (auto &stream : streams)
+        {
+            auto decision = controller.admit(stream);
+            printf("%s\n", decision.to_string().c_str());
+            if (decision.kind == Admission::Decision::REJECT)
+                rejected++;
+        }
+
+        printf("Utilisation: %.1f%% of %d cpus, per core:", controller.total_utilization() * 100, budget.cpus);
+        for (auto utilization : controller.core_utilization())
+            printf(" %.1f%%", utilization * 100);
+        printf("\n");
+        return rejected > 0 ? 1 : 0;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc >= 2 && strcmp(argv[1], "calibrate") == 0)
+        return calibrate(argc, argv);
+    if (argc >= 2 && strcmp(argv[1], "admit") == 0)
+        return admit(argc, argv);
+    fprintf(stderr, "Usage: %s calibrate [--output=FILE] [--resolutions=WxH,...] [--qualities=Q,...] "
+                    "[--samplings=444,422,420] [--runs=N]\n"
+                    "       %s admit TABLE [--cpus=N] [--cpu-share=F] [--core-bound=F] [--margin=X] [--min-quality=Q] "
+                    "STREAM...\n", argv[0], argv[0]);
+    return 2;
+}
@@ -0,0 +1,148 @@
+#include <cstring>
+#include "framecache.h"
+
+namespace FrameCache
+{
+    namespace
+    {
+        // xxHash64 constants and round function
+        const uint64_t PRIME1 = 0x9E3779B185EBCA87ULL;
+        const uint64_t PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+        const uint64_t PRIME3 = 0x165667B19E3779F9ULL;
+        const uint64_t PRIME4 = 0x85EBCA77C2B2AE63ULL;
+        const uint64_t PRIME5 = 0x27D4EB2F165667C5ULL;
+
+        inline uint64_t rotate(uint64_t value, int bits)
+        {
+            return (value << bits) | (value >> (64 - bits));
+        }
+
+        inline uint64_t load64(const unsigned char *bytes)
+        {
+            uint64_t value;
+            memcpy(&value, bytes, sizeof(value)); // unaligned, compiles to a single load
+            return value;
+        }
+
+        inline uint64_t round(uint64_t accumulator, uint64_t input)
+        {
+            return rotate(accumulator + input * PRIME2, 31) * PRIME1;
+        }
+
+        inline uint64_t merge(uint64_t accumulator, uint64_t lane)
+        {
+            return (accumulator ^ round(0, lane)) * PRIME1 + PRIME4;
+        }
+    }
+
+    uint64_t hash(const unsigned char *pixels, size_t size)
+    {
+        auto end = pixels + size;
+        uint64_t result;
+        if (size >= 32)
+        {
+            // four lanes keep the multipliers busy, the frame is read once at memory speed
+            uint64_t lane1 = PRIME1 + PRIME2, lane2 = PRIME2, lane3 = 0, lane4 = 0 - PRIME1;
+            for (; pixels + 32 <= end; pixels += 32)
+            {
+                lane1 = round(lane1, load64(pixels));
+                lane2 = round(lane2, load64(pixels + 8));
+                lane3 = round(lane3, load64(pixels + 16));
+                lane4 = round(lane4, load64(pixels + 24));
+            }
+            result = rotate(lane1, 1) + rotate(lane2, 7) + rotate(lane3, 12) + rotate(lane4, 18);
+            result = merge(merge(merge(merge(result, lane1), lane2), lane3), lane4);
+        }
+        else
+            result = PRIME5;
+        result += size;
+
+        for (; pixels + 8 <= end; pixels += 8)
+            result = rotate(result ^ round(0, load64(pixels)), 27) * PRIME1 + PRIME4;
+        for (; pixels < end; pixels++)
+            result = rotate(result ^ (*pixels * PRIME5), 11) * PRIME1;
+
+        result ^= result >> 33;
+        result *= PRIME2;
+        result ^= result >> 29;
+        result *= PRIME3;
+        result ^= result >> 32;
+        return result;
+    }
+
+    bool Key::operator==(const Key &other) const
+    {
+        return pixels == other.pixels && width == other.width && height == other.height && quality == other.quality &&
+               is_rgb == other.is_rgb && sampling == other.sampling;
+    }
+
+    size_t KeyHash::operator()(const Key &key) const
+    {
+        // the pixel hash is already well mixed, fold the parameters in
+        return size_t(key.pixels ^ (uint64_t(key.width) << 40) ^ (uint64_t(key.height) << 20) ^
+                      (uint64_t(key.quality) << 3) ^ (key.is_rgb ? 4 : 0) ^ uint64_t(key.sampling));
+    }
+
+    double Stats::hit_rate() const
+    {
+        return hits + misses > 0 ? double(hits) / (hits + misses) : 0;
+    }
+
+    std::string Stats::to_string() const
+    {
+        return "hits: " + std::to_string(hits) + ", misses: " + std::to_string(misses) +
+               " (hit rate " + std::to_string(int(100 * hit_rate())) + "%)" +
+               ", insertions: " + std::to_string(insertions) + ", evictions: " + std::to_string(evictions) +
+               ", entries: " + std::to_string(entries) + ", " + std::to_string(bytes) + " bytes";
+    }
+
+    Jpeg Cache::find(const Key &key)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = index.find(key);
+        if (found == index.end())
+        {
+            current.misses++;
+            return nullptr;
+        }
+        current.hits++;
+        entries.splice(entries.begin(), entries, found->second);
+        return found->second->second;
+    }
+
+    int Cache::insert(const Key &key, const std::vector<unsigned char> &jpeg)
+    {
+        if (jpeg.size() > budget)
+            return 0;
+        // copied outside the lock, the encoder threads only wait for the list update
+        auto copy = std::make_shared<const std::vector<unsigned char>>(jpeg);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (index.count(key))
+            return 0; // another thread encoded the same frame meanwhile
+
+        auto evicted = 0;
+        while (!entries.empty() && current.bytes + jpeg.size() > budget)
+        {
+            auto &oldest = entries.back();
+            current.bytes -= oldest.second->size();
+            index.erase(oldest.first);
+            entries.pop_back();
+            evicted++;
+        }
+        entries.emplace_front(key, copy);
+        index[key] = entries.begin();
+
+        current.bytes += jpeg.size();
+        current.insertions++;
+        current.evictions += evicted;
+        current.entries = long(entries.size());
+        return evicted;
+    }
+
+    Stats Cache::stats()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return current;
+    }
+}
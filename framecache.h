@@ -0,0 +1,79 @@
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "toojpeg.h"
+
+#ifndef SCZR00_FRAMECACHE_H
+#define SCZR00_FRAMECACHE_H
+
+// Encoded frames keyed by a hash of the input pixels and the encoder parameters. Static scenes and the synthetic
+// gradient repeat byte-identical frames, a hit costs one pass over the pixels instead of a full encode.
+// Least recently used entries are evicted when the JPEG bytes exceed the budget.
+namespace FrameCache
+{
+    // 64 bit hash of the frame, 8 bytes per step in four independent lanes
+    uint64_t hash(const unsigned char *pixels, size_t size);
+
+    struct Key
+    {
+        uint64_t pixels; // hash(), see above
+        int width;
+        int height;
+        int quality;
+        bool is_rgb;
+        TooJpeg::Sampling sampling;
+
+        bool operator==(const Key &other) const;
+    };
+
+    struct KeyHash
+    {
+        size_t operator()(const Key &key) const;
+    };
+
+    typedef std::shared_ptr<const std::vector<unsigned char>> Jpeg;
+
+    struct Stats
+    {
+        long hits = 0;
+        long misses = 0;
+        long insertions = 0;
+        long evictions = 0;
+        long entries = 0;
+        size_t bytes = 0;
+
+        double hit_rate() const;
+        std::string to_string() const;
+    };
+
+    // Thread safe, shared by all encoder threads of the client
+    class Cache
+    {
+    public:
+        explicit Cache(size_t budget_bytes) : budget(budget_bytes) {}
+
+        // cached JPEG or nullptr, a hit becomes the most recently used entry
+        Jpeg find(const Key &key);
+
+        // returns the number of entries evicted to make room, frames larger than the budget are not cached
+        int insert(const Key &key, const std::vector<unsigned char> &jpeg);
+
+        Stats stats();
+
+    private:
+        typedef std::list<std::pair<Key, Jpeg>> Entries; // most recently used first
+
+        size_t budget;
+        std::mutex mutex;
+        Entries entries;
+        std::unordered_map<Key, Entries::iterator, KeyHash> index;
+        Stats current;
+    };
+}
+
+#endif //SCZR00_FRAMECACHE_H
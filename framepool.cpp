@@ -0,0 +1,208 @@
+#include <sys/mman.h>
+#include <unistd.h>
+#include <new>
+#include <utility>
+#include "framepool.h"
+
+namespace FramePool
+{
+    // Shared between processes, lives at the start of the mapping
+    struct Pool::Header
+    {
+        size_t slot_size;
+        long slots;
+        bool huge_pages;
+        bool transparent_huge_pages;
+        std::atomic<long> in_use;
+        std::atomic<long> peak_in_use;
+        std::atomic<long> acquired;
+        std::atomic<long> exhausted;
+        std::atomic<long> next;        // where the next search for a free slot starts
+
+        std::atomic<int> *references() { return (std::atomic<int> *) (this + 1); }
+    };
+
+    namespace
+    {
+        size_t round_up(size_t value, size_t multiple)
+        {
+            return (value + multiple - 1) / multiple * multiple;
+        }
+    }
+
+    std::string Stats::to_string() const
+    {
+        return "slots: " + std::to_string(in_use) + "/" + std::to_string(slots) +
+               " in use (peak " + std::to_string(peak_in_use) + ")" +
+               ", slot size: " + std::to_string(slot_size) + " B" +
+               ", ceiling: " + std::to_string(slots * slot_size) + " B" +
+               ", acquired: " + std::to_string(acquired) +
+               ", exhausted: " + std::to_string(exhausted) +
+               ", pages: " + (huge_pages ? "hugetlb" : transparent_huge_pages ? "thp" : "4k");
+    }
+
+    Pool *Pool::create(size_t slot_size, size_t max_bytes, bool huge_pages)
+    {
+        const size_t page = sysconf(_SC_PAGESIZE);
+        const size_t alignment = huge_pages ? HUGE_PAGE_SIZE : page;
+        slot_size = round_up(slot_size, page);
+
+        // the ceiling covers the frame buffers, bookkeeping comes on top
+        auto slots = long(max_bytes / slot_size);
+        if (slots < 1)
+            return nullptr;
+
+        auto header_size = round_up(sizeof(Header) + slots * sizeof(std::atomic<int>), alignment);
+        auto total = round_up(header_size + slots * slot_size, alignment);
+
+        // MAP_SHARED: producer and client see the same slots after fork()
+        void *memory = MAP_FAILED;
+        auto hugetlb = false;
+        if (huge_pages)
+        {
+            memory = mmap(nullptr, total, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            hugetlb = memory != MAP_FAILED;
+        }
+        if (memory == MAP_FAILED)
+            memory = mmap(nullptr, total, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED)
+            return nullptr;
+
+        // no reserved huge pages: ask for transparent huge pages instead (needs shmem_enabled=advise or always)
+        auto thp = false;
+        if (huge_pages && !hugetlb)
+            thp = madvise(memory, total, MADV_HUGEPAGE) == 0;
+
+        auto header = new (memory) Header;
+        header->slot_size = slot_size;
+        header->slots = slots;
+        header->huge_pages = hugetlb;
+        header->transparent_huge_pages = thp;
+        header->in_use = 0;
+        header->peak_in_use = 0;
+        header->acquired = 0;
+        header->exhausted = 0;
+        header->next = 0;
+        for (long i = 0; i < slots; i++)
+            new (&header->references()[i]) std::atomic<int>(0);
+
+        // Prefault all frame buffers now instead of inside the real-time path
+        auto data = (unsigned char *) memory + header_size;
+        for (size_t offset = 0; offset < slots * slot_size; offset += page)
+            data[offset] = 0;
+
+        return new Pool(header, data);
+    }
+
+    Handle Pool::acquire()
+    {
+        auto references = header->references();
+        auto start = header->next.load(std::memory_order_relaxed);
+        for (long i = 0; i < header->slots; i++)
+        {
+            auto slot = int((start + i) % header->slots);
+            int expected = 0;
+            if (references[slot].load(std::memory_order_relaxed) == 0 &&
+                references[slot].compare_exchange_strong(expected, 1, std::memory_order_acquire))
+            {
+                header->next.store(slot + 1, std::memory_order_relaxed);
+                header->acquired++;
+                auto in_use = ++header->in_use;
+                auto peak = header->peak_in_use.load();
+                while (in_use > peak && !header->peak_in_use.compare_exchange_weak(peak, in_use));
+                return Handle(this, slot);
+            }
+        }
+        header->exhausted++;
+        return Handle();
+    }
+
+    Handle Pool::adopt(int slot)
+    {
+        if (slot < 0 || slot >= header->slots)
+            return Handle();
+        return Handle(this, slot);
+    }
+
+    void Pool::retain(int slot)
+    {
+        header->references()[slot].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void Pool::release(int slot)
+    {
+        if (header->references()[slot].fetch_sub(1, std::memory_order_acq_rel) == 1)
+            header->in_use--;
+    }
+
+    unsigned char *Pool::data(int slot) const
+    {
+        return slots + size_t(slot) * header->slot_size;
+    }
+
+    size_t Pool::slot_size() const
+    {
+        return header->slot_size;
+    }
+
+    Stats Pool::stats() const
+    {
+        Stats result;
+        result.slots = header->slots;
+        result.slot_size = header->slot_size;
+        result.in_use = header->in_use;
+        result.peak_in_use = header->peak_in_use;
+        result.acquired = header->acquired;
+        result.exhausted = header->exhausted;
+        result.huge_pages = header->huge_pages;
+        result.transparent_huge_pages = header->transparent_huge_pages;
+        return result;
+    }
+
+    Handle::Handle(const Handle &other) : pool(other.pool), slot(other.slot)
+    {
+        if (valid())
+            pool->retain(slot);
+    }
+
+    Handle::Handle(Handle &&other) noexcept : pool(other.pool), slot(other.slot)
+    {
+        other.slot = INVALID_SLOT;
+    }
+
+    Handle &Handle::operator=(Handle other)
+    {
+        std::swap(pool, other.pool);
+        std::swap(slot, other.slot);
+        return *this;
+    }
+
+    Handle::~Handle()
+    {
+        release();
+    }
+
+    unsigned char *Handle::data() const
+    {
+        return valid() ? pool->data(slot) : nullptr;
+    }
+
+    size_t Handle::capacity() const
+    {
+        return valid() ? pool->slot_size() : 0;
+    }
+
+    int Handle::detach()
+    {
+        auto result = slot;
+        slot = INVALID_SLOT;
+        return result;
+    }
+
+    void Handle::release()
+    {
+        if (valid())
+            pool->release(slot);
+        slot = INVALID_SLOT;
+    }
+}
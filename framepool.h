@@ -0,0 +1,89 @@
+#include <atomic>
+#include <cstddef>
+#include <string>
+
+#ifndef SCZR00_FRAMEPOOL_H
+#define SCZR00_FRAMEPOOL_H
+
+namespace FramePool
+{
+    auto const HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+    auto const INVALID_SLOT = -1;
+
+    struct Stats
+    {
+        long slots = 0;
+        long slot_size = 0;
+        long in_use = 0;
+        long peak_in_use = 0;
+        long acquired = 0;
+        long exhausted = 0;       // acquire() calls that found no free slot
+        bool huge_pages = false;  // true if backed by MAP_HUGETLB
+        bool transparent_huge_pages = false; // true if MADV_HUGEPAGE was accepted instead
+
+        std::string to_string() const;
+    };
+
+    class Pool;
+
+    // Reference counted frame buffer, copies share the same slot
+    class Handle
+    {
+    public:
+        Handle() = default;
+        Handle(const Handle &other);
+        Handle(Handle &&other) noexcept;
+        Handle &operator=(Handle other);
+        ~Handle();
+
+        bool valid() const { return slot != INVALID_SLOT; }
+        unsigned char *data() const;
+        size_t capacity() const;
+        int index() const { return slot; }
+
+        // give up ownership without releasing the reference, e.g. to send the slot index to another process
+        int detach();
+        void release();
+
+    private:
+        friend class Pool;
+        Handle(Pool *pool, int slot) : pool(pool), slot(slot) {}
+
+        Pool *pool = nullptr;
+        int slot = INVALID_SLOT;
+    };
+
+    // Fixed number of equally sized frame buffers in one shared mapping, preallocated at startup.
+    // Created before fork(), the slots can be passed between processes by index.
+    class Pool
+    {
+    public:
+        // slot_size is rounded up to whole pages; the number of slots is max_bytes / slot_size (hard ceiling)
+        // returns nullptr if not even a single slot fits or the mapping fails
+        static Pool *create(size_t slot_size, size_t max_bytes, bool huge_pages);
+
+        // free slot with reference count 1, invalid handle if the pool is exhausted
+        Handle acquire();
+
+        // take over a reference detached in another process
+        Handle adopt(int slot);
+
+        // add / drop a reference, the slot is free again when its count reaches zero
+        void retain(int slot);
+        void release(int slot);
+
+        unsigned char *data(int slot) const;
+        size_t slot_size() const;
+
+        Stats stats() const;
+
+    private:
+        struct Header;
+        Pool(Header *header, unsigned char *slots) : header(header), slots(slots) {}
+
+        Header *header;
+        unsigned char *slots;
+    };
+}
+
+#endif //SCZR00_FRAMEPOOL_H
@@ -0,0 +1,695 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include "jpegtransform.h"
+#include "toojpeg.h"
+
+// The encoder's own tables and building blocks: ZigZagInv, generateHuffmanTable(), Codewords, BitWriter and
+// encodeQuantized() re-emit the coefficients exactly like TooJpeg writes them.
+
+namespace JpegTransform
+{
+    namespace
+    {
+        namespace Jpeg = TooJpeg::Internal;
+
+        // zig-zag position of each row-major coefficient, inverse of Jpeg::ZigZagInv
+        struct ZigZagTable
+        {
+            uint8_t position[64];
+
+            ZigZagTable()
+            {
+                for (auto i = 0; i < 64; i++)
+                    position[Jpeg::ZigZagInv[i]] = uint8_t(i);
+            }
+        };
+        const ZigZagTable ZigZag;
+
+        // ////////////////////////////////////////
+        // entropy decoding
+
+        // canonical Huffman decoding: codes up to LOOKUP_BITS long in one table lookup, longer ones by length
+        struct Decoder
+        {
+            static const int LOOKUP_BITS = 9;
+            uint16_t lookup[1 << LOOKUP_BITS]; // (length << 8) | symbol, 0 = code is longer
+            int32_t max_code[17];              // largest code of each length, -1 = none
+            int32_t value_offset[17];          // symbol index = code + value_offset[length]
+            const uint8_t *values;
+
+            bool build(const HuffmanTable &table)
+            {
+                std::fill(lookup, lookup + (1 << LOOKUP_BITS), 0);
+                values = table.values.data();
+
+                // a table comes from an untrusted file: at most 256 symbols, and all of them present
+                size_t total = 0;
+                for (auto count : table.counts)
+                    total += count;
+                if (total > 256 || total > table.values.size())
+                    return false;
+
+                int32_t code = 0;
+                int32_t index = 0;
+                for (auto length = 1; length <= 16; length++)
+                {
+                    value_offset[length] = index - code;
+                    for (auto i = 0; i < table.counts[length - 1]; i++, code++, index++)
+                    {
+                        // more codes than fit into this length
+                        if (code >= (1 << length))
+                            return false;
+                        if (length <= LOOKUP_BITS)
+                        {
+                            auto first = code << (LOOKUP_BITS - length);
+                            std::fill(lookup + first, lookup + first + (1 << (LOOKUP_BITS - length)),
+                                      uint16_t((length << 8) | values[index]));
+                        }
+                    }
+                    max_code[length] = table.counts[length - 1] ? code - 1 : -1;
+                    code <<= 1;
+                }
+                return true;
+            }
+        };
+
+        // reads the entropy coded segment, removes stuffed zero bytes and feeds zeros once a marker is reached
+        struct BitReader
+        {
+            const uint8_t *data;
+            const uint8_t *end;
+            uint64_t buffer = 0; // next bits start at the most significant bit
+            int bits = 0;
+            long padding = 0;    // zero bytes fed after the end of the data
+
+            // at least 57 bits available afterwards: a Huffman code (16 bits) and its value (11 bits) need no refill
+            void fill()
+            {
+                while (bits <= 56)
+                {
+                    uint8_t byte = 0;
+                    if (data < end && *data != 0xFF)
+                        byte = *data++;
+                    else if (data + 1 < end && data[1] == 0)
+                    {
+                        byte = 0xFF;
+                        data += 2;
+                    }
+                    else
+                        padding++;
+                    buffer |= uint64_t(byte) << (56 - bits);
+                    bits += 8;
+                }
+            }
+
+            uint32_t peek(int count) const
+            {
+                return uint32_t(buffer >> (64 - count));
+            }
+
+            void consume(int count)
+            {
+                buffer <<= count;
+                bits -= count;
+            }
+
+            // the padding is the tail of the fed bits, reading into it means the data ended too early
+            bool overrun() const
+            {
+                return bits < 8 * padding;
+            }
+
+            int decode(const Decoder &table)
+            {
+                auto code = peek(16);
+                auto entry = table.lookup[code >> (16 - Decoder::LOOKUP_BITS)];
+                if (entry)
+                {
+                    consume(entry >> 8);
+                    return entry & 0xFF;
+                }
+                for (auto length = Decoder::LOOKUP_BITS + 1; length <= 16; length++)
+                {
+                    auto prefix = int32_t(code >> (16 - length));
+                    if (prefix <= table.max_code[length])
+                    {
+                        consume(length);
+                        return table.values[prefix + table.value_offset[length]];
+                    }
+                }
+                return -1;
+            }
+
+            // value of a coefficient with the given number of bits, negative values have the leading bit cleared
+            int receive(int count)
+            {
+                if (count == 0)
+                    return 0;
+                auto value = int(peek(count));
+                consume(count);
+                return value < (1 << (count - 1)) ? value - (1 << count) + 1 : value;
+            }
+        };
+
+        bool decode_block(BitReader &reader, const Decoder &dc, const Decoder &ac, int16_t *block, int &last_dc)
+        {
+            reader.fill();
+            auto size = reader.decode(dc);
+            if (size < 0 || size > 11)
+                return false;
+            last_dc += reader.receive(size);
+            // the largest DC of 8 bit samples, so DC differences stay within the encoder's codeword table
+            if (last_dc < -1024 || last_dc > 1023)
+                return false;
+            block[0] = int16_t(last_dc);
+
+            for (auto i = 1; i < 64;)
+            {
+                reader.fill();
+                auto symbol = reader.decode(ac);
+                if (symbol < 0)
+                    return false;
+                auto zeros = symbol >> 4;
+                size = symbol & 15;
+                if (size == 0)
+                {
+                    if (zeros != 15)
+                        break; // end of block
+                    i += 16;
+                    continue;
+                }
+                i += zeros;
+                if (i > 63 || size > 10)
+                    return false;
+                block[i++] = int16_t(reader.receive(size));
+            }
+            return true;
+        }
+
+        // all blocks in the order of the entropy coded data, calls onBlock(component, block) until it returns false
+        template <typename ImageType, typename BlockHandler>
+        void for_each_block(ImageType &image, BlockHandler &&onBlock)
+        {
+            const auto mcus_x = (image.width + image.mcu_width() - 1) / image.mcu_width();
+            const auto mcus_y = (image.height + image.mcu_height() - 1) / image.mcu_height();
+            for (auto mcu_y = 0; mcu_y < mcus_y; mcu_y++)
+                for (auto mcu_x = 0; mcu_x < mcus_x; mcu_x++)
+                    for (size_t c = 0; c < image.components.size(); c++)
+                    {
+                        auto &component = image.components[c];
+                        for (auto y = 0; y < component.v; y++)
+                            for (auto x = 0; x < component.h; x++)
+                            {
+                                auto row = mcu_y * component.v + y;
+                                auto column = mcu_x * component.h + x;
+                                if (!onBlock(c, &component.blocks[64 * (size_t(row) * component.blocks_wide + column)]))
+                                    return;
+                            }
+                    }
+        }
+
+        // a Huffman table that lacks symbols cannot encode the rearranged coefficients (new DC differences and runs)
+        bool complete(const HuffmanTable &table, bool is_dc)
+        {
+            bool present[256] = {};
+            for (auto value : table.values)
+                present[value] = true;
+            for (auto size = 0; size <= (is_dc ? 11 : 10); size++)
+                for (auto zeros = 0; zeros < (is_dc ? 1 : 16); zeros++)
+                    if ((size > 0 || is_dc || zeros == 0 || zeros == 15) && !present[(zeros << 4) | size])
+                        return false;
+            return true;
+        }
+
+        void resize_blocks(Image &image)
+        {
+            const auto mcus_x = (image.width + image.mcu_width() - 1) / image.mcu_width();
+            const auto mcus_y = (image.height + image.mcu_height() - 1) / image.mcu_height();
+            for (auto &component : image.components)
+            {
+                component.blocks_wide = mcus_x * component.h;
+                component.blocks_high = mcus_y * component.v;
+                component.blocks.assign(64 * size_t(component.blocks_wide) * component.blocks_high, 0);
+            }
+        }
+
+        void put16(std::vector<uint8_t> &jpeg, int value)
+        {
+            jpeg.push_back(uint8_t(value >> 8));
+            jpeg.push_back(uint8_t(value & 0xFF));
+        }
+
+        void marker(std::vector<uint8_t> &jpeg, uint8_t id, int length)
+        {
+            jpeg.push_back(0xFF);
+            jpeg.push_back(id);
+            put16(jpeg, length);
+        }
+    }
+
+    bool parse_operation(const std::string &text, Operation &operation)
+    {
+        if (text == "90") operation = ROTATE_90;
+        else if (text == "180") operation = ROTATE_180;
+        else if (text == "270") operation = ROTATE_270;
+        else if (text == "horizontal") operation = FLIP_HORIZONTAL;
+        else if (text == "vertical") operation = FLIP_VERTICAL;
+        else if (text == "transpose") operation = TRANSPOSE;
+        else return false;
+        return true;
+    }
+
+    bool parse_crop(const std::string &text, Crop &crop)
+    {
+        Crop parsed;
+        char end = 0;
+        auto fields = sscanf(text.c_str(), "%dx%d+%d+%d%c", &parsed.width, &parsed.height, &parsed.x, &parsed.y, &end);
+        if ((fields != 2 && fields != 4) || parsed.width <= 0 || parsed.height <= 0 || parsed.x < 0 || parsed.y < 0)
+            return false;
+        crop = parsed;
+        return true;
+    }
+
+    int Image::mcu_width() const
+    {
+        auto h = 1;
+        for (auto &component : components)
+            h = std::max(h, component.h);
+        return 8 * h;
+    }
+
+    int Image::mcu_height() const
+    {
+        auto v = 1;
+        for (auto &component : components)
+            v = std::max(v, component.v);
+        return 8 * v;
+    }
+
+    bool decode(const uint8_t *jpeg, size_t size, Image &image, std::string &error)
+    {
+        image = Image();
+        if (size < 4 || jpeg[0] != 0xFF || jpeg[1] != 0xD8)
+        {
+            error = "not a JPEG file";
+            return false;
+        }
+
+        size_t pos = 2;
+        while (true)
+        {
+            if (pos >= size || jpeg[pos] != 0xFF)
+            {
+                error = "no marker at offset " + std::to_string(pos);
+                return false;
+            }
+            auto start = pos;
+            while (pos < size && jpeg[pos] == 0xFF) // fill bytes
+                pos++;
+            if (pos + 2 >= size)
+            {
+                error = "file ends before the image data";
+                return false;
+            }
+            auto id = jpeg[pos++];
+            if (id == 0x01 || (id >= 0xD0 && id <= 0xD7))
+                continue; // no length field
+            size_t length = (jpeg[pos] << 8) | jpeg[pos + 1];
+            if (length < 2 || pos + length > size)
+            {
+                error = "truncated segment at offset " + std::to_string(start);
+                return false;
+            }
+            auto segment = jpeg + pos + 2;
+            auto bytes = length - 2;
+            pos += length;
+
+            if ((id >= 0xE0 && id <= 0xEF) || id == 0xFE) // APPn, COM
+                image.segments.emplace_back(jpeg + pos - length - 2, jpeg + pos);
+            else if (id == 0xDB) // DQT
+            {
+                for (size_t i = 0; i < bytes; i += 65)
+                {
+                    auto table = segment[i] & 15;
+                    if ((segment[i] >> 4) != 0 || table > 3 || i + 65 > bytes)
+                    {
+                        error = "unsupported quantization table (16 bit or invalid)";
+                        return false;
+                    }
+                    std::copy(segment + i + 1, segment + i + 65, image.quant[table]);
+                    image.quant_defined[table] = true;
+                }
+            }
+            else if (id == 0xC4) // DHT
+            {
+                for (size_t i = 0; i < bytes;)
+                {
+                    auto type = segment[i] >> 4;
+                    auto table = segment[i] & 15;
+                    if (type > 1 || table > 3 || i + 17 > bytes)
+                    {
+                        error = "invalid Huffman table";
+                        return false;
+                    }
+                    auto &huffman = type == 0 ? image.dc[table] : image.ac[table];
+                    size_t total = 0;
+                    for (auto length = 0; length < 16; length++)
+                        total += huffman.counts[length] = segment[i + 1 + length];
+                    if (total > 256 || i + 17 + total > bytes)
+                    {
+                        error = "invalid Huffman table";
+                        return false;
+                    }
+                    huffman.values.assign(segment + i + 17, segment + i + 17 + total);
+                    huffman.defined = true;
+                    i += 17 + total;
+                }
+            }
+            else if (id == 0xC0) // SOF0, baseline
+            {
+                if (bytes < 6 || segment[0] != 8 || segment[5] == 0 || segment[5] > 4 || bytes < 6 + 3u * segment[5])
+                {
+                    error = "invalid frame header";
+                    return false;
+                }
+                image.height = (segment[1] << 8) | segment[2];
+                image.width  = (segment[3] << 8) | segment[4];
+                if (image.width == 0 || image.height == 0)
+                {
+                    error = "image size is missing (DNL marker is not supported)";
+                    return false;
+                }
+                for (auto c = 0; c < segment[5]; c++)
+                {
+                    auto field = segment + 6 + 3 * c;
+                    Component component{};
+                    component.id = field[0];
+                    component.h = field[1] >> 4;
+                    component.v = field[1] & 15;
+                    component.quant = field[2];
+                    if (component.h < 1 || component.h > 2 || component.v < 1 || component.v > 2 || component.quant > 3)
+                    {
+                        error = "unsupported sampling factors or quantization table of component " + std::to_string(c);
+                        return false;
+                    }
+                    image.components.push_back(component);
+                }
+                // a single component is never interleaved, its blocks cover the image without padding to larger MCUs
+                if (image.components.size() == 1)
+                    image.components[0].h = image.components[0].v = 1;
+            }
+            else if (id >= 0xC1 && id <= 0xCF && id != 0xC4 && id != 0xC8 && id != 0xCC)
+            {
+                char name[8];
+                snprintf(name, sizeof(name), "SOF%d", id - 0xC0);
+                error = std::string("only baseline JPEGs are supported, found ") + name;
+                return false;
+            }
+            else if (id == 0xDD) // DRI
+            {
+                if (bytes >= 2 && ((segment[0] << 8) | segment[1]) != 0)
+                {
+                    error = "restart markers are not supported";
+                    return false;
+                }
+            }
+            else if (id == 0xD9)
+            {
+                error = "no image data";
+                return false;
+            }
+            else if (id == 0xDA) // SOS, the entropy coded data follows
+            {
+                if (image.components.empty())
+                {
+                    error = "scan before frame header";
+                    return false;
+                }
+                if (bytes < 1 || segment[0] != image.components.size() || bytes < 1 + 2u * segment[0] + 3)
+                {
+                    error = "only single scan JPEGs are supported";
+                    return false;
+                }
+                for (auto c = 0; c < segment[0]; c++)
+                {
+                    auto field = segment + 1 + 2 * c;
+                    auto found = std::find_if(image.components.begin(), image.components.end(),
+                                              [field](const Component &component) { return component.id == field[0]; });
+                    if (found == image.components.end() || (field[1] >> 4) > 3 || (field[1] & 15) > 3)
+                    {
+                        error = "invalid scan header";
+                        return false;
+                    }
+                    found->dc_table = field[1] >> 4;
+                    found->ac_table = field[1] & 15;
+                }
+                auto spectral = segment + 1 + 2 * segment[0];
+                if (spectral[0] != 0 || spectral[1] != 63 || spectral[2] != 0)
+                {
+                    error = "only sequential scans are supported";
+                    return false;
+                }
+                break;
+            }
+        }
+
+        std::vector<Decoder> decoders(2 * image.components.size());
+        for (size_t c = 0; c < image.components.size(); c++)
+        {
+            auto &component = image.components[c];
+            auto &dc = image.dc[component.dc_table];
+            auto &ac = image.ac[component.ac_table];
+            if (!image.quant_defined[component.quant] || !dc.defined || !ac.defined)
+            {
+                error = "missing tables for component " + std::to_string(c);
+                return false;
+            }
+            if (!complete(dc, true) || !complete(ac, false))
+            {
+                error = "incomplete Huffman tables (optimized tables are not supported)";
+                return false;
+            }
+            if (!decoders[2 * c].build(dc) || !decoders[2 * c + 1].build(ac))
+            {
+                error = "invalid Huffman table";
+                return false;
+            }
+        }
+        resize_blocks(image);
+
+        BitReader reader{jpeg + pos, jpeg + size};
+        int last_dc[4] = {0, 0, 0, 0};
+        auto ok = true;
+        for_each_block(image, [&](size_t c, int16_t *block)
+        {
+            ok = decode_block(reader, decoders[2 * c], decoders[2 * c + 1], block, last_dc[c]) && !reader.overrun();
+            return ok;
+        });
+        if (!ok)
+        {
+            error = "corrupt or truncated image data";
+            return false;
+        }
+        return true;
+    }
+
+    bool apply(Image &image, Operation operation, std::string &error)
+    {
+        // every operation is a transposition followed by mirroring the result horizontally and/or vertically
+        auto transpose = operation == ROTATE_90 || operation == ROTATE_270 || operation == TRANSPOSE;
+        auto mirror_x  = operation == ROTATE_90 || operation == ROTATE_180 || operation == FLIP_HORIZONTAL;
+        auto mirror_y  = operation == ROTATE_180 || operation == ROTATE_270 || operation == FLIP_VERTICAL;
+        if (operation == NONE)
+            return true;
+
+        // source coefficient and sign of each output coefficient, zig-zag order: transposing swaps the frequencies,
+        // mirroring negates the odd horizontal (u) or vertical (v) frequencies
+        uint8_t source[64];
+        int16_t sign[64];
+        for (auto i = 0; i < 64; i++)
+        {
+            auto natural = Jpeg::ZigZagInv[i];
+            auto v = natural / 8;
+            auto u = natural % 8;
+            source[i] = ZigZag.position[transpose ? u * 8 + v : natural];
+            sign[i] = int16_t(((mirror_x && (u & 1)) != (mirror_y && (v & 1))) ? -1 : 1);
+        }
+
+        Image result;
+        result.segments = image.segments;
+        std::copy(&image.dc[0], &image.dc[0] + 4, result.dc);
+        std::copy(&image.ac[0], &image.ac[0] + 4, result.ac);
+        std::copy(image.quant_defined, image.quant_defined + 4, result.quant_defined);
+        for (auto table = 0; table < 4; table++)
+            for (auto i = 0; i < 64; i++)
+                result.quant[table][i] = image.quant[table][transpose ? source[i] : i];
+        result.width  = transpose ? image.height : image.width;
+        result.height = transpose ? image.width : image.height;
+        result.components = image.components;
+        for (auto &component : result.components)
+            if (transpose)
+                std::swap(component.h, component.v);
+
+        // a partial MCU would end up at the left/top edge, where it cannot be represented: drop it
+        if (mirror_x)
+            result.width -= result.width % result.mcu_width();
+        if (mirror_y)
+            result.height -= result.height % result.mcu_height();
+        if (result.width == 0 || result.height == 0)
+        {
+            error = "image is smaller than one MCU";
+            return false;
+        }
+        resize_blocks(result);
+
+        for (size_t c = 0; c < result.components.size(); c++)
+        {
+            auto &from = image.components[c];
+            auto &to = result.components[c];
+            for (auto y = 0; y < to.blocks_high; y++)
+                for (auto x = 0; x < to.blocks_wide; x++)
+                {
+                    auto mirrored_x = mirror_x ? to.blocks_wide - 1 - x : x;
+                    auto mirrored_y = mirror_y ? to.blocks_high - 1 - y : y;
+                    auto from_x = transpose ? mirrored_y : mirrored_x;
+                    auto from_y = transpose ? mirrored_x : mirrored_y;
+                    auto input = &from.blocks[64 * (size_t(from_y) * from.blocks_wide + from_x)];
+                    auto output = &to.blocks[64 * (size_t(y) * to.blocks_wide + x)];
+                    for (auto i = 0; i < 64; i++)
+                        output[i] = int16_t(input[source[i]] * sign[i]);
+                }
+        }
+        image = std::move(result);
+        return true;
+    }
+
+    bool crop(Image &image, const Crop &rectangle, std::string &error)
+    {
+        if (rectangle.width == 0)
+            return true;
+        // the corner moves to the MCU boundary, the requested right/bottom edge stays
+        auto x = rectangle.x - rectangle.x % image.mcu_width();
+        auto y = rectangle.y - rectangle.y % image.mcu_height();
+        if (rectangle.x < 0 || rectangle.y < 0 || rectangle.width <= 0 || rectangle.height <= 0 ||
+            x >= image.width || y >= image.height)
+        {
+            error = "crop rectangle is outside of the image";
+            return false;
+        }
+
+        Image result;
+        result.segments = image.segments;
+        std::copy(&image.dc[0], &image.dc[0] + 4, result.dc);
+        std::copy(&image.ac[0], &image.ac[0] + 4, result.ac);
+        for (auto table = 0; table < 4; table++)
+            std::copy(image.quant[table], image.quant[table] + 64, result.quant[table]);
+        std::copy(image.quant_defined, image.quant_defined + 4, result.quant_defined);
+        result.width = std::min(rectangle.x + rectangle.width, image.width) - x;
+        result.height = std::min(rectangle.y + rectangle.height, image.height) - y;
+        result.components = image.components;
+        resize_blocks(result);
+
+        for (size_t c = 0; c < result.components.size(); c++)
+        {
+            auto &from = image.components[c];
+            auto &to = result.components[c];
+            auto offset_x = x / image.mcu_width() * from.h;
+            auto offset_y = y / image.mcu_height() * from.v;
+            for (auto row = 0; row < to.blocks_high; row++)
+            {
+                auto input = &from.blocks[64 * (size_t(offset_y + row) * from.blocks_wide + offset_x)];
+                std::copy(input, input + 64 * to.blocks_wide, &to.blocks[64 * size_t(row) * to.blocks_wide]);
+            }
+        }
+        image = std::move(result);
+        return true;
+    }
+
+    void encode(const Image &image, std::vector<uint8_t> &jpeg)
+    {
+        jpeg.clear();
+        jpeg.push_back(0xFF);
+        jpeg.push_back(0xD8); // SOI
+        for (auto &segment : image.segments)
+            jpeg.insert(jpeg.end(), segment.begin(), segment.end());
+
+        for (auto table = 0; table < 4; table++)
+            if (image.quant_defined[table])
+            {
+                marker(jpeg, 0xDB, 2 + 1 + 64);
+                jpeg.push_back(uint8_t(table));
+                jpeg.insert(jpeg.end(), image.quant[table], image.quant[table] + 64);
+            }
+
+        auto components = int(image.components.size());
+        marker(jpeg, 0xC0, 2 + 6 + 3 * components);
+        jpeg.push_back(8);
+        put16(jpeg, image.height);
+        put16(jpeg, image.width);
+        jpeg.push_back(uint8_t(components));
+        for (auto &component : image.components)
+        {
+            jpeg.push_back(component.id);
+            jpeg.push_back(uint8_t((component.h << 4) | component.v));
+            jpeg.push_back(uint8_t(component.quant));
+        }
+
+        // the encoder's Huffman codes for the tables of the input file
+        Jpeg::BitCode huffmanDC[4][256];
+        Jpeg::BitCode huffmanAC[4][256];
+        for (auto type = 0; type < 2; type++)
+            for (auto table = 0; table < 4; table++)
+            {
+                auto &huffman = type == 0 ? image.dc[table] : image.ac[table];
+                if (!huffman.defined)
+                    continue;
+                marker(jpeg, 0xC4, 2 + 1 + 16 + int(huffman.values.size()));
+                jpeg.push_back(uint8_t((type << 4) | table));
+                jpeg.insert(jpeg.end(), huffman.counts, huffman.counts + 16);
+                jpeg.insert(jpeg.end(), huffman.values.begin(), huffman.values.end());
+                Jpeg::generateHuffmanTable(huffman.counts, huffman.values.data(),
+                                           type == 0 ? huffmanDC[table] : huffmanAC[table]);
+            }
+        auto codewords = Jpeg::Codewords;
+
+        marker(jpeg, 0xDA, 2 + 1 + 2 * components + 3);
+        jpeg.push_back(uint8_t(components));
+        for (auto &component : image.components)
+        {
+            jpeg.push_back(component.id);
+            jpeg.push_back(uint8_t((component.dc_table << 4) | component.ac_table));
+        }
+        jpeg.push_back(0);  // spectral selection 0..63
+        jpeg.push_back(63);
+        jpeg.push_back(0);  // no successive approximation
+
+        auto output = [&jpeg](uint8_t oneByte) { jpeg.push_back(oneByte); };
+        Jpeg::BitWriter<decltype(output)&> writer(output);
+        int16_t last_dc[4] = {0, 0, 0, 0};
+        for_each_block(image, [&](size_t c, const int16_t *block)
+        {
+            auto &component = image.components[c];
+            auto last = 63;
+            while (last > 0 && block[last] == 0)
+                last--;
+            last_dc[c] = Jpeg::encodeQuantized(writer, block, last, last_dc[c], huffmanDC[component.dc_table],
+                                               huffmanAC[component.ac_table], codewords);
+            return true;
+        });
+        writer.flush();
+        jpeg.push_back(0xFF);
+        jpeg.push_back(0xD9); // EOI
+    }
+
+    bool transform(const std::vector<uint8_t> &input, Operation operation, const Crop &rectangle,
+                   std::vector<uint8_t> &output, std::string &error)
+    {
+        Image image;
+        if (!decode(input.data(), input.size(), image, error) || !apply(image, operation, error) ||
+            !crop(image, rectangle, error))
+            return false;
+        encode(image, output);
+        return true;
+    }
+}
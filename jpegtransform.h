@@ -0,0 +1,91 @@
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#ifndef SCZR00_JPEGTRANSFORM_H
+#define SCZR00_JPEGTRANSFORM_H
+
+// Lossless crop, rotation and flips of baseline JPEGs. The entropy coded data is decoded to quantized DCT coefficients
+// only, blocks are moved and their coefficients transposed or negated, and the result is Huffman-coded again with the
+// tables of the input. There is no IDCT/DCT and no requantization, so the pixels do not change.
+// Reads single scan baseline files as written by TooJpeg (any Huffman and quantization tables, no restart markers).
+namespace JpegTransform
+{
+    enum Operation
+    {
+        NONE,
+        ROTATE_90,       // clockwise
+        ROTATE_180,
+        ROTATE_270,
+        FLIP_HORIZONTAL, // mirror left <-> right
+        FLIP_VERTICAL,   // mirror top <-> bottom
+        TRANSPOSE        // mirror along the top-left to bottom-right diagonal
+    };
+
+    // "90", "180", "270", "horizontal", "vertical" or "transpose"
+    bool parse_operation(const std::string &text, Operation &operation);
+
+    // pixel rectangle, the corner is moved up/left to the closest MCU boundary; width = 0 keeps the whole image
+    struct Crop
+    {
+        int x = 0;
+        int y = 0;
+        int width = 0;
+        int height = 0;
+    };
+
+    // "WxH+X+Y" (the offset is optional)
+    bool parse_crop(const std::string &text, Crop &crop);
+
+    struct HuffmanTable
+    {
+        uint8_t counts[16]; // number of codes per length 1..16, as stored in the DHT segment
+        std::vector<uint8_t> values;
+        bool defined = false;
+    };
+
+    struct Component
+    {
+        uint8_t id;
+        int h;              // sampling factors
+        int v;
+        int quant;          // quantization table
+        int dc_table;       // Huffman tables
+        int ac_table;
+        int blocks_wide;    // whole MCUs, including the blocks beyond the right/bottom border
+        int blocks_high;
+        std::vector<int16_t> blocks; // 64 quantized coefficients per block in zig-zag order, row by row
+    };
+
+    struct Image
+    {
+        int width = 0;
+        int height = 0;
+        std::vector<std::vector<uint8_t>> segments; // APPn and COM segments (marker included), written back unchanged
+        uint8_t quant[4][64];                       // zig-zag order
+        bool quant_defined[4] = {false, false, false, false};
+        HuffmanTable dc[4];
+        HuffmanTable ac[4];
+        std::vector<Component> components;
+
+        // MCU size in pixels
+        int mcu_width() const;
+        int mcu_height() const;
+    };
+
+    // entropy decode, returns false and sets error if the file is not a supported baseline JPEG
+    bool decode(const uint8_t *jpeg, size_t size, Image &image, std::string &error);
+
+    // edges that end up on the left or top are trimmed to whole MCUs, a partial MCU cannot be moved there
+    bool apply(Image &image, Operation operation, std::string &error);
+    bool crop(Image &image, const Crop &rectangle, std::string &error);
+
+    // Huffman-code the image again, output is a complete JPEG file
+    void encode(const Image &image, std::vector<uint8_t> &jpeg);
+
+    // decode, rotate/flip, crop and encode
+    bool transform(const std::vector<uint8_t> &input, Operation operation, const Crop &rectangle,
+                   std::vector<uint8_t> &output, std::string &error);
+}
+
+#endif //SCZR00_JPEGTRANSFORM_H
@@ -0,0 +1,119 @@
+#include <algorithm>
+#include <cstdlib>
+#include <sstream>
+#include "latency.h"
+
+namespace Latency
+{
+    namespace
+    {
+        // nearest rank on sorted samples
+        long long percentile(const std::vector<long long> &sorted, double fraction)
+        {
+            if (sorted.empty())
+                return 0;
+            auto rank = size_t(fraction * (sorted.size() - 1) + 0.5);
+            return sorted[std::min(rank, sorted.size() - 1)];
+        }
+
+        std::string us(long long ns)
+        {
+            return std::to_string(ns / 1000) + " us";
+        }
+    }
+
+    double Summary::miss_rate() const
+    {
+        auto total = frames + dropped;
+        return total ? double(misses + dropped) / total : 0;
+    }
+
+    std::string Summary::to_string() const
+    {
+        return "frames: " + std::to_string(frames) +
+               ", p50: " + us(p50_ns) + ", p90: " + us(p90_ns) + ", p99: " + us(p99_ns) +
+               ", p99.9: " + us(p999_ns) + ", max: " + us(max_ns) + ", mean: " + us(mean_ns) +
+               ", misses: " + std::to_string(misses) + ", dropped: " + std::to_string(dropped) +
+               ", miss rate: " + std::to_string(100 * miss_rate()) + "%" +
+               (policy_errors ? ", policy errors: " + std::to_string(policy_errors) : "");
+    }
+
+    std::string Summary::to_record() const
+    {
+        return "frames=" + std::to_string(frames) + " misses=" + std::to_string(misses) +
+               " dropped=" + std::to_string(dropped) + " policy_errors=" + std::to_string(policy_errors) +
+               " mean_ns=" + std::to_string(mean_ns) + " p50_ns=" + std::to_string(p50_ns) +
+               " p90_ns=" + std::to_string(p90_ns) + " p99_ns=" + std::to_string(p99_ns) +
+               " p999_ns=" + std::to_string(p999_ns) + " max_ns=" + std::to_string(max_ns);
+    }
+
+    bool Summary::parse(const std::string &record, Summary &summary)
+    {
+        std::istringstream fields(record);
+        std::string field;
+        auto found = 0;
+        while (fields >> field)
+        {
+            auto equals = field.find('=');
+            if (equals == std::string::npos)
+                return false;
+            auto key = field.substr(0, equals);
+            auto value = strtoll(field.c_str() + equals + 1, nullptr, 10);
+            found++;
+            if (key == "frames") summary.frames = long(value);
+            else if (key == "misses") summary.misses = long(value);
+            else if (key == "dropped") summary.dropped = long(value);
+            else if (key == "policy_errors") summary.policy_errors = long(value);
+            else if (key == "mean_ns") summary.mean_ns = value;
+            else if (key == "p50_ns") summary.p50_ns = value;
+            else if (key == "p90_ns") summary.p90_ns = value;
+            else if (key == "p99_ns") summary.p99_ns = value;
+            else if (key == "p999_ns") summary.p999_ns = value;
+            else if (key == "max_ns") summary.max_ns = value;
+            else found--;
+        }
+        return found > 0;
+    }
+
+    void Recorder::add(long long latency_ns, bool missed)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        samples.push_back(latency_ns);
+        if (missed)
+            counts.misses++;
+    }
+
+    void Recorder::drop()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        counts.dropped++;
+    }
+
+    void Recorder::policy_error()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        counts.policy_errors++;
+    }
+
+    Summary Recorder::summary()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto result = counts;
+        auto sorted = samples;
+        std::sort(sorted.begin(), sorted.end());
+        result.frames = long(sorted.size());
+        if (!sorted.empty())
+        {
+            long long total = 0;
+            for (auto sample : sorted)
+                total += sample;
+            result.mean_ns = total / (long long) sorted.size();
+            result.p50_ns = percentile(sorted, 0.5);
+            result.p90_ns = percentile(sorted, 0.9);
+            result.p99_ns = percentile(sorted, 0.99);
+            result.p999_ns = percentile(sorted, 0.999);
+            result.max_ns = sorted.back();
+        }
+        return result;
+    }
+}
@@ -0,0 +1,50 @@
+#include <mutex>
+#include <string>
+#include <vector>
+
+#ifndef SCZR00_LATENCY_H
+#define SCZR00_LATENCY_H
+
+// End-to-end frame latency (sent by the producer -> encoded) and deadline misses of one run
+namespace Latency
+{
+    struct Summary
+    {
+        long frames = 0;        // encoded frames with a latency sample
+        long misses = 0;        // encoded after their deadline
+        long dropped = 0;       // received but never encoded
+        long policy_errors = 0; // threads that could not switch to the requested scheduling policy
+        long long mean_ns = 0;
+        long long p50_ns = 0;
+        long long p90_ns = 0;
+        long long p99_ns = 0;
+        long long p999_ns = 0;
+        long long max_ns = 0;
+
+        // misses and drops relative to all received frames
+        double miss_rate() const;
+
+        std::string to_string() const;
+
+        // single "key=value ..." line, read back by parse()
+        std::string to_record() const;
+        static bool parse(const std::string &record, Summary &summary);
+    };
+
+    class Recorder
+    {
+    public:
+        void add(long long latency_ns, bool missed);
+        void drop();
+        void policy_error();
+
+        Summary summary();
+
+    private:
+        std::mutex mutex;
+        std::vector<long long> samples;
+        Summary counts;
+    };
+}
+
+#endif //SCZR00_LATENCY_H
@@ -0,0 +1,143 @@
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include "livestats.h"
+
+namespace LiveStats
+{
+    namespace
+    {
+        Segment *map_segment(bool writable)
+        {
+            auto fd = shm_open(SEGMENT_NAME, writable ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+            if (fd < 0)
+                return nullptr;
+            // growing a fresh segment zero-fills it: every slot starts out free
+            if (writable && ftruncate(fd, sizeof(Segment)) != 0)
+            {
+                close(fd);
+                return nullptr;
+            }
+            auto memory = mmap(nullptr, sizeof(Segment), writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+            close(fd);
+            return memory == MAP_FAILED ? nullptr : (Segment *) memory;
+        }
+
+        bool alive(pid_t pid)
+        {
+            return kill(pid, 0) == 0 || errno == EPERM;
+        }
+
+        // a writer killed in the middle of an update leaves an odd sequence number behind
+        auto const READ_ATTEMPTS = 1000;
+    }
+
+    Writer *Writer::attach(int stream, const std::string &role)
+    {
+        auto segment = map_segment(true);
+        if (!segment)
+            return nullptr;
+        segment->magic = MAGIC;
+        segment->version = VERSION;
+
+        for (auto &slot : segment->slots)
+        {
+            int expected = 0;
+            if (!slot.used.compare_exchange_strong(expected, 2))
+            {
+                // reclaim slots of writers that died without detaching
+                if (expected != 1 || alive(slot.writer) || !slot.used.compare_exchange_strong(expected, 2))
+                    continue;
+            }
+
+            // 2 = being initialized, readers skip it
+            slot.sequence.store(0);
+            slot.stream = stream;
+            slot.writer = getpid();
+            strncpy(slot.role, role.c_str(), ROLE_LENGTH - 1);
+            slot.role[ROLE_LENGTH - 1] = 0;
+            for (auto &value : slot.values)
+                value.store(0, std::memory_order_relaxed);
+            slot.used.store(1, std::memory_order_release);
+            return new Writer(&slot);
+        }
+        munmap(segment, sizeof(Segment));
+        return nullptr;
+    }
+
+    void Writer::add(Counter counter, unsigned long long value)
+    {
+        add({{counter, value}});
+    }
+
+    void Writer::add(std::initializer_list<std::pair<Counter, unsigned long long>> values)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto sequence = slot->sequence.load(std::memory_order_relaxed);
+        slot->sequence.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for (auto &value : values)
+        {
+            auto &target = slot->values[value.first];
+            target.store(target.load(std::memory_order_relaxed) + value.second, std::memory_order_relaxed);
+        }
+        slot->sequence.store(sequence + 2, std::memory_order_release);
+    }
+
+    void Writer::set(Counter counter, unsigned long long value)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto sequence = slot->sequence.load(std::memory_order_relaxed);
+        slot->sequence.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        slot->values[counter].store(value, std::memory_order_relaxed);
+        slot->sequence.store(sequence + 2, std::memory_order_release);
+    }
+
+    void Writer::detach()
+    {
+        slot->used.store(0, std::memory_order_release);
+    }
+
+    const Segment *open_reader()
+    {
+        auto segment = map_segment(false);
+        if (segment && (segment->magic != MAGIC || segment->version != VERSION))
+        {
+            munmap(segment, sizeof(Segment));
+            return nullptr;
+        }
+        return segment;
+    }
+
+    bool read(const Slot &slot, Snapshot &snapshot)
+    {
+        if (slot.used.load(std::memory_order_acquire) != 1 || !alive(slot.writer))
+            return false;
+
+        snapshot.stream = slot.stream;
+        snapshot.writer = slot.writer;
+        snapshot.role.assign(slot.role, strnlen(slot.role, ROLE_LENGTH));
+
+        for (int attempt = 1; attempt <= READ_ATTEMPTS; attempt++)
+        {
+            auto before = slot.sequence.load(std::memory_order_acquire);
+            if (before & 1)
+            {
+                // writer is in the middle of an update, or died there
+                if (attempt % 100 == 0 && !alive(slot.writer))
+                    return false;
+                continue;
+            }
+            for (int i = 0; i < NUM_COUNTERS; i++)
+                snapshot.values[i] = slot.values[i].load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.sequence.load(std::memory_order_relaxed) == before)
+                return true;
+        }
+        return false;
+    }
+}
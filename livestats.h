@@ -0,0 +1,98 @@
+#include <atomic>
+#include <initializer_list>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <sys/types.h>
+
+#ifndef SCZR00_LIVESTATS_H
+#define SCZR00_LIVESTATS_H
+
+// Live counters in a shared memory segment, readable by sczr00_top without locks.
+// Every writer (producer process, client process) owns a slot protected by a seqlock;
+// a reader retries a slot while its sequence number is odd or changed during the copy.
+namespace LiveStats
+{
+    auto const SEGMENT_NAME = "/sczr00_stats";
+    auto const MAGIC = 0x53435a52u; // "SCZR"
+    auto const VERSION = 2u;
+    auto const MAX_SLOTS = 64;
+    auto const ROLE_LENGTH = 16;
+
+    enum Counter
+    {
+        PRODUCED,
+        RECEIVED,
+        ENCODED,
+        ARCHIVED,
+        DROPPED,
+        DEADLINE_MISSES,
+        ENCODE_NS,        // total time spent in the encoder
+        BYTES_OUT,
+        QUEUE_DEPTH,      // gauge, last observed value
+        CACHE_HITS,       // encoded frame cache, see FrameCache
+        CACHE_MISSES,
+        CACHE_EVICTIONS,
+        NUM_COUNTERS
+    };
+
+    const char *const COUNTER_NAMES[NUM_COUNTERS] = {
+        "produced", "received", "encoded", "archived", "dropped",
+        "deadline_misses", "encode_ns", "bytes_out", "queue_depth",
+        "cache_hits", "cache_misses", "cache_evictions"
+    };
+
+    struct Slot
+    {
+        std::atomic<int> used;            // 0 = free, 1 = claimed by a writer, 2 = being initialized
+        std::atomic<unsigned> sequence;   // odd while the writer updates values
+        int stream;                       // stream id (pid of the pipeline's main process)
+        pid_t writer;                     // process owning the slot
+        char role[ROLE_LENGTH];
+        std::atomic<unsigned long long> values[NUM_COUNTERS];
+    };
+
+    struct Segment
+    {
+        unsigned magic;
+        unsigned version;
+        Slot slots[MAX_SLOTS];
+    };
+
+    // Consistent copy of a slot
+    struct Snapshot
+    {
+        int stream;
+        pid_t writer;
+        std::string role;
+        unsigned long long values[NUM_COUNTERS];
+    };
+
+    class Writer
+    {
+    public:
+        // claim a slot for this process, nullptr if the segment is unavailable or full
+        static Writer *attach(int stream, const std::string &role);
+
+        void add(Counter counter, unsigned long long value = 1);
+        // several counters in one update, readers see all of them or none
+        void add(std::initializer_list<std::pair<Counter, unsigned long long>> values);
+        void set(Counter counter, unsigned long long value);
+        void detach();
+
+    private:
+        explicit Writer(Slot *slot) : slot(slot) {}
+
+        Slot *slot;
+        std::mutex mutex; // serializes the writer threads of one process, readers never take it
+    };
+
+    // map the segment read-only, nullptr if no pipeline created it yet
+    const Segment *open_reader();
+
+    // copy a claimed slot whose writer is still alive, false otherwise or if no consistent copy was seen
+    // within a bounded number of tries (e.g. the writer was killed in the middle of an update)
+    bool read(const Slot &slot, Snapshot &snapshot);
+}
+
+#endif //SCZR00_LIVESTATS_H
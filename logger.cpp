@@ -11,6 +11,13 @@ namespace Logger
         return std::chrono::duration_cast<std::chrono::seconds>(p1.time_since_epoch()).count();
     }
 
+    // Monotonic clock in nanoseconds, comparable between processes on the same host
+    long long now_ns()
+    {
+        const auto p1 = std::chrono::steady_clock::now();
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(p1.time_since_epoch()).count();
+    }
+
     // timestamp/process_id/task_id/source:.....message.....
     void log(int pid, int task_id, const std::string &source, const std::string &message)
     {
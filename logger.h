@@ -19,6 +19,7 @@ namespace Logger
     void log(int pid, int task_id, const std::string &source, const std::string &message);
     void logd(int pid, const std::string &source, const std::string &message);
     long timestamp();
+    long long now_ns();
 }
 
 #endif //SCZR00_LOGGER_H
\ No newline at end of file
@@ -5,13 +5,31 @@
 #include <errno.h>
 #include <cstring>
 #include <wait.h>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <vector>
 #include "toojpeg.h"
 #include "logger.h"
 #include "edf.h"
+#include "ratecontrol.h"
+#include "overload.h"
+#include "realtime.h"
+#include "framepool.h"
+#include "livestats.h"
+#include "trace.h"
+#include "perfcounters.h"
+#include "latency.h"
+#include "arrivals.h"
+#include "streamserver.h"
+#include "framecache.h"
+#include "receiver.h"
+#include "admission.h"
 
 #define MAX_MSGS 10
-#define VECTOR_SIZE 3072
 #define MAX_MSG_SIZE 8192
+#define END_OF_STREAM -1 // task id of the message that tells the client to stop
 
 // Default params
 int scenario_id = 0;
@@ -20,13 +38,91 @@ int width  = 32;
 int height = 32;
 int bytes_per_pixel = 3; // RGB
 int max_interval = 4; // 4x more than predicted speed
+long deadline_ms = 0; // frame deadline relative to sending, 0 = max_interval seconds
+int frames = 1;
+double fps = 0; // 0 = send frames as fast as possible
 
 // JPEG conversion params
 const bool is_RGB = true; // true = RGB image, else false = grayscale
-const auto quality = 90; // compression quality: 0 = worst, 100 = best, 80 to 90 are most often used
-const bool downsample = false; // false = save as YCbCr444 JPEG (better quality), true = YCbCr420 (smaller file)
+auto quality = RateControl::DEFAULT_QUALITY; // compression quality: 0 = worst, 100 = best, 80 to 90 are most often used
+auto sampling = TooJpeg::YCbCr444; // chroma subsampling: 444 = best quality, 422 or 420 = smaller files, --sampling=444|422|420
 const char* comment = "example image"; // arbitrary JPEG comment
 
+// Rate control, enabled by --target-bytes or --bitrate (with --fps)
+RateControl::Config rate_config;
+RateControl::Controller* rate_controller = nullptr;
+
+// Overload policies: --drop-late, --keep-newest=N, --degrade
+Overload::Config overload_config;
+Overload::Controller* overload = nullptr;
+
+// Frame buffers shared by producer and client: --pool-mb=N, --huge-pages
+long pool_mb = 64;
+bool huge_pages = false;
+FramePool::Pool* frame_pool = nullptr;
+
+// Real-time hardening: --mlock, --cpus-producer/receiver/encoder/archiver=LIST
+RealTime::Config rt_config;
+
+// Scheduling policy of the encoder threads: --policy=other|fifo:PRIO|rr:PRIO|deadline:RUNTIME_MS/PERIOD_MS
+// scenario 2 without --policy reserves the encode time estimated by the capacity model every frame interval
+RealTime::Policy policy;
+bool policy_set = false;
+
+// End-to-end latency and deadline misses, written to --results=FILE for sczr00_scenarios
+Latency::Recorder latencies;
+std::string results_path;
+
+// Frame sources: --input=RAW_RGB_FILE instead of the gradient, --record=FILE / --replay=FILE arrival traces
+std::string input_path;
+std::string record_path;
+std::string replay_path;
+double replay_speed = 1;
+std::vector<Arrivals::Arrival> arrivals; // frames to replay, empty = live frames
+Arrivals::Contents contents;             // raw frames referenced by --input or the replayed trace
+
+// Encoded frames for local subscribers: --serve=SOCKET_PATH, --subscriber-queue=N
+// --stream-quality=Q sends them a second, lower quality copy encoded in the same pass (0 = the archived JPEG)
+StreamServer::Config stream_config;
+StreamServer::Server* stream_server = nullptr;
+int stream_quality = 0;
+
+// Progressive frames, a viewer can show a preview after the first scan: --progressive[=spectral|SCRIPT] (empty = baseline)
+std::vector<TooJpeg::Scan> progressive_scans;
+
+// Encoded frames of repeated input, keyed by pixel hash and encoder parameters: --cache-mb=N (0 = off)
+long cache_mb = 0;
+FrameCache::Cache* frame_cache = nullptr;
+
+// Producer -> client hand-off: --receive=block|spin|hybrid:US, --receive-timeout-ms=N (0 = wait forever)
+Receiver::Policy receive_policy;
+long receive_timeout_ms = 0;
+
+// Capacity model of this host: --capacity=TABLE from sczr00_capacity (default: calibrate this run's stream at startup)
+// --admit checks the stream against --cpu-share=F of the encoder cpus and rejects or degrades it
+std::string capacity_path;
+bool admit_stream = false;
+Admission::Budget admission_budget;
+
+// Live counters for sczr00_top, one shared memory slot per process: --no-stats
+bool publish_stats = true;
+int stream_id = 0; // pid of the main process, shared by producer and client
+LiveStats::Writer* live_stats = nullptr;
+
+// Chrome trace / Perfetto JSON of all processes: --trace=FILE, SIGUSR2 writes what was recorded so far
+std::string trace_path;
+
+// Hardware counters and CPU time per stage: --perf-counters, summed over all threads of a process
+bool perf_counters = false;
+PerfCounters::Totals perf_totals;
+std::mutex perf_mutex;
+
+void addPerfTotals(const PerfCounters::Totals& totals)
+{
+    std::lock_guard<std::mutex> lock(perf_mutex);
+    perf_totals.merge(totals);
+}
+
 // current process data
 int pid = 0;
 std::string source = Source::MAIN;
@@ -34,29 +130,72 @@ std::string source = Source::MAIN;
 typedef struct Task {
     int id;
     long timestamp;
+    long long deadline; // monotonic ns, see Logger::now_ns()
+    long long sent;     // monotonic ns, just before mq_send()
+    int width;
+    int height;
     int max_interval;
-    unsigned char image[VECTOR_SIZE];
+    int frame; // FramePool slot with the image, its reference travels with the task
 } Task;
 
-// Output file
-std::ofstream file;
+// Encoded frames handed from consumer threads to the archiver thread
+typedef struct Archive {
+    int task_id;
+    std::string file_name;
+    std::vector<unsigned char> jpeg;
+    std::vector<unsigned char> stream_jpeg; // for subscribers, empty = they get jpeg
+} Archive;
+
+std::deque<Archive*> archive_queue;
+std::mutex archive_mutex;
+std::condition_variable archive_ready;
+bool archive_closed = false;
 
-// Write a single byte compressed by tooJpeg
-void output(unsigned char byte){
-    file << byte;
+void count(LiveStats::Counter counter, unsigned long long value = 1)
+{
+    if (live_stats)
+        live_stats->add(counter, value);
 }
 
-void generateImage(unsigned char image[] ){
+void attachStats(const std::string& role)
+{
+    if (!publish_stats)
+        return;
+    live_stats = LiveStats::Writer::attach(stream_id, role);
+    if (!live_stats)
+        Logger::logd(pid, source, std::string("Live stats unavailable: ") + strerror(errno));
+}
+
+// Lock memory (if enabled), pin the calling thread and report where it landed
+void harden(const std::string& role, const std::string& cpus)
+{
+    Logger::logd(pid, source, "Placement: " + RealTime::pin_thread(role, cpus));
+    if (rt_config.lock_memory)
+        RealTime::prefault_stack();
+}
+
+// Lock all pages of the calling process, must run after fork() because locks are not inherited
+void lockProcessMemory()
+{
+    if (!rt_config.lock_memory)
+        return;
+    if (!RealTime::lock_memory(rt_config.prefault_heap))
+        Logger::logd(pid, source, std::string("mlockall failed: ") + strerror(errno));
+    else
+        Logger::logd(pid, source, "Memory locked, " + std::to_string(rt_config.prefault_heap) + " bytes of heap prefaulted.");
+}
+
+void generateImage(unsigned char image[], int image_width, int image_height){
 
     // create a nice color transition (replace with your code)
-    for (auto y = 0; y < height; y++)
-        for (auto x = 0; x < width; x++)
+    for (auto y = 0; y < image_height; y++)
+        for (auto x = 0; x < image_width; x++)
         {
             // memory location of current pixel
-            auto offset = (y * width + x) * bytes_per_pixel;
+            auto offset = (y * image_width + x) * bytes_per_pixel;
             // red and green fade from 0 to 255, blue is always 127
-            image[offset] = 255 * x / width;
-            image[offset + 1] = 255 * y / height;
+            image[offset] = 255 * x / image_width;
+            image[offset + 1] = 255 * y / image_height;
             image[offset + 2] = 127;
         }
 
@@ -66,110 +205,766 @@ void generateImage(unsigned char image[] ){
 void producer(const std::string& prod_queue_name, struct mq_attr attr){
     // Global current source for logger
     source = Source::PRODUCER;
+    if (!trace_path.empty())
+        Trace::start(trace_path, "sczr00 producer");
+    Trace::name_thread("producer");
+
+    lockProcessMemory();
+    harden("producer", rt_config.producer_cpus);
+    attachStats("producer");
 
     // Open communication queue
     auto queue = mq_open(prod_queue_name.c_str(), O_WRONLY | O_CREAT , 0777, &attr);
     Logger::logd(pid, source,
                 "Opened queue. Id: " + std::to_string(queue) + ", errno: " + strerror(errno));
 
-    // New data generation
-    Task task = {
-            pid,
-            Logger::timestamp(),
-            max_interval,
-            NULL
-    };
-    generateImage(task.image);
-    // Send generated data
-    int ret = mq_send(queue, (const char *) &task, MAX_MSG_SIZE, 2);
-    Logger::log(pid, task.id, source,
-            "Sent msg. Length: " + std::to_string(sizeof(task)) +
-            ". Code result: " + std::to_string(ret) + ", " + strerror(errno) + ".");
+    PerfCounters::Thread* counters = nullptr;
+    if (perf_counters)
+    {
+        counters = new PerfCounters::Thread;
+        Logger::logd(pid, source, "Perf counters " + counters->status());
+    }
+
+    Arrivals::Recorder recorder;
+    if (!record_path.empty() && !recorder.open(record_path))
+        Logger::logd(pid, source, "Cannot record arrivals to " + record_path + ": " + strerror(errno));
+    Arrivals::Replayer replayer(replay_speed);
+    auto replay = !arrivals.empty();
+    auto live_content = input_path.empty() ? std::string(Arrivals::GRADIENT) : Arrivals::RAW_PREFIX + input_path;
+    auto total = replay ? int(arrivals.size()) : frames;
+
+    for (int i = 0; i < total; i++)
+    {
+        // Replayed frames arrive at their recorded time, live frames are paced by --fps
+        auto frame_width = width, frame_height = height;
+        auto content = live_content;
+        if (replay)
+        {
+            auto& arrival = arrivals[i];
+            replayer.wait(arrival);
+            frame_width = arrival.width;
+            frame_height = arrival.height;
+            content = arrival.content;
+        }
+        recorder.add(frame_width, frame_height, long(frame_width) * frame_height * bytes_per_pixel, content);
+
+        // New data generation
+        Task task{};
+        task.id = i;
+        task.width = frame_width;
+        task.height = frame_height;
+        task.timestamp = Logger::timestamp();
+        task.max_interval = max_interval;
+        task.deadline = Logger::now_ns() + (deadline_ms > 0 ? deadline_ms * 1000000LL : max_interval * 1000000000LL);
+
+        // Memory use is capped by the pool, a frame without a free buffer is dropped
+        auto frame = frame_pool->acquire();
+        if (!frame.valid())
+        {
+            Logger::log(pid, task.id, source, "Dropped: frame pool exhausted.");
+            count(LiveStats::DROPPED);
+            if (fps > 0 && !replay)
+                usleep(useconds_t(1000000 / fps));
+            continue;
+        }
+        {
+            Trace::Span span("generate", task.id);
+            auto pixels = contents.find(content);
+            if (pixels)
+                memcpy(frame.data(), pixels, size_t(frame_width) * frame_height * bytes_per_pixel);
+            else
+                generateImage(frame.data(), frame_width, frame_height);
+        }
+        task.frame = frame.detach();
+
+        // Send generated data
+        int ret;
+        {
+            Trace::Span span("send", task.id);
+            Trace::flow('s', task.id);
+            PerfCounters::Sample before{};
+            if (counters)
+                before = counters->read();
+            task.sent = Logger::now_ns();
+            ret = mq_send(queue, (const char *) &task, sizeof(task), 2);
+            if (counters)
+            {
+                perf_totals.add(PerfCounters::IPC, before, counters->read());
+                perf_totals.add_frame(long(frame_width) * frame_height);
+            }
+        }
+        Logger::log(pid, task.id, source,
+                "Sent msg. Length: " + std::to_string(sizeof(task)) +
+                ". Code result: " + std::to_string(ret) + ", " + strerror(errno) + ".");
+        if (ret != 0)
+        {
+            frame_pool->release(task.frame);
+            count(LiveStats::DROPPED);
+        }
+        else if (live_stats)
+        {
+            struct mq_attr state{};
+            mq_getattr(queue, &state);
+            live_stats->add(LiveStats::PRODUCED);
+            live_stats->set(LiveStats::QUEUE_DEPTH, state.mq_curmsgs);
+        }
+
+        if (fps > 0 && !replay)
+            usleep(useconds_t(1000000 / fps));
+    }
+    if (replay)
+        Logger::logd(pid, source, "Replay: " + replayer.to_string());
+
+    // Tell the client that no more frames follow
+    Task end{};
+    end.id = END_OF_STREAM;
+    end.frame = FramePool::INVALID_SLOT;
+    mq_send(queue, (const char *) &end, sizeof(end), 1);
     mq_close(queue);
 
+    if (counters)
+    {
+        Logger::logd(pid, source, "Perf counters per stage:\n" + perf_totals.to_string());
+        delete counters;
+    }
+
 }
 
 void* consumer(void* arg){
     Task* task = (Task*) arg;
+    // Released when the consumer is done, whatever path it takes
+    auto frame = frame_pool->adopt(task->frame);
+    Trace::name_thread("encoder");
+    Trace::Span span("consumer", task->id);
+    Trace::flow('t', task->id);
 
-    if (scenario_id == 2)
+    if (policy.policy != SCHED_OTHER)
     {
-        struct EDF::sched_attr attr{};
-        int x = 0, ret;
-        unsigned int flags = 0;
-
-        printf("deadline thread start %ld\n", gettid());
-
-        attr.size = sizeof(attr);
-        attr.sched_flags = 0;
-        attr.sched_nice = 0;
-        attr.sched_priority = 0;
+        if (policy.policy == SCHED_DEADLINE)
+            printf("deadline thread start %ld\n", gettid());
 
-        /* creates a 10ms/30ms reservation */
-        attr.sched_policy = SCHED_DEADLINE;
-        attr.sched_runtime = 10 * 1000 * 1000;
-        attr.sched_period = 30 * 1000 * 1000;
-        attr.sched_deadline = 30 * 1000 * 1000;
-
-        ret = EDF::sched_setattr(0, &attr, flags);
-        if (ret < 0)
+        // the frame is still encoded with the default policy, the run reports the failures
+        auto error = RealTime::apply_policy(policy);
+        if (error)
         {
-            Logger::log(pid, task->id, Source::CLIENT, "Error scheduling EDF task...");
-            exit(-1);
+            Logger::log(pid, task->id, Source::CLIENT,
+                        "Error scheduling " + RealTime::to_string(policy) + " task: " + strerror(error));
+            latencies.policy_error();
         }
     }
+    harden("encoder", rt_config.encoder_cpus);
+
+    // Encoding a frame that missed its deadline is wasted work
+    if (!overload->on_start(task->deadline, Logger::now_ns()))
+    {
+        Logger::log(pid, task->id, Source::CLIENT, "Dropped: deadline passed.");
+        if (live_stats)
+            live_stats->add({{LiveStats::DROPPED, 1}, {LiveStats::DEADLINE_MISSES, 1}});
+        latencies.drop();
+        delete task;
+        return nullptr;
+    }
+    auto settings = overload->settings();
+    auto encode_start = Logger::now_ns();
 
     // Prepare to output
     const auto file_name = "outputs/" + std::to_string(pid) + ".jpeg";
-
-    Logger::log(pid, task->id, Source::CLIENT,"Opening file: " + file_name + "...");
-    file.open(file_name, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
-    if(!file.is_open()) Logger::log(pid, task->id, Source::CLIENT,"Opening file  " + file_name + " failed");
+    // Each consumer thread compresses into its own buffer first, the sink is inlined into the encoder
+    std::vector<unsigned char> jpeg;
+    std::vector<unsigned char> stream_jpeg;
+    auto output = [&jpeg](unsigned char byte) { jpeg.push_back(byte); };
 
     // Perform output action
     Logger::log(pid, task->id, Source::ENCODER, "Starting conversion to file: " + file_name + "...");
-    auto ok = TooJpeg::writeJpeg(output, task->image, width, height, is_RGB, quality, downsample, comment);
 
-    Logger::log(pid, task->id, Source::ARCHIVER,
-                ok ? "Finished. Saved file as " + file_name : "Error saving file as " + file_name);
-    file.close();
+    // Same pixels and parameters give the same bytes; not with rate control, its quality depends on earlier frames
+    FrameCache::Key cache_key{};
+    FrameCache::Jpeg cached;
+    auto use_cache = frame_cache && !rate_controller;
+    if (use_cache)
+    {
+        Trace::Span lookup("cache lookup", task->id);
+        cache_key = FrameCache::Key{FrameCache::hash(frame.data(), size_t(task->width) * task->height * bytes_per_pixel),
+                                    task->width, task->height, settings.quality, is_RGB, settings.sampling};
+        cached = frame_cache->find(cache_key);
+        count(cached ? LiveStats::CACHE_HITS : LiveStats::CACHE_MISSES);
+    }
+
+    bool ok;
+    Trace::observe_rows(task->id);
+    if (cached)
+    {
+        jpeg.assign(cached->begin(), cached->end());
+        ok = true;
+        Logger::log(pid, task->id, Source::ENCODER, "Cache hit, " + std::to_string(jpeg.size()) + " bytes.");
+    }
+    else if (rate_controller)
+    {
+        // Colour conversion and DCT only once, the controller re-quantizes if needed
+        TooJpeg::Coefficients coefficients;
+        {
+            Trace::Span analyze("analyze", task->id);
+            ok = TooJpeg::analyzeJpeg(coefficients, frame.data(), task->width, task->height, is_RGB, settings.sampling);
+        }
+        if (ok)
+        {
+            Trace::Span encode("rate control", task->id);
+            auto chosen = rate_controller->encode(coefficients, comment, jpeg);
+            Logger::log(pid, task->id, Source::ENCODER,
+                        "Quality " + std::to_string(chosen) + ", " + std::to_string(jpeg.size()) + " bytes. " +
+                        rate_controller->stats().to_string());
+        }
+    }
+    else if (perf_counters)
+    {
+        // stage by stage, same bytes as writeJpeg()
+        Trace::Span encode("encode", task->id);
+        PerfCounters::Thread counters;
+        PerfCounters::Totals totals;
+        ok = PerfCounters::encode(counters, totals, jpeg, frame.data(), task->width, task->height, is_RGB, settings.quality,
+                                  settings.sampling, comment);
+        addPerfTotals(totals);
+    }
+    else if (stream_server && stream_quality > 0)
+    {
+        // archive and stream copy share colour conversion and DCT
+        Trace::Span encode("encode", task->id);
+        std::vector<TooJpeg::Rendition> renditions(2);
+        renditions[0].quality = (unsigned char) settings.quality;
+        renditions[1].quality = (unsigned char) stream_quality;
+        renditions[0].sampling = renditions[1].sampling = settings.sampling;
+        renditions[0].scans = renditions[1].scans = progressive_scans;
+        ok = TooJpeg::writeJpegs(renditions, frame.data(), task->width, task->height, is_RGB, comment);
+        jpeg = std::move(renditions[0].jpeg);
+        stream_jpeg = std::move(renditions[1].jpeg);
+    }
+    else if (!progressive_scans.empty())
+    {
+        Trace::Span encode("encode", task->id);
+        ok = TooJpeg::writeProgressive(output, frame.data(), task->width, task->height, progressive_scans, is_RGB,
+                                       settings.quality, settings.sampling, comment);
+    }
+    else
+    {
+        Trace::Span encode("encode", task->id);
+        ok = TooJpeg::writeJpeg(output, frame.data(), task->width, task->height, is_RGB, settings.quality, settings.sampling, comment);
+    }
+    Trace::observe_rows(Trace::NO_TASK);
+    if (use_cache && !cached && ok)
+    {
+        auto evicted = frame_cache->insert(cache_key, jpeg);
+        if (evicted > 0)
+            count(LiveStats::CACHE_EVICTIONS, evicted);
+    }
+    auto encode_end = Logger::now_ns();
+    if (ok && cached)
+        overload->on_cached(settings.level);
+    else if (ok)
+        overload->on_encoded(settings.level, long(encode_end - encode_start));
+    else
+        overload->on_failed();
+    if (live_stats && ok)
+        live_stats->add({{LiveStats::ENCODED, 1},
+                         {LiveStats::ENCODE_NS, (unsigned long long) (encode_end - encode_start)},
+                         {LiveStats::BYTES_OUT, jpeg.size()},
+                         {LiveStats::DEADLINE_MISSES, encode_end > task->deadline ? 1u : 0u}});
+
+    if (!ok)
+    {
+        Logger::log(pid, task->id, Source::ARCHIVER, "Error saving file as " + file_name);
+        latencies.drop();
+        delete task;
+        return nullptr;
+    }
+    latencies.add(encode_end - task->sent, encode_end > task->deadline);
+
+    // Hand the frame over to the archiver
+    auto archive = new Archive{task->id, file_name, std::move(jpeg), std::move(stream_jpeg)};
+    {
+        std::lock_guard<std::mutex> lock(archive_mutex);
+        archive_queue.push_back(archive);
+    }
+    archive_ready.notify_one();
+
+    delete task;
     return nullptr;
 }
 
+void* archiver(void*)
+{
+    harden("archiver", rt_config.archiver_cpus);
+    Trace::name_thread("archiver");
+
+    while (true)
+    {
+        Archive* archive;
+        {
+            std::unique_lock<std::mutex> lock(archive_mutex);
+            archive_ready.wait(lock, []{ return !archive_queue.empty() || archive_closed; });
+            if (archive_queue.empty())
+                break;
+            archive = archive_queue.front();
+            archive_queue.pop_front();
+        }
+
+        Trace::Span span("archive", archive->task_id);
+        Trace::flow('f', archive->task_id);
+        Logger::log(pid, archive->task_id, Source::CLIENT,"Opening file: " + archive->file_name + "...");
+        std::ofstream file(archive->file_name, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+        if(!file.is_open()) Logger::log(pid, archive->task_id, Source::CLIENT,"Opening file  " + archive->file_name + " failed");
+        file.write((const char *) archive->jpeg.data(), archive->jpeg.size());
+        file.close();
+
+        // subscribers share this single copy
+        if (stream_server)
+        {
+            auto& published = archive->stream_jpeg.empty() ? archive->jpeg : archive->stream_jpeg;
+            stream_server->publish(archive->task_id, std::make_shared<const std::vector<unsigned char>>(std::move(published)));
+        }
+
+        Logger::log(pid, archive->task_id, Source::ARCHIVER, "Finished. Saved file as " + archive->file_name);
+        count(LiveStats::ARCHIVED);
+        delete archive;
+    }
+    return nullptr;
+}
+
+// Encode one blank frame, so code pages and lazily initialized data are resident before the first real frame
+void warmUpEncoder()
+{
+    std::vector<unsigned char> image(width * height * bytes_per_pixel);
+    std::vector<unsigned char> jpeg;
+    jpeg.reserve(MAX_MSG_SIZE);
+    auto output = [&jpeg](unsigned char byte) { jpeg.push_back(byte); };
+    TooJpeg::writeJpeg(output, image.data(), width, height, is_RGB, quality, sampling, comment);
+    TooJpeg::Coefficients coefficients;
+    TooJpeg::analyzeJpeg(coefficients, image.data(), width, height, is_RGB, TooJpeg::YCbCr420);
+    jpeg.clear();
+    TooJpeg::writeJpeg(output, coefficients, quality, comment);
+}
+
 void client(const std::string& prod_queue_name, struct mq_attr attr)
 {
     // Set global current source for logger
     source = Source::CLIENT;
+    if (!trace_path.empty())
+        Trace::start(trace_path, "sczr00 client");
+    Trace::name_thread("receiver");
+
+    lockProcessMemory();
+    warmUpEncoder();
+    harden("receiver", rt_config.receiver_cpus);
+    attachStats("client");
+    auto isolated = RealTime::isolated_cpus();
+    Logger::logd(pid, source, "Allowed cpus: " + RealTime::to_string(RealTime::allowed_cpus()) +
+                              ", isolated cpus: " + (isolated.empty() ? "none" : isolated));
+
+    if (!stream_config.path.empty())
+    {
+        std::string error;
+        stream_server = StreamServer::Server::start(stream_config, error);
+        Logger::logd(pid, source, stream_server ? "Serving frames on " + stream_config.path : error);
+        if (stream_server && stream_quality > 0 && (cache_mb > 0 || rate_controller || perf_counters))
+            Logger::logd(pid, source, "--stream-quality only applies to frames without cache, rate control and perf counters");
+    }
+
+    if (!progressive_scans.empty() && (rate_controller || perf_counters))
+        Logger::logd(pid, source, "--progressive does not apply to rate controlled and perf counted frames");
+
+    if (cache_mb > 0)
+        frame_cache = new FrameCache::Cache(size_t(cache_mb) * 1024 * 1024);
+
+    pthread_t archiver_thread;
+    pthread_create(&archiver_thread, NULL, archiver, nullptr);
 
-    // Open producer -> client queue
-    auto prod_queue = mq_open(prod_queue_name.c_str(), O_RDONLY | O_CREAT , 0777, &attr);
+    // Open producer -> client queue, nonblocking because the receive loop waits in epoll_wait() or polls
+    auto prod_queue = mq_open(prod_queue_name.c_str(), O_RDONLY | O_CREAT | O_NONBLOCK, 0777, &attr);
     Logger::log(pid, Logger::DEBUG_TASK_ID, source,
                 "Opened queue. Id: " + std::to_string(prod_queue) + ", errno: " + strerror(errno));
 
-    // Receive task from producer
-    Task task;
-    int ret = 1;
+    // One queue per client, the stall timer ends the client if the producer goes away without END_OF_STREAM
+    Receiver::Loop receiver(receive_policy);
+    // Without the queue no frame and no end of stream can arrive, stop like after END_OF_STREAM
+    auto receiving = receiver.add_queue(prod_queue) >= 0;
+    if (!receiving)
+        Logger::logd(pid, source, std::string("Cannot wait for the queue: ") + strerror(errno) + ", stopping.");
+    auto stall_timer = receive_timeout_ms > 0 ? receiver.add_timer() : -1;
+    receiver.arm(stall_timer, Logger::now_ns() + receive_timeout_ms * 1000000);
+    Logger::logd(pid, source, "Receive policy: " + Receiver::to_string(receive_policy));
 
-    do
+    // Receive tasks from producer, the receive buffer must hold mq_msgsize bytes
+    char buffer[MAX_MSG_SIZE];
+    std::vector<pthread_t> threads;
+    pthread_attr_t thread_attr;
+    pthread_attr_init(&thread_attr);
+    pthread_attr_setstacksize(&thread_attr, RealTime::THREAD_STACK_SIZE);
+
+    // counts only while the receiver runs, time asleep in epoll_wait() is not included but polling is
+    PerfCounters::Thread* counters = nullptr;
+    PerfCounters::Totals receive_totals;
+    if (perf_counters)
+    {
+        counters = new PerfCounters::Thread;
+        Logger::logd(pid, source, "Perf counters " + counters->status());
+        if (rate_controller)
+            Logger::logd(pid, source, "Perf counters: encoder stages are only counted without rate control");
+    }
+
+    while (receiving)
     {
-        ret = mq_receive(prod_queue, (char *) &task, MAX_MSG_SIZE, NULL);
+        PerfCounters::Sample before{};
+        if (counters)
+            before = counters->read();
+        auto event = receiver.wait(buffer, MAX_MSG_SIZE);
+        if (counters)
+            receive_totals.add(PerfCounters::IPC, before, counters->read());
+        auto received = event.ready_ns;
+        if (event.kind == Receiver::Event::TIMER)
+        {
+            Logger::logd(pid, source, "No frame for " + std::to_string(receive_timeout_ms) + " ms, stopping.");
+            break;
+        }
+        auto ret = event.kind == Receiver::Event::MESSAGE ? event.size : -1;
         Logger::logd(pid, source,
                      "Received msg. Code result: " + std::to_string(ret) + ", errno: " + strerror(errno));
+        if (ret < (ssize_t) sizeof(Task))
+            break;
+
+        // Each consumer thread owns its copy of the task
+        auto task = new Task;
+        memcpy(task, buffer, sizeof(Task));
+        if (task->id == END_OF_STREAM)
+        {
+            delete task;
+            break;
+        }
+        Trace::flow('t', task->id);
+        auto task_id = task->id;
+        receiver.record(received - task->sent);
+        receiver.arm(stall_timer, received + receive_timeout_ms * 1000000);
+
+        // Frames still waiting in the queue are newer than this one
+        struct mq_attr state{};
+        mq_getattr(prod_queue, &state);
+        if (live_stats)
+        {
+            live_stats->add(LiveStats::RECEIVED);
+            live_stats->set(LiveStats::QUEUE_DEPTH, state.mq_curmsgs);
+        }
+        auto level = overload->current_level();
+        if (!overload->on_received(state.mq_curmsgs))
+        {
+            Logger::log(pid, task->id, source, "Dropped: " + std::to_string(state.mq_curmsgs) + " newer frames queued.");
+            count(LiveStats::DROPPED);
+            latencies.drop();
+            frame_pool->release(task->frame);
+            delete task;
+            Trace::complete("dispatch", received, Logger::now_ns(), task_id);
+            continue;
+        }
+        if (overload->current_level() != level)
+            Logger::log(pid, task->id, source, "Overload level " + std::to_string(level) + " -> " +
+                                               std::to_string(overload->current_level()) + ".");
+
+        // Join finished consumers while the run goes on, so their (locked) stacks are freed or reused
+        threads.erase(std::remove_if(threads.begin(), threads.end(),
+                                     [](pthread_t thread) { return pthread_tryjoin_np(thread, nullptr) == 0; }),
+                      threads.end());
 
         pthread_t thread;
-        pthread_create(&thread, NULL, consumer, &task);
+        if (pthread_create(&thread, &thread_attr, consumer, task) == 0)
+            threads.push_back(thread);
+        else
+        {
+            overload->on_failed();
+            count(LiveStats::DROPPED);
+            latencies.drop();
+            frame_pool->release(task->frame);
+            delete task;
+        }
+        Trace::complete("dispatch", received, Logger::now_ns(), task_id);
+    }
 
-    } while (ret > 0);
+    for (auto thread : threads)
+        pthread_join(thread, nullptr);
+    pthread_attr_destroy(&thread_attr);
+
+    // All encoders are done, let the archiver drain its queue
+    {
+        std::lock_guard<std::mutex> lock(archive_mutex);
+        archive_closed = true;
+    }
+    archive_ready.notify_one();
+    pthread_join(archiver_thread, nullptr);
+
+    if (rate_controller)
+        Logger::logd(pid, source, "Rate control: " + rate_controller->stats().to_string());
+    if (counters)
+    {
+        addPerfTotals(receive_totals);
+        Logger::logd(pid, source, "Perf counters per stage:\n" + perf_totals.to_string());
+        delete counters;
+    }
+    Logger::logd(pid, source, "Overload: " + overload->counters().to_string());
+    if (frame_cache)
+    {
+        Logger::logd(pid, source, "Frame cache: " + frame_cache->stats().to_string());
+        delete frame_cache;
+        frame_cache = nullptr;
+    }
+    if (stream_server)
+    {
+        stream_server->stop();
+        Logger::logd(pid, source, "Stream server: " + stream_server->stats().to_string());
+        delete stream_server;
+        stream_server = nullptr;
+    }
+
+    auto latency = latencies.summary();
+    auto wakeups = receiver.stats();
+    Logger::logd(pid, source, "Latency (" + RealTime::to_string(policy) + "): " + latency.to_string());
+    Logger::logd(pid, source, "Receiver (" + Receiver::to_string(receive_policy) + "): " + wakeups.to_string());
+    if (!results_path.empty())
+    {
+        std::ofstream results(results_path, std::ios_base::out | std::ios_base::trunc);
+        results << latency.to_record() << std::endl;
+        results << wakeups.to_record() << std::endl;
+    }
 
     mq_close(prod_queue);
+    if (live_stats)
+        live_stats->detach();
 }
 
-int main(int argc, char * argv[])
+// Parse "--name=value", returns false if arg is a different option
+bool option(const char* arg, const std::string& name, std::string& value)
+{
+    auto prefix = "--" + name + "=";
+    if (strncmp(arg, prefix.c_str(), prefix.size()) != 0)
+        return false;
+    value = arg + prefix.size();
+    return true;
+}
+
+// Parse "--name" without a value
+bool flag(const char* arg, const std::string& name)
+{
+    return arg == "--" + name;
+}
+
+// Usage: sczr00 [scenario_id] [--frames=N] [--fps=F] [--target-bytes=B | --bitrate=BITS_PER_SECOND]
+//               [--deadline-ms=MS] [--drop-late] [--keep-newest=N] [--degrade] [--backlog-high=N] [--backlog-low=N]
+//               [--latency-high-us=US] [--latency-low-us=US] [--hold-frames=N]
+//               [--width=W] [--height=H] [--pool-mb=N] [--huge-pages]
+//               [--mlock] [--cpus-producer=LIST] [--cpus-receiver=LIST] [--cpus-encoder=LIST] [--cpus-archiver=LIST]
+//               [--no-stats] [--trace=FILE] [--perf-counters] [--policy=POLICY] [--results=FILE]
+//               [--input=RAW_RGB_FILE] [--record=FILE] [--replay=FILE] [--replay-speed=X]
+//               [--serve=SOCKET_PATH] [--subscriber-queue=N] [--cache-mb=N] [--sampling=444|422|420]
+//               [--receive=block|spin|hybrid:US] [--receive-timeout-ms=N] [--stream-quality=Q]
+//               [--progressive[=spectral|SCRIPT]] [--capacity=TABLE] [--admit] [--cpu-share=F]
+void parseOptions(int argc, char * argv[])
 {
-    if (argc > 1) {
-        scenario_id = atoi(argv[1]);
+    long bitrate = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string value;
+        if (option(argv[i], "frames", value))
+            frames = atoi(value.c_str());
+        else if (option(argv[i], "fps", value))
+            fps = atof(value.c_str());
+        else if (option(argv[i], "target-bytes", value))
+            rate_config.target_bytes = atol(value.c_str());
+        else if (option(argv[i], "bitrate", value))
+            bitrate = atol(value.c_str());
+        else if (option(argv[i], "deadline-ms", value))
+            deadline_ms = atol(value.c_str());
+        else if (flag(argv[i], "drop-late"))
+            overload_config.drop_late = true;
+        else if (option(argv[i], "keep-newest", value))
+            overload_config.keep_newest = atoi(value.c_str());
+        else if (flag(argv[i], "degrade"))
+            overload_config.degrade = true;
+        else if (option(argv[i], "backlog-high", value))
+            overload_config.backlog_high = atol(value.c_str());
+        else if (option(argv[i], "backlog-low", value))
+            overload_config.backlog_low = atol(value.c_str());
+        else if (option(argv[i], "latency-high-us", value))
+            overload_config.latency_high_ns = atol(value.c_str()) * 1000;
+        else if (option(argv[i], "latency-low-us", value))
+            overload_config.latency_low_ns = atol(value.c_str()) * 1000;
+        else if (option(argv[i], "hold-frames", value))
+            overload_config.hold_frames = atoi(value.c_str());
+        else if (option(argv[i], "width", value))
+            width = atoi(value.c_str());
+        else if (option(argv[i], "height", value))
+            height = atoi(value.c_str());
+        else if (option(argv[i], "pool-mb", value))
+            pool_mb = atol(value.c_str());
+        else if (flag(argv[i], "huge-pages"))
+            huge_pages = true;
+        else if (flag(argv[i], "mlock"))
+            rt_config.lock_memory = true;
+        else if (option(argv[i], "cpus-producer", value))
+            rt_config.producer_cpus = value;
+        else if (option(argv[i], "cpus-receiver", value))
+            rt_config.receiver_cpus = value;
+        else if (option(argv[i], "cpus-encoder", value))
+            rt_config.encoder_cpus = value;
+        else if (option(argv[i], "cpus-archiver", value))
+            rt_config.archiver_cpus = value;
+        else if (flag(argv[i], "no-stats"))
+            publish_stats = false;
+        else if (option(argv[i], "trace", value))
+            trace_path = value;
+        else if (flag(argv[i], "perf-counters"))
+            perf_counters = true;
+        else if (option(argv[i], "policy", value))
+        {
+            if (RealTime::parse_policy(value, policy))
+                policy_set = true;
+            else
+                Logger::logd(pid, source, "Invalid policy '" + value + "', using SCHED_OTHER");
+        }
+        else if (option(argv[i], "results", value))
+            results_path = value;
+        else if (option(argv[i], "input", value))
+            input_path = value;
+        else if (option(argv[i], "record", value))
+            record_path = value;
+        else if (option(argv[i], "replay", value))
+            replay_path = value;
+        else if (option(argv[i], "replay-speed", value))
+            replay_speed = atof(value.c_str());
+        else if (option(argv[i], "serve", value))
+            stream_config.path = value;
+        else if (option(argv[i], "subscriber-queue", value))
+            stream_config.queue_frames = std::max(1, atoi(value.c_str()));
+        else if (option(argv[i], "stream-quality", value))
+            stream_quality = std::min(100, std::max(0, atoi(value.c_str())));
+        else if (flag(argv[i], "progressive"))
+            progressive_scans = TooJpeg::progressiveScans(is_RGB, true);
+        else if (option(argv[i], "progressive", value))
+        {
+            if (value == "spectral")
+                progressive_scans = TooJpeg::progressiveScans(is_RGB, false);
+            else if (!TooJpeg::parseScans(value.c_str(), is_RGB, progressive_scans))
+            {
+                Logger::logd(pid, source, "Invalid scan script '" + value + "', using the default");
+                progressive_scans = TooJpeg::progressiveScans(is_RGB, true);
+            }
+        }
+        else if (option(argv[i], "cache-mb", value))
+            cache_mb = atol(value.c_str());
+        else if (option(argv[i], "sampling", value))
+        {
+            if (value == "444" || value == "422" || value == "420")
+                sampling = value == "444" ? TooJpeg::YCbCr444 : value == "422" ? TooJpeg::YCbCr422 : TooJpeg::YCbCr420;
+            else
+                Logger::logd(pid, source, "Invalid sampling '" + value + "', using 444");
+        }
+        else if (option(argv[i], "receive", value))
+        {
+            if (!Receiver::parse_policy(value, receive_policy))
+                Logger::logd(pid, source, "Invalid receive policy '" + value + "', using block");
+        }
+        else if (option(argv[i], "receive-timeout-ms", value))
+            receive_timeout_ms = atol(value.c_str());
+        else if (option(argv[i], "capacity", value))
+            capacity_path = value;
+        else if (flag(argv[i], "admit"))
+            admit_stream = true;
+        else if (option(argv[i], "cpu-share", value))
+            admission_budget.cpu_share = atof(value.c_str());
+        else if (i == 1)
+            scenario_id = atoi(argv[i]);
+        else
+            Logger::logd(pid, source, std::string("Unknown option: ") + argv[i]);
+    }
+
+    if (bitrate > 0)
+    {
+        if (fps > 0)
+            rate_config.target_bytes = RateControl::bytes_per_frame(bitrate, fps);
+        else
+            Logger::logd(pid, source, "--bitrate requires --fps, rate control disabled");
+    }
+}
+
+// Estimate the encode time of this run's frames, admit the stream (--admit) and derive the SCHED_DEADLINE reservation
+// of scenario 2; returns false if the stream is rejected
+bool planCapacity()
+{
+    auto reserve = scenario_id == 2 && !policy_set;
+    if (!admit_stream && !reserve)
+        return true;
+
+    // cheaper versions of the stream are only considered with --admit
+    Admission::Calibration calibration;
+    calibration.resolutions = {{width, height}};
+    calibration.qualities = {quality};
+    calibration.samplings = {sampling};
+    if (admit_stream)
+    {
+        if (quality > admission_budget.min_quality)
+            calibration.qualities.push_back(admission_budget.min_quality);
+        if (sampling == TooJpeg::YCbCr444)
+            calibration.samplings.push_back(TooJpeg::YCbCr422);
+        if (sampling != TooJpeg::YCbCr420)
+            calibration.samplings.push_back(TooJpeg::YCbCr420);
+    }
+    calibration.runs = 3;
+
+    Admission::Table table;
+    std::string error;
+    long long cost_ns = 0;
+    if (!capacity_path.empty() && !table.load(capacity_path, error))
+        Logger::logd(pid, source, "Cannot load capacity table: " + error);
+    if (!table.estimate(width, height, quality, sampling, cost_ns))
+    {
+        table = Admission::calibrate(calibration);
+        table.estimate(width, height, quality, sampling, cost_ns);
+        Logger::logd(pid, source, "Calibrated " + std::to_string(table.costs.size()) + " encoder configurations");
+    }
+
+    Admission::Stream stream;
+    stream.width = width;
+    stream.height = height;
+    stream.quality = quality;
+    stream.sampling = sampling;
+    stream.fps = fps;
+    if (admit_stream)
+    {
+        cpu_set_t cpus = RealTime::allowed_cpus();
+        if (!rt_config.encoder_cpus.empty())
+            RealTime::parse_cpus(rt_config.encoder_cpus, cpus);
+        admission_budget.cpus = std::max(1, CPU_COUNT(&cpus));
+        admission_budget.core_bound = Admission::kernel_bound();
+
+        Admission::Controller controller(table, admission_budget);
+        auto decision = controller.admit(stream);
+        Logger::logd(pid, source, "Admission: " + decision.to_string());
+        if (decision.kind == Admission::Decision::REJECT)
+            return false;
+        quality = decision.stream.quality;
+        sampling = decision.stream.sampling;
+        cost_ns = decision.cost_ns;
     }
 
+    if (reserve)
+    {
+        policy = Admission::deadline_policy(cost_ns, fps, admission_budget.margin);
+        Logger::logd(pid, source, "Encoder reservation from the capacity model: " + RealTime::to_string(policy) +
+                                  " (" + std::to_string(cost_ns / 1000) + " us per frame)");
+    }
+    return true;
+}
+
+int main(int argc, char * argv[])
+{
+    parseOptions(argc, argv);
+    if (rate_config.target_bytes > 0)
+        rate_controller = new RateControl::Controller(rate_config);
+
     std::string prod_queue_name = "/prod_queue";
     
     // Adjust params
@@ -177,21 +972,80 @@ int main(int argc, char * argv[])
     height = height * p;
     max_interval = max_interval * p;
 
+    // A replayed trace brings its own frame sizes, the pool slots must hold the largest one
+    std::string error;
+    if (!replay_path.empty())
+    {
+        if (replay_speed <= 0 || !Arrivals::load(replay_path, arrivals, error) || !contents.load(arrivals, error))
+        {
+            Logger::logd(pid, source, "Cannot replay " + replay_path + ": " +
+                                      (replay_speed <= 0 ? "--replay-speed must be positive" : error));
+            return 1;
+        }
+        width = height = 0;
+        for (auto& arrival : arrivals)
+        {
+            width = std::max(width, arrival.width);
+            height = std::max(height, arrival.height);
+        }
+        Logger::logd(pid, source, "Replaying " + std::to_string(arrivals.size()) + " arrivals from " + replay_path +
+                                  " at " + std::to_string(replay_speed) + "x");
+    }
+    else if (!input_path.empty())
+    {
+        Arrivals::Arrival live;
+        live.width = width;
+        live.height = height;
+        live.content = Arrivals::RAW_PREFIX + input_path;
+        if (!contents.load({live}, error))
+        {
+            Logger::logd(pid, source, error);
+            return 1;
+        }
+    }
+
+    // Needs the final frame size, before the overload controller takes over quality and sampling
+    if (!planCapacity())
+        return 1;
+    overload = new Overload::Controller(overload_config, quality, sampling);
+
+    // Preallocate all frame buffers before fork(), so both processes share them
+    frame_pool = FramePool::Pool::create(size_t(width) * height * bytes_per_pixel, size_t(pool_mb) * 1024 * 1024, huge_pages);
+    if (!frame_pool)
+    {
+        Logger::logd(pid, source, "Cannot create frame pool of " + std::to_string(pool_mb) + " MB.");
+        return 1;
+    }
+    Logger::logd(pid, source, "Frame pool: " + frame_pool->stats().to_string());
+
     // Initialize queues params
     struct mq_attr attr{};
     attr.mq_flags = 0;
     attr.mq_msgsize = MAX_MSG_SIZE;
     attr.mq_maxmsg = MAX_MSGS;
 
+    if (!trace_path.empty() && !Trace::create(trace_path))
+    {
+        Logger::logd(pid, source, "Cannot create trace file " + trace_path + ": " + strerror(errno));
+        trace_path.clear();
+    }
+
+    // Buffered log lines would be printed by both processes otherwise
+    fflush(stdout);
+    stream_id = getpid();
     pid = fork();
     if (pid) { //producer
         producer(prod_queue_name, attr);
         waitpid(pid, nullptr, 0);
         mq_unlink(prod_queue_name.c_str());
+        if (live_stats)
+            live_stats->detach();
+        Logger::logd(pid, source, "Frame pool: " + frame_pool->stats().to_string());
     } else { //child
         client(prod_queue_name, attr);
     }
 
+    Trace::stop();
     Logger::logd(pid, source, "Exiting...");
     return 0;
 }
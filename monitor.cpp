@@ -0,0 +1,163 @@
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include "livestats.h"
+
+// Usage: sczr00_top [--interval=SECONDS] [--once] [--prometheus]
+// Reads the live stats segment of all running pipelines, never blocks their writers.
+
+namespace
+{
+    using LiveStats::Counter;
+
+    struct Stream
+    {
+        unsigned long long values[LiveStats::NUM_COUNTERS] = {};
+        std::string writers;
+    };
+
+    // sum the slots of every stream, the queue depth is a gauge: take the largest observation
+    std::map<int, Stream> collect(const LiveStats::Segment *segment)
+    {
+        std::map<int, Stream> streams;
+        for (auto &slot : segment->slots)
+        {
+            LiveStats::Snapshot snapshot;
+            if (!LiveStats::read(slot, snapshot))
+                continue;
+            auto &stream = streams[snapshot.stream];
+            for (int i = 0; i < LiveStats::NUM_COUNTERS; i++)
+                if (i == LiveStats::QUEUE_DEPTH)
+                    stream.values[i] = std::max(stream.values[i], snapshot.values[i]);
+                else
+                    stream.values[i] += snapshot.values[i];
+            if (!stream.writers.empty())
+                stream.writers += ",";
+            stream.writers += snapshot.role + ":" + std::to_string(snapshot.writer);
+        }
+        return streams;
+    }
+
+    // Prometheus text exposition format, one sample per stream and counter
+    void prometheus(const std::map<int, Stream> &streams)
+    {
+        for (int i = 0; i < LiveStats::NUM_COUNTERS; i++)
+        {
+            auto type = i == LiveStats::QUEUE_DEPTH ? "gauge" : "counter";
+            auto suffix = i == LiveStats::QUEUE_DEPTH ? "" : "_total";
+            printf("# TYPE sczr00_%s%s %s\n", LiveStats::COUNTER_NAMES[i], suffix, type);
+            for (auto &stream : streams)
+                printf("sczr00_%s%s{stream=\"%d\"} %llu\n", LiveStats::COUNTER_NAMES[i], suffix,
+                       stream.first, stream.second.values[i]);
+        }
+    }
+
+    // growth of a counter during the interval; a stream sum shrinks when one of its writers exits, count that as 0
+    unsigned long long delta(const Stream &now, const Stream *before, Counter counter)
+    {
+        auto previous = before ? before->values[counter] : 0;
+        return now.values[counter] >= previous ? now.values[counter] - previous : 0;
+    }
+
+    double rate(const Stream &now, const Stream *before, Counter counter, double seconds)
+    {
+        if (!before || seconds <= 0)
+            return 0;
+        return delta(now, before, counter) / seconds;
+    }
+
+    void table(const std::map<int, Stream> &streams, const std::map<int, Stream> &previous, double seconds)
+    {
+        printf("\033[H\033[2J"); // clear screen, cursor home
+        printf("sczr00_top - %zu stream(s), rates per second over %.1f s\n\n", streams.size(), seconds);
+        printf("%8s %8s %8s %8s %8s %6s %8s %8s %9s %10s %7s  %s\n",
+               "stream", "prod/s", "recv/s", "enc/s", "arch/s", "queue", "dropped", "missed", "enc ms", "KB/s", "cache%",
+               "writers");
+        for (auto &entry : streams)
+        {
+            auto &stream = entry.second;
+            auto found = previous.find(entry.first);
+            auto before = found == previous.end() ? nullptr : &found->second;
+
+            // average encode time of the frames finished during the interval
+            double encode_ms = 0;
+            auto encoded = delta(stream, before, LiveStats::ENCODED);
+            if (encoded > 0)
+                encode_ms = delta(stream, before, LiveStats::ENCODE_NS) / 1e6 / encoded;
+
+            // encoded frame cache hit rate since the start, blank without --cache-mb
+            auto lookups = stream.values[LiveStats::CACHE_HITS] + stream.values[LiveStats::CACHE_MISSES];
+            auto cache = lookups ? std::to_string(100 * stream.values[LiveStats::CACHE_HITS] / lookups) : std::string("-");
+
+            printf("%8d %8.1f %8.1f %8.1f %8.1f %6llu %8llu %8llu %9.3f %10.1f %7s  %s\n",
+                   entry.first,
+                   rate(stream, before, LiveStats::PRODUCED, seconds),
+                   rate(stream, before, LiveStats::RECEIVED, seconds),
+                   rate(stream, before, LiveStats::ENCODED, seconds),
+                   rate(stream, before, LiveStats::ARCHIVED, seconds),
+                   stream.values[LiveStats::QUEUE_DEPTH],
+                   stream.values[LiveStats::DROPPED],
+                   stream.values[LiveStats::DEADLINE_MISSES],
+                   encode_ms,
+                   rate(stream, before, LiveStats::BYTES_OUT, seconds) / 1024,
+                   cache.c_str(),
+                   stream.writers.c_str());
+        }
+        fflush(stdout);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    double interval = 1;
+    bool once = false, prometheus_format = false;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strncmp(argv[i], "--interval=", 11) == 0)
+            interval = atof(argv[i] + 11);
+        else if (strcmp(argv[i], "--once") == 0)
+            once = true;
+        else if (strcmp(argv[i], "--prometheus") == 0)
+            prometheus_format = true;
+        else
+        {
+            fprintf(stderr, "Usage: %s [--interval=SECONDS] [--once] [--prometheus]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    auto segment = LiveStats::open_reader();
+    if (!segment)
+    {
+        fprintf(stderr, "No live stats segment %s, is sczr00 running?\n", LiveStats::SEGMENT_NAME);
+        return 1;
+    }
+
+    if (prometheus_format)
+    {
+        prometheus(collect(segment));
+        return 0;
+    }
+
+    auto previous = collect(segment);
+    auto last = std::chrono::steady_clock::now();
+    if (once)
+    {
+        table(previous, {}, 0);
+        return 0;
+    }
+    while (true)
+    {
+        usleep(useconds_t(interval * 1000000));
+        auto streams = collect(segment);
+        auto now = std::chrono::steady_clock::now();
+        table(streams, previous, std::chrono::duration<double>(now - last).count());
+        previous = std::move(streams);
+        last = now;
+    }
+}
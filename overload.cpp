@@ -0,0 +1,163 @@
+#include <algorithm>
+#include "overload.h"
+
+namespace Overload
+{
+    std::string Counters::to_string() const
+    {
+        auto result = "received: " + std::to_string(received) +
+                      ", encoded: " + std::to_string(encoded) +
+                      ", dropped late: " + std::to_string(dropped_late) +
+                      ", dropped stale: " + std::to_string(dropped_stale) +
+                      ", steps down: " + std::to_string(steps_down) +
+                      ", steps up: " + std::to_string(steps_up) +
+                      ", frames per level:";
+        for (auto frames : frames_per_level)
+            result += " " + std::to_string(frames);
+        return result;
+    }
+
+    Controller::Controller(const Config &config, int quality, TooJpeg::Sampling sampling)
+            : config(config), base_quality(quality), base_sampling(sampling)
+    {
+    }
+
+    Settings Controller::level_settings(int level) const
+    {
+        // 0: as configured, 1: YCbCr 4:2:0, 2: 4:2:0 and 3/4 quality, 3: 4:2:0 and half quality
+        Settings result{level, base_quality, base_sampling};
+        if (level >= 1)
+            result.sampling = TooJpeg::YCbCr420;
+        if (level == 2)
+            result.quality = base_quality * 3 / 4;
+        if (level >= 3)
+            result.quality = base_quality / 2;
+        // never above the configured quality
+        result.quality = std::max(result.quality, std::min(base_quality, 10));
+        return result;
+    }
+
+    int Controller::next_level(int from, int step) const
+    {
+        // levels that would encode with the same settings (e.g. 4:2:0 with --sampling=420) are skipped
+        auto current_settings = level_settings(from);
+        for (auto next = from + step; next >= 0 && next <= MAX_LEVEL; next += step)
+        {
+            auto settings = level_settings(next);
+            if (settings.quality != current_settings.quality || settings.sampling != current_settings.sampling)
+            {
+                // stepping up: to the lowest level with these settings
+                while (step < 0 && next > 0 && level_settings(next - 1).quality == settings.quality &&
+                       level_settings(next - 1).sampling == settings.sampling)
+                    next--;
+                return next;
+            }
+        }
+        return from;
+    }
+
+    void Controller::update_level(long backlog)
+    {
+        if (!config.degrade)
+            return;
+
+        auto overloaded = backlog >= config.backlog_high ||
+                          (config.latency_high_ns > 0 && latency_ns > config.latency_high_ns);
+        auto calm = backlog <= config.backlog_low &&
+                    (config.latency_low_ns == 0 || latency_ns < config.latency_low_ns);
+
+        if (overloaded)
+        {
+            calm_frames = 0;
+            auto next = next_level(level, 1);
+            if (next != level)
+            {
+                level = next;
+                current.steps_down++;
+            }
+        }
+        else if (calm && level > 0)
+        {
+            // hysteresis: only step back up after a while without pressure
+            if (++calm_frames >= config.hold_frames)
+            {
+                calm_frames = 0;
+                level = next_level(level, -1);
+                current.steps_up++;
+            }
+        }
+        else
+        {
+            calm_frames = 0;
+        }
+    }
+
+    bool Controller::on_received(long queued_frames)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        current.received++;
+        queued = queued_frames;
+
+        if (config.keep_newest > 0 && queued_frames >= config.keep_newest)
+        {
+            current.dropped_stale++;
+            return false;
+        }
+
+        in_flight++;
+        update_level(queued + in_flight);
+        return true;
+    }
+
+    bool Controller::on_start(long long deadline_ns, long long now_ns)
+    {
+        if (!config.drop_late || now_ns <= deadline_ns)
+            return true;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        current.dropped_late++;
+        in_flight--;
+        return false;
+    }
+
+    Settings Controller::settings()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return level_settings(level);
+    }
+
+    int Controller::current_level()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return level;
+    }
+
+    void Controller::on_encoded(int encoded_level, long encode_ns)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        current.encoded++;
+        current.frames_per_level[encoded_level]++;
+        in_flight--;
+        latency_ns = latency_ns == 0 ? encode_ns : 0.8 * latency_ns + 0.2 * encode_ns;
+    }
+
+    void Controller::on_cached(int encoded_level)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        current.encoded++;
+        current.frames_per_level[encoded_level]++;
+        in_flight--;
+    }
+
+    void Controller::on_failed()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        in_flight--;
+    }
+
+    Counters Controller::counters()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return current;
+    }
+}
@@ -0,0 +1,96 @@
+#include <mutex>
+#include <string>
+#include "toojpeg.h"
+
+#ifndef SCZR00_OVERLOAD_H
+#define SCZR00_OVERLOAD_H
+
+namespace Overload
+{
+    // Encoder settings, stepped down one level at a time when the client falls behind
+    struct Settings
+    {
+        int level;
+        int quality;
+        TooJpeg::Sampling sampling;
+    };
+
+    auto const MAX_LEVEL = 3;
+
+    struct Config
+    {
+        bool drop_late = false;       // drop frames whose deadline has already passed
+        int keep_newest = 0;          // drop a frame if at least this many newer frames are queued, 0 = keep all
+        bool degrade = false;         // step quality/subsampling down under load
+
+        // degrade thresholds: backlog = queued + in-flight frames, latency = recent encode time
+        long backlog_high = 6;
+        long backlog_low = 2;
+        long latency_high_ns = 0;     // 0 = only the backlog is considered
+        long latency_low_ns = 0;
+        int hold_frames = 10;         // calm frames required before stepping back up (hysteresis)
+    };
+
+    // Every decision is counted, see to_string()
+    struct Counters
+    {
+        long received = 0;
+        long encoded = 0;
+        long dropped_late = 0;
+        long dropped_stale = 0;
+        long steps_down = 0;
+        long steps_up = 0;
+        long frames_per_level[MAX_LEVEL + 1] = {};
+
+        std::string to_string() const;
+    };
+
+    class Controller
+    {
+    public:
+        Controller(const Config &config, int quality, TooJpeg::Sampling sampling);
+
+        // client: a frame was received while `queued` newer frames wait in the queue
+        // returns false if the frame is dropped because newer frames are waiting
+        bool on_received(long queued);
+
+        // consumer: returns false if the deadline (monotonic ns) has passed and the frame is dropped
+        bool on_start(long long deadline_ns, long long now_ns);
+
+        // consumer: encoder settings for the next frame
+        Settings settings();
+
+        int current_level();
+
+        // consumer: frame encoded, encode_ns is the time spent in the encoder
+        void on_encoded(int level, long encode_ns);
+
+        // consumer: frame taken from the frame cache, its lookup time says nothing about the encoder's load
+        void on_cached(int level);
+
+        // client: an admitted frame never reached the encoder, consumer: the encoder failed
+        void on_failed();
+
+        Counters counters();
+
+    private:
+        Settings level_settings(int level) const;
+        // nearest level in direction step (+1 down, -1 up) with other settings, from if there is none
+        int next_level(int from, int step) const;
+        void update_level(long backlog);
+
+        Config config;
+        int base_quality;
+        TooJpeg::Sampling base_sampling;
+
+        std::mutex mutex;
+        Counters current;
+        int level = 0;
+        int calm_frames = 0;
+        long in_flight = 0;
+        long queued = 0;
+        double latency_ns = 0; // exponential moving average
+    };
+}
+
+#endif //SCZR00_OVERLOAD_H
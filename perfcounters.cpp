@@ -0,0 +1,261 @@
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <vector>
+#include "perfcounters.h"
+#include "toojpeg_internal.h"
+
+namespace PerfCounters
+{
+    namespace
+    {
+        const unsigned long long CONFIGS[NUM_EVENTS] = {
+            PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+            PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+        };
+
+        long long thread_cpu_ns()
+        {
+            timespec now{};
+            clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+            return now.tv_sec * 1000000000LL + now.tv_nsec;
+        }
+
+        std::string per(double value, double count, bool available)
+        {
+            if (!available || count <= 0)
+                return "n/a";
+            char text[32];
+            snprintf(text, sizeof(text), "%.0f", value / count);
+            return text;
+        }
+    }
+
+    void Totals::add(Stage stage, const Sample &begin, const Sample &end)
+    {
+        for (int i = 0; i < NUM_EVENTS; i++)
+        {
+            if (begin.values[i] < 0 || end.values[i] < 0)
+                available[i] = false;
+            else
+                values[stage][i] += end.values[i] - begin.values[i];
+        }
+        cpu_ns[stage] += end.cpu_ns - begin.cpu_ns;
+        samples[stage]++;
+    }
+
+    void Totals::add_frame(long frame_pixels)
+    {
+        frames++;
+        pixels += frame_pixels;
+    }
+
+    void Totals::merge(const Totals &other)
+    {
+        for (int stage = 0; stage < NUM_STAGES; stage++)
+        {
+            for (int i = 0; i < NUM_EVENTS; i++)
+                values[stage][i] += other.values[stage][i];
+            cpu_ns[stage] += other.cpu_ns[stage];
+            samples[stage] += other.samples[stage];
+        }
+        for (int i = 0; i < NUM_EVENTS; i++)
+            available[i] = available[i] && (other.available[i] || other.frames == 0);
+        frames += other.frames;
+        pixels += other.pixels;
+    }
+
+    std::string Totals::to_string() const
+    {
+        auto megapixels = pixels / 1e6;
+        char line[256];
+        snprintf(line, sizeof(line), "%-17s %12s %12s %9s %12s %13s %11s %12s %11s\n",
+                 "stage", "cycles/frm", "insn/frm", "insn/cyc", "cache-miss/f", "branch-miss/f", "cpu us/frm",
+                 "cycles/MP", "cpu us/MP");
+        std::string result = "frames: " + std::to_string(frames) + ", megapixels: " + std::to_string(megapixels) + "\n";
+        if (samples[COLOR_CONVERSION] > 0)
+            result += "encoder stages run one after another over buffered blocks (not writeJpeg()'s single pass); "
+                      "entropy includes storing its bytes, output replays them through a per-byte callback\n";
+        result += line;
+
+        for (int stage = 0; stage < NUM_STAGES; stage++)
+        {
+            if (samples[stage] == 0)
+                continue;
+            auto &value = values[stage];
+            std::string ratio = "n/a";
+            if (available[CYCLES] && available[INSTRUCTIONS] && value[CYCLES] > 0)
+            {
+                char text[32];
+                snprintf(text, sizeof(text), "%.2f", double(value[INSTRUCTIONS]) / value[CYCLES]);
+                ratio = text;
+            }
+            snprintf(line, sizeof(line), "%-17s %12s %12s %9s %12s %13s %11.1f %12s %11.1f\n",
+                     STAGE_NAMES[stage],
+                     per(value[CYCLES], frames, available[CYCLES]).c_str(),
+                     per(value[INSTRUCTIONS], frames, available[INSTRUCTIONS]).c_str(),
+                     ratio.c_str(),
+                     per(value[CACHE_MISSES], frames, available[CACHE_MISSES]).c_str(),
+                     per(value[BRANCH_MISSES], frames, available[BRANCH_MISSES]).c_str(),
+                     frames ? cpu_ns[stage] / 1e3 / frames : 0.0,
+                     per(value[CYCLES], megapixels, available[CYCLES]).c_str(),
+                     megapixels > 0 ? cpu_ns[stage] / 1e3 / megapixels : 0.0);
+            result += line;
+        }
+        return result;
+    }
+
+    Thread::Thread()
+    {
+        for (int i = 0; i < NUM_EVENTS; i++)
+        {
+            fds[i] = -1;
+            index[i] = -1;
+            errors[i] = 0;
+
+            perf_event_attr attr{};
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = CONFIGS[i];
+            attr.disabled = leader < 0;   // the group starts when the leader is enabled
+            attr.exclude_kernel = 1;      // allowed with perf_event_paranoid <= 2
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+            // this thread, any CPU
+            auto fd = int(syscall(__NR_perf_event_open, &attr, 0, -1, leader, 0));
+            if (fd < 0)
+            {
+                errors[i] = errno;
+                continue;
+            }
+            if (leader < 0)
+                leader = fd;
+            fds[i] = fd;
+            index[i] = opened++;
+        }
+        if (leader >= 0)
+            ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+
+    Thread::~Thread()
+    {
+        for (auto fd : fds)
+            if (fd >= 0)
+                close(fd);
+    }
+
+    Sample Thread::read() const
+    {
+        Sample sample{};
+        for (auto &value : sample.values)
+            value = -1;
+
+        if (leader >= 0)
+        {
+            // nr, time enabled, time running, one value per opened event
+            unsigned long long data[3 + NUM_EVENTS];
+            if (::read(leader, data, sizeof(data)) >= ssize_t(3 * sizeof(data[0])) && data[2] > 0)
+            {
+                // scale up if the PMU was multiplexed between more events than it has counters
+                auto scale = double(data[1]) / data[2];
+                for (int i = 0; i < NUM_EVENTS; i++)
+                    if (index[i] >= 0 && index[i] < int(data[0]))
+                        sample.values[i] = (long long) (data[3 + index[i]] * scale);
+            }
+        }
+        sample.cpu_ns = thread_cpu_ns();
+        return sample;
+    }
+
+    std::string Thread::status() const
+    {
+        std::string counted, missing;
+        for (int i = 0; i < NUM_EVENTS; i++)
+        {
+            if (index[i] >= 0)
+                counted += std::string(counted.empty() ? "" : ", ") + EVENT_NAMES[i];
+            else
+                missing += std::string(missing.empty() ? "" : ", ") + EVENT_NAMES[i] + " (" + strerror(errors[i]) + ")";
+        }
+        return "counting: " + (counted.empty() ? std::string("cpu time only") : counted) +
+               (missing.empty() ? "" : ", unavailable: " + missing);
+    }
+
+    bool encode(const Thread &counters, Totals &totals, std::vector<unsigned char> &jpeg, const void *pixels,
+                unsigned short width, unsigned short height, bool isRGB, unsigned char quality, TooJpeg::Sampling sampling,
+                const char *comment)
+    {
+        using namespace TooJpeg::Internal;
+
+        if (pixels == nullptr || width == 0 || height == 0)
+            return false;
+        if (!isRGB)
+            sampling = TooJpeg::YCbCr444;
+
+        // table setup is not attributed to any stage
+        EncoderTables tables(quality);
+
+        // colour conversion: YCbCr blocks in baseline order
+        auto start = counters.read();
+        std::vector<float> blocks;
+        std::vector<uint8_t> components;
+        processBlocks((const uint8_t *) pixels, width, height, isRGB, sampling, [&](int component, float block[8][8])
+        {
+            auto block64 = (const float *) block;
+            blocks.insert(blocks.end(), block64, block64 + 8 * 8);
+            components.push_back(uint8_t(component));
+        });
+        auto converted = counters.read();
+        totals.add(COLOR_CONVERSION, start, converted);
+
+        // DCT and quantization
+        const auto numBlocks = components.size();
+        std::vector<int16_t> quantized(numBlocks * 8 * 8);
+        std::vector<int> posNonZero(numBlocks);
+        for (size_t i = 0; i < numBlocks; i++)
+        {
+            auto block64 = &blocks[i * 8 * 8];
+            transformBlock(block64);
+            posNonZero[i] = quantizeBlock(block64, components[i] == 0 ? tables.scaledLuminance : tables.scaledChrominance,
+                                          &quantized[i * 8 * 8]);
+        }
+        auto transformed = counters.read();
+        totals.add(DCT_QUANTIZE, converted, transformed);
+
+        // entropy coding into memory, headers included
+        std::vector<uint8_t> bytes;
+        bytes.reserve(numBlocks * 8);
+        auto store = [&bytes](uint8_t byte) { bytes.push_back(byte); };
+        BitWriter<decltype(store)> bitWriter(store);
+        writeHeaders(bitWriter, width, height, isRGB, sampling, tables, comment);
+        int16_t lastDC[3] = {0, 0, 0};
+        for (size_t i = 0; i < numBlocks; i++)
+        {
+            auto component = components[i];
+            auto luminance = component == 0;
+            lastDC[component] = encodeQuantized(bitWriter, &quantized[i * 8 * 8], posNonZero[i], lastDC[component],
+                                                luminance ? tables.huffmanLuminanceDC : tables.huffmanChrominanceDC,
+                                                luminance ? tables.huffmanLuminanceAC : tables.huffmanChrominanceAC,
+                                                tables.codewords);
+        }
+        bitWriter.flush();
+        bitWriter << 0xFF << 0xD9; // EOI marker
+        auto encoded = counters.read();
+        totals.add(ENTROPY, transformed, encoded);
+
+        // the caller's sink, one call per byte like writeJpeg()'s output callback
+        auto output = [&jpeg](unsigned char byte) { jpeg.push_back(byte); };
+        for (auto byte : bytes)
+            output(byte);
+        totals.add(OUTPUT, encoded, counters.read());
+
+        totals.add_frame(long(width) * height);
+        return true;
+    }
+}
@@ -0,0 +1,92 @@
+#include <string>
+#include <vector>
+#include "toojpeg.h"
+
+#ifndef SCZR00_PERFCOUNTERS_H
+#define SCZR00_PERFCOUNTERS_H
+
+// Hardware performance counters (perf_event_open) and thread CPU time per pipeline stage.
+// Counters that cannot be opened (no PMU, perf_event_paranoid, seccomp) are reported as n/a.
+namespace PerfCounters
+{
+    enum Event
+    {
+        CYCLES,
+        INSTRUCTIONS,
+        CACHE_MISSES,
+        BRANCH_MISSES,
+        NUM_EVENTS
+    };
+
+    enum Stage
+    {
+        COLOR_CONVERSION,
+        DCT_QUANTIZE,
+        ENTROPY,
+        OUTPUT,
+        IPC,              // mq_send / mq_receive
+        NUM_STAGES
+    };
+
+    const char *const EVENT_NAMES[NUM_EVENTS] = {"cycles", "instructions", "cache-misses", "branch-misses"};
+    const char *const STAGE_NAMES[NUM_STAGES] = {"color conversion", "dct/quantize", "entropy", "output", "ipc"};
+
+    // Counter values of the calling thread, -1 = unavailable
+    struct Sample
+    {
+        long long values[NUM_EVENTS];
+        long long cpu_ns; // CLOCK_THREAD_CPUTIME_ID
+    };
+
+    struct Totals
+    {
+        long long values[NUM_STAGES][NUM_EVENTS] = {};
+        long long cpu_ns[NUM_STAGES] = {};
+        long samples[NUM_STAGES] = {};
+        bool available[NUM_EVENTS] = {true, true, true, true}; // false once a single sample missed the event
+        long frames = 0;
+        double pixels = 0;
+
+        void add(Stage stage, const Sample &begin, const Sample &end);
+        void add_frame(long frame_pixels);
+        void merge(const Totals &other);
+
+        // one line per stage that has samples: per-frame and per-megapixel figures
+        std::string to_string() const;
+    };
+
+    // Counter group of the calling thread, counts user space only while the thread runs
+    class Thread
+    {
+    public:
+        Thread();
+        ~Thread();
+
+        Sample read() const;
+
+        // which events are counted, and why the others are not
+        std::string status() const;
+
+        Thread(const Thread &) = delete;
+        Thread &operator=(const Thread &) = delete;
+
+    private:
+        int leader = -1;
+        int fds[NUM_EVENTS];
+        int index[NUM_EVENTS];  // position in the group read, -1 = not opened
+        int errors[NUM_EVENTS]; // errno of failed opens
+        int opened = 0;
+    };
+
+    // Same output as TooJpeg::writeJpeg(), but one pass per stage so that each stage can be counted on its own:
+    // colour conversion, DCT/quantization, entropy coding into memory, then the bytes are handed to a per-byte
+    // output callback appending to jpeg. Limitations: the stages work on buffered blocks and coefficients instead of
+    // writeJpeg()'s single pass per MCU, so cache and branch misses are those of this staged encoder; entropy coding
+    // includes storing its bytes in memory, and output replays them through the callback afterwards instead of
+    // interleaving the calls with the coder.
+    bool encode(const Thread &counters, Totals &totals, std::vector<unsigned char> &jpeg, const void *pixels,
+                unsigned short width, unsigned short height, bool isRGB, unsigned char quality, TooJpeg::Sampling sampling,
+                const char *comment);
+}
+
+#endif //SCZR00_PERFCOUNTERS_H
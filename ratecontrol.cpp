@@ -0,0 +1,160 @@
+#include <cmath>
+#include "ratecontrol.h"
+
+namespace RateControl
+{
+    namespace
+    {
+        long encode_once(const TooJpeg::Coefficients &coefficients, int quality, const char *comment,
+                         std::vector<unsigned char> &jpeg)
+        {
+            jpeg.clear();
+            TooJpeg::writeJpeg([&jpeg](unsigned char byte) { jpeg.push_back(byte); }, coefficients, quality, comment);
+            return jpeg.size();
+        }
+    }
+
+    long bytes_per_frame(long bitrate, double fps)
+    {
+        return fps > 0 ? long(bitrate / 8 / fps) : 0;
+    }
+
+    std::string Stats::to_string() const
+    {
+        auto average = frames ? total_bytes / frames : 0;
+        auto error = frames ? 100 * total_error / frames : 0;
+        auto passes = frames ? double(total_passes) / frames : 0;
+        return "frames: " + std::to_string(frames) +
+               ", target: " + std::to_string(target_bytes) + " B" +
+               ", achieved: " + std::to_string(average) + " B" +
+               ", mean error: " + std::to_string(error) + "%" +
+               ", over: " + std::to_string(over_budget) +
+               ", under: " + std::to_string(under_budget) +
+               ", passes/frame: " + std::to_string(passes) +
+               ", quality: " + std::to_string(last_quality);
+    }
+
+    Controller::Controller(const Config &config) : config(config)
+    {
+        current.target_bytes = config.target_bytes;
+    }
+
+    int Controller::clamp_quality(double quality) const
+    {
+        auto rounded = int(std::lround(quality));
+        if (rounded < config.min_quality) return config.min_quality;
+        if (rounded > config.max_quality) return config.max_quality;
+        return rounded;
+    }
+
+    int Controller::predict() const
+    {
+        if (!has_history)
+            return clamp_quality(DEFAULT_QUALITY);
+
+        // aim at the middle of the accepted window
+        auto goal = std::log(config.target_bytes * (1 - config.tolerance / 2));
+        return clamp_quality(last_quality + (goal - last_log_bytes) / slope);
+    }
+
+    void Controller::learn(int quality, long bytes)
+    {
+        last_quality = quality;
+        last_log_bytes = std::log(double(bytes));
+        has_history = true;
+    }
+
+    int Controller::encode(const TooJpeg::Coefficients &coefficients, const char *comment,
+                           std::vector<unsigned char> &jpeg)
+    {
+        int quality;
+        double local_slope;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quality = predict();
+            local_slope = slope;
+        }
+
+        const auto target = config.target_bytes;
+        const auto lowest = long(target * (1 - config.tolerance));
+        const auto goal = std::log(target * (1 - config.tolerance / 2));
+
+        // best result so far: the largest frame within budget, otherwise the smallest one
+        std::vector<unsigned char> attempt;
+        long best_bytes = -1;
+        auto best_quality = quality;
+
+        // qualities that still may hit the window
+        auto low = config.min_quality;
+        auto high = config.max_quality;
+        auto previous_quality = -1;
+        double previous_log_bytes = 0;
+        auto passes = 0;
+
+        while (passes < config.max_passes)
+        {
+            auto bytes = encode_once(coefficients, quality, comment, attempt);
+            passes++;
+
+            auto better = best_bytes < 0 ||
+                          (bytes <= target && (best_bytes > target || bytes > best_bytes)) ||
+                          (bytes > target && best_bytes > target && bytes < best_bytes);
+            if (better)
+            {
+                jpeg.swap(attempt);
+                best_bytes = bytes;
+                best_quality = quality;
+            }
+
+            if (bytes <= target && bytes >= lowest)
+                break;
+            if (bytes > target)
+                high = quality - 1;
+            else
+                low = quality + 1;
+            if (low > high)
+                break;
+
+            // same content at two qualities: secant gives the local slope of the size/quality curve
+            auto log_bytes = std::log(double(bytes));
+            if (previous_quality >= 0 && previous_quality != quality)
+            {
+                auto secant = (log_bytes - previous_log_bytes) / (quality - previous_quality);
+                if (secant > 1e-3)
+                    local_slope = secant;
+            }
+            previous_quality = quality;
+            previous_log_bytes = log_bytes;
+
+            auto next = clamp_quality(quality + (goal - log_bytes) / local_slope);
+            if (next < low) next = low;
+            if (next > high) next = high;
+            if (next == quality)
+                break;
+            quality = next;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        // smooth the learned slope, single frames can be noisy
+        slope = 0.75 * slope + 0.25 * local_slope;
+        learn(best_quality, best_bytes);
+
+        current.frames++;
+        current.total_bytes += best_bytes;
+        current.total_passes += passes;
+        current.total_error += std::fabs(double(best_bytes - target)) / target;
+        current.last_quality = best_quality;
+        if (best_bytes > target)
+            current.over_budget++;
+        else if (best_bytes < lowest)
+            current.under_budget++;
+
+        return best_quality;
+    }
+
+    Stats Controller::stats()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return current;
+    }
+}
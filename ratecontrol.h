@@ -0,0 +1,69 @@
+#include <mutex>
+#include <string>
+#include <vector>
+#include "toojpeg.h"
+
+#ifndef SCZR00_RATECONTROL_H
+#define SCZR00_RATECONTROL_H
+
+namespace RateControl
+{
+    auto const DEFAULT_QUALITY = 90;
+
+    struct Config
+    {
+        long target_bytes = 0;   // byte budget per frame, 0 = rate control disabled
+        double tolerance = 0.15; // frames between (1 - tolerance) * target and target are accepted
+        int min_quality = 5;
+        int max_quality = 98;
+        int max_passes = 4;      // encodes per frame, including the first one
+    };
+
+    // budget per frame for a given bitrate (bits per second) and frame rate
+    long bytes_per_frame(long bitrate, double fps);
+
+    // achieved bitrate against the target, exported by the client after each frame
+    struct Stats
+    {
+        long frames = 0;
+        long target_bytes = 0;
+        long total_bytes = 0;
+        long total_passes = 0;   // number of encodes, re-quantizations included
+        long over_budget = 0;    // frames that are larger than target_bytes
+        long under_budget = 0;   // frames that are smaller than (1 - tolerance) * target_bytes
+        double total_error = 0;  // sum of |bytes - target| / target
+        int last_quality = DEFAULT_QUALITY;
+
+        std::string to_string() const;
+    };
+
+    // picks the quality for each frame from the size/quality curve of previous frames
+    // and re-quantizes cached DCT coefficients if the prediction misses the budget
+    class Controller
+    {
+    public:
+        explicit Controller(const Config &config);
+
+        // encode a frame analyzed by TooJpeg::analyzeJpeg(), returns the chosen quality
+        int encode(const TooJpeg::Coefficients &coefficients, const char *comment, std::vector<unsigned char> &jpeg);
+
+        Stats stats();
+
+    private:
+        int predict() const;
+        void learn(int quality, long bytes);
+        int clamp_quality(double quality) const;
+
+        Config config;
+        Stats current;
+        std::mutex mutex;
+
+        // model: log(bytes) is roughly linear in quality, slope is learned from observed frames
+        int last_quality = DEFAULT_QUALITY;
+        double last_log_bytes = 0;
+        double slope = 0.03;
+        bool has_history = false;
+    };
+}
+
+#endif //SCZR00_RATECONTROL_H
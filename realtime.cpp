@@ -0,0 +1,212 @@
+#include <fstream>
+#include <malloc.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "edf.h"
+#include "realtime.h"
+
+namespace RealTime
+{
+    bool lock_memory(long prefault_heap)
+    {
+        // Freed memory stays in the process, mmap'ed chunks would be returned (and faulted again) on every allocation
+        mallopt(M_TRIM_THRESHOLD, -1);
+        mallopt(M_MMAP_MAX, 0);
+
+        auto locked = mlockall(MCL_CURRENT | MCL_FUTURE) == 0;
+
+        // Grow the heap once, the pages stay resident for all later allocations
+        if (prefault_heap > 0)
+        {
+            auto heap = (char *) malloc(prefault_heap);
+            if (heap)
+            {
+                prefault(heap, prefault_heap);
+                free(heap);
+            }
+        }
+
+        prefault_stack();
+        return locked;
+    }
+
+    void prefault_stack()
+    {
+        unsigned char stack[PREFAULT_STACK_SIZE];
+        prefault(stack, PREFAULT_STACK_SIZE);
+    }
+
+    void prefault(void *buffer, long bytes)
+    {
+        auto page = sysconf(_SC_PAGESIZE);
+        auto data = (volatile unsigned char *) buffer;
+        for (long i = 0; i < bytes; i += page)
+            data[i] = data[i];
+    }
+
+    bool parse_cpus(const std::string &list, cpu_set_t &cpus)
+    {
+        CPU_ZERO(&cpus);
+        size_t pos = 0;
+        while (pos < list.size())
+        {
+            auto end = list.find(',', pos);
+            if (end == std::string::npos)
+                end = list.size();
+            auto range = list.substr(pos, end - pos);
+            pos = end + 1;
+            if (range.empty())
+                continue;
+
+            char *rest;
+            auto first = strtol(range.c_str(), &rest, 10);
+            auto last = first;
+            if (*rest == '-')
+                last = strtol(rest + 1, &rest, 10);
+            if (*rest != 0 || first < 0 || last < first || last >= CPU_SETSIZE)
+                return false;
+            for (auto cpu = first; cpu <= last; cpu++)
+                CPU_SET(cpu, &cpus);
+        }
+        return CPU_COUNT(&cpus) > 0;
+    }
+
+    cpu_set_t allowed_cpus()
+    {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        sched_getaffinity(0, sizeof(cpus), &cpus);
+        return cpus;
+    }
+
+    std::string isolated_cpus()
+    {
+        std::ifstream file("/sys/devices/system/cpu/isolated");
+        std::string list;
+        std::getline(file, list);
+        return list;
+    }
+
+    std::string to_string(const cpu_set_t &cpus)
+    {
+        std::string result;
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        {
+            if (!CPU_ISSET(cpu, &cpus))
+                continue;
+            auto last = cpu;
+            while (last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, &cpus))
+                last++;
+            if (!result.empty())
+                result += ",";
+            result += std::to_string(cpu);
+            if (last > cpu)
+                result += "-" + std::to_string(last);
+            cpu = last;
+        }
+        return result;
+    }
+
+    std::string pin_thread(const std::string &role, const std::string &cpus)
+    {
+        std::string note;
+        if (!cpus.empty())
+        {
+            cpu_set_t requested, allowed = allowed_cpus(), effective;
+            if (!parse_cpus(cpus, requested))
+                note = ", invalid cpu list '" + cpus + "'";
+            else
+            {
+                // Never ask for CPUs outside our cpuset, the kernel would reject the whole mask
+                CPU_AND(&effective, &requested, &allowed);
+                if (CPU_COUNT(&effective) == 0)
+                    note = ", cpus " + cpus + " not allowed (allowed: " + to_string(allowed) + ")";
+                else
+                {
+                    // returns the error instead of setting errno
+                    auto result = pthread_setaffinity_np(pthread_self(), sizeof(effective), &effective);
+                    if (result != 0)
+                        note = std::string(", pinning failed: ") + strerror(result);
+                    else if (CPU_COUNT(&effective) < CPU_COUNT(&requested))
+                        note = ", restricted to allowed cpus";
+                }
+            }
+        }
+
+        cpu_set_t current;
+        CPU_ZERO(&current);
+        pthread_getaffinity_np(pthread_self(), sizeof(current), &current);
+        return role + " tid " + std::to_string(gettid()) + " -> cpus " + to_string(current) +
+               " (running on " + std::to_string(sched_getcpu()) + note + ")";
+    }
+
+    bool parse_policy(const std::string &text, Policy &policy)
+    {
+        auto colon = text.find(':');
+        auto name = text.substr(0, colon);
+        auto params = colon == std::string::npos ? std::string() : text.substr(colon + 1);
+        policy = Policy();
+
+        if (name == "other")
+            return params.empty();
+        if (name == "fifo" || name == "rr")
+        {
+            policy.policy = name == "fifo" ? SCHED_FIFO : SCHED_RR;
+            policy.priority = atoi(params.c_str());
+            return policy.priority >= 1 && policy.priority <= 99;
+        }
+        if (name == "deadline")
+        {
+            double runtime = 0, period = 0, deadline = 0;
+            auto fields = sscanf(params.c_str(), "%lf/%lf/%lf", &runtime, &period, &deadline);
+            if (fields < 2)
+                return false;
+            if (fields == 2)
+                deadline = period;
+            policy.policy = SCHED_DEADLINE;
+            policy.runtime_ns = (long long) (runtime * 1000000);
+            policy.period_ns = (long long) (period * 1000000);
+            policy.deadline_ns = (long long) (deadline * 1000000);
+            // the kernel requires runtime <= deadline <= period
+            return policy.runtime_ns > 0 && policy.runtime_ns <= policy.deadline_ns && policy.deadline_ns <= policy.period_ns;
+        }
+        return false;
+    }
+
+    std::string to_string(const Policy &policy)
+    {
+        switch (policy.policy)
+        {
+            case SCHED_FIFO:
+                return "fifo:" + std::to_string(policy.priority);
+            case SCHED_RR:
+                return "rr:" + std::to_string(policy.priority);
+            case SCHED_DEADLINE:
+            {
+                char text[64];
+                snprintf(text, sizeof(text), "deadline:%g/%g/%g", policy.runtime_ns / 1e6, policy.period_ns / 1e6,
+                         policy.deadline_ns / 1e6);
+                return text;
+            }
+            default:
+                return "other";
+        }
+    }
+
+    int apply_policy(const Policy &policy)
+    {
+        struct EDF::sched_attr attr{};
+        attr.size = sizeof(attr);
+        attr.sched_policy = policy.policy;
+        attr.sched_priority = policy.priority;
+        attr.sched_runtime = policy.runtime_ns;
+        attr.sched_deadline = policy.deadline_ns;
+        attr.sched_period = policy.period_ns;
+        return EDF::sched_setattr(0, &attr, 0) < 0 ? errno : 0;
+    }
+}
@@ -0,0 +1,71 @@
+#include <sched.h>
+#include <string>
+
+#ifndef SCZR00_REALTIME_H
+#define SCZR00_REALTIME_H
+
+namespace RealTime
+{
+    // stack touched by prefault_stack(), must stay below the thread's stack size
+    auto const PREFAULT_STACK_SIZE = 256 * 1024;
+
+    // stack of the per-frame encoder threads instead of the 8 MB default, which mlockall(MCL_FUTURE) would pin
+    auto const THREAD_STACK_SIZE = 4 * PREFAULT_STACK_SIZE;
+
+    struct Config
+    {
+        bool lock_memory = false;  // mlockall() and heap/stack prefaulting in every process
+        long prefault_heap = 16 * 1024 * 1024;
+
+        // CPU lists like "2-3,6", empty = inherit; applied to the calling thread of each role
+        std::string producer_cpus;
+        std::string receiver_cpus;
+        std::string encoder_cpus;
+        std::string archiver_cpus;
+    };
+
+    // Lock all current and future pages, stop glibc from returning heap memory to the kernel
+    // and prefault prefault_heap bytes of heap; returns false if mlockall() is not permitted
+    bool lock_memory(long prefault_heap);
+
+    // Touch PREFAULT_STACK_SIZE bytes of the calling thread's stack
+    void prefault_stack();
+
+    // Touch every page of a buffer
+    void prefault(void *buffer, long bytes);
+
+    // Parse a CPU list ("0-3,6"), returns false on syntax errors
+    bool parse_cpus(const std::string &list, cpu_set_t &cpus);
+
+    // CPUs this process may run on (cgroup cpuset and inherited affinity applied)
+    cpu_set_t allowed_cpus();
+
+    // CPUs isolated from the scheduler by the isolcpus= kernel parameter
+    std::string isolated_cpus();
+
+    // Pin the calling thread to the given CPU list, restricted to allowed_cpus()
+    // returns a placement report: "<role> tid <tid> -> cpus <list> (running on <cpu>)"
+    std::string pin_thread(const std::string &role, const std::string &cpus);
+
+    std::string to_string(const cpu_set_t &cpus);
+
+    // Scheduling policy of the encoder threads
+    struct Policy
+    {
+        int policy = SCHED_OTHER;  // SCHED_OTHER, SCHED_FIFO, SCHED_RR or SCHED_DEADLINE
+        int priority = 0;          // 1..99 for SCHED_FIFO / SCHED_RR
+        long long runtime_ns = 0;  // SCHED_DEADLINE reservation: runtime every period, done by the relative deadline
+        long long deadline_ns = 0;
+        long long period_ns = 0;
+    };
+
+    // "other", "fifo:PRIO", "rr:PRIO" or "deadline:RUNTIME_MS/PERIOD_MS[/DEADLINE_MS]" (deadline defaults to the period)
+    bool parse_policy(const std::string &text, Policy &policy);
+
+    std::string to_string(const Policy &policy);
+
+    // Switch the calling thread to the policy, returns 0 or the errno of sched_setattr()
+    int apply_policy(const Policy &policy);
+}
+
+#endif //SCZR00_REALTIME_H
@@ -0,0 +1,279 @@
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstdlib>
+#include <ctime>
+#include <sstream>
+#include "receiver.h"
+
+namespace Receiver
+{
+    namespace
+    {
+        auto const MAX_EVENTS = 16;
+
+        // same clock as Logger::now_ns(), so callers can subtract the producer's timestamps
+        long long now_ns()
+        {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        long long cpu_ns()
+        {
+            timespec now{};
+            clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+            return now.tv_sec * 1000000000LL + now.tv_nsec;
+        }
+
+        // nearest rank on sorted samples
+        long long percentile(const std::vector<long long> &sorted, double fraction)
+        {
+            if (sorted.empty())
+                return 0;
+            auto rank = size_t(fraction * (sorted.size() - 1) + 0.5);
+            return sorted[std::min(rank, sorted.size() - 1)];
+        }
+
+        std::string us(long long ns)
+        {
+            return std::to_string(ns / 1000) + " us";
+        }
+    }
+
+    bool parse_policy(const std::string &text, Policy &policy)
+    {
+        auto colon = text.find(':');
+        auto name = text.substr(0, colon);
+        auto params = colon == std::string::npos ? std::string() : text.substr(colon + 1);
+        Policy parsed;
+
+        if ((name == "block" || name == "spin") && params.empty())
+            parsed.mode = name == "block" ? BLOCK : SPIN;
+        else if (name == "hybrid" && !params.empty())
+        {
+            char *end = nullptr;
+            parsed.mode = HYBRID;
+            parsed.spin_ns = (long long) (strtod(params.c_str(), &end) * 1000);
+            if (*end != 0 || parsed.spin_ns <= 0)
+                return false;
+        }
+        else
+            return false;
+        // policy is left unchanged on errors
+        policy = parsed;
+        return true;
+    }
+
+    std::string to_string(const Policy &policy)
+    {
+        switch (policy.mode)
+        {
+            case SPIN:
+                return "spin";
+            case HYBRID:
+                return "hybrid:" + std::to_string(policy.spin_ns / 1000);
+            default:
+                return "block";
+        }
+    }
+
+    std::string Stats::to_string() const
+    {
+        return "messages: " + std::to_string(messages) + ", timers: " + std::to_string(timers) +
+               ", polled: " + std::to_string(polled) + ", sleeps: " + std::to_string(sleeps) +
+               ", wakeup p50: " + us(p50_ns) + ", p99: " + us(p99_ns) + ", max: " + us(max_ns) +
+               ", mean: " + us(mean_ns) + ", cpu: " + std::to_string(cpu_ns / 1000000) + " ms";
+    }
+
+    std::string Stats::to_record() const
+    {
+        return "messages=" + std::to_string(messages) + " timers=" + std::to_string(timers) +
+               " polled=" + std::to_string(polled) + " sleeps=" + std::to_string(sleeps) +
+               " cpu_ns=" + std::to_string(cpu_ns) + " wakeups=" + std::to_string(wakeups) +
+               " wakeup_mean_ns=" + std::to_string(mean_ns) + " wakeup_p50_ns=" + std::to_string(p50_ns) +
+               " wakeup_p99_ns=" + std::to_string(p99_ns) + " wakeup_max_ns=" + std::to_string(max_ns);
+    }
+
+    bool Stats::parse(const std::string &record, Stats &stats)
+    {
+        std::istringstream fields(record);
+        std::string field;
+        auto found = 0;
+        while (fields >> field)
+        {
+            auto equals = field.find('=');
+            if (equals == std::string::npos)
+                return false;
+            auto key = field.substr(0, equals);
+            auto value = strtoll(field.c_str() + equals + 1, nullptr, 10);
+            found++;
+            if (key == "messages") stats.messages = long(value);
+            else if (key == "timers") stats.timers = long(value);
+            else if (key == "polled") stats.polled = long(value);
+            else if (key == "sleeps") stats.sleeps = long(value);
+            else if (key == "cpu_ns") stats.cpu_ns = value;
+            else if (key == "wakeups") stats.wakeups = long(value);
+            else if (key == "wakeup_mean_ns") stats.mean_ns = value;
+            else if (key == "wakeup_p50_ns") stats.p50_ns = value;
+            else if (key == "wakeup_p99_ns") stats.p99_ns = value;
+            else if (key == "wakeup_max_ns") stats.max_ns = value;
+            else found--;
+        }
+        return found > 0;
+    }
+
+    Loop::Loop(const Policy &policy) : policy(policy)
+    {
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    }
+
+    Loop::~Loop()
+    {
+        for (auto &source : sources)
+            if (source.timer)
+                close(source.fd);
+        if (epoll_fd >= 0)
+            close(epoll_fd);
+    }
+
+    int Loop::add_queue(mqd_t queue)
+    {
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.u32 = uint32_t(sources.size());
+        if (queue == (mqd_t) -1 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, queue, &event) != 0)
+            return -1;
+        sources.push_back({queue, false});
+        return int(sources.size() - 1);
+    }
+
+    int Loop::add_timer()
+    {
+        auto fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (fd < 0)
+            return -1;
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.u32 = uint32_t(sources.size());
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0)
+        {
+            close(fd);
+            return -1;
+        }
+        sources.push_back({fd, true});
+        return int(sources.size() - 1);
+    }
+
+    bool Loop::arm(int timer, long long deadline_ns)
+    {
+        if (timer < 0 || timer >= int(sources.size()) || !sources[timer].timer)
+            return false;
+        // an absolute deadline in the past fires immediately, 0 in it_value disarms
+        itimerspec expiration{};
+        expiration.it_value.tv_sec = deadline_ns / 1000000000;
+        expiration.it_value.tv_nsec = deadline_ns % 1000000000;
+        return timerfd_settime(sources[timer].fd, TFD_TIMER_ABSTIME, &expiration, nullptr) == 0;
+    }
+
+    Event Loop::wait(char *buffer, size_t size)
+    {
+        Event result;
+        if (sources.empty())
+            return result; // nothing could ever become ready
+        auto cpu_start = cpu_ns();
+        epoll_event ready[MAX_EVENTS];
+        while (result.kind == Event::FAILED)
+        {
+            auto count = 0;
+            if (policy.mode != BLOCK)
+            {
+                // each poll is one epoll_wait() without timeout, covering all queues and timers at once
+                auto give_up = policy.mode == SPIN ? LLONG_MAX : now_ns() + policy.spin_ns;
+                while ((count = epoll_wait(epoll_fd, ready, MAX_EVENTS, 0)) <= 0 && now_ns() < give_up)
+                    if (count < 0 && errno != EINTR)
+                        break;
+                if (count > 0)
+                    counts.polled++;
+            }
+            if (count <= 0)
+            {
+                counts.sleeps++;
+                while ((count = epoll_wait(epoll_fd, ready, MAX_EVENTS, -1)) < 0 && errno == EINTR)
+                    ;
+                if (count < 0)
+                    break;
+            }
+
+            // the ready source at or after the round robin position, so one busy queue cannot starve the others
+            auto chosen = ready[0].data.u32;
+            auto distance = (chosen + sources.size() - next) % sources.size();
+            for (auto i = 1; i < count; i++)
+            {
+                auto candidate = ready[i].data.u32;
+                auto candidate_distance = (candidate + sources.size() - next) % sources.size();
+                if (candidate_distance < distance)
+                {
+                    chosen = candidate;
+                    distance = candidate_distance;
+                }
+            }
+            next = (chosen + 1) % sources.size();
+
+            auto &source = sources[chosen];
+            if (source.timer)
+            {
+                uint64_t expirations = 0;
+                if (read(source.fd, &expirations, sizeof(expirations)) == sizeof(expirations))
+                {
+                    result.kind = Event::TIMER;
+                    counts.timers++;
+                }
+            }
+            else
+            {
+                result.size = mq_receive(source.fd, buffer, size, nullptr);
+                if (result.size >= 0)
+                {
+                    result.kind = Event::MESSAGE;
+                    counts.messages++;
+                }
+                else if (errno != EAGAIN)
+                    break;
+            }
+            // EAGAIN: the event was consumed meanwhile (timer re-armed, message taken by another reader), wait again
+            result.source = int(chosen);
+        }
+        result.ready_ns = now_ns();
+        counts.cpu_ns += cpu_ns() - cpu_start;
+        return result;
+    }
+
+    void Loop::record(long long latency_ns)
+    {
+        samples.push_back(latency_ns);
+    }
+
+    Stats Loop::stats() const
+    {
+        auto result = counts;
+        auto sorted = samples;
+        std::sort(sorted.begin(), sorted.end());
+        result.wakeups = long(sorted.size());
+        if (!sorted.empty())
+        {
+            long long total = 0;
+            for (auto sample : sorted)
+                total += sample;
+            result.mean_ns = total / (long long) sorted.size();
+            result.p50_ns = percentile(sorted, 0.5);
+            result.p99_ns = percentile(sorted, 0.99);
+            result.max_ns = sorted.back();
+        }
+        return result;
+    }
+}
@@ -0,0 +1,107 @@
+#include <mqueue.h>
+#include <sys/types.h>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#ifndef SCZR00_RECEIVER_H
+#define SCZR00_RECEIVER_H
+
+// Receiving end of the producer -> client hand-off. Any number of message queues (mq descriptors are pollable on
+// Linux) and timerfd deadlines share one epoll set, the policy decides how the receiving thread waits for them:
+// sleep in epoll_wait() right away, poll without ever sleeping, or poll for a bounded time and sleep only if
+// nothing arrived meanwhile. Polling spends receiver CPU time on a shorter and steadier wakeup latency,
+// the time from mq_send() until the receiver holds the message.
+namespace Receiver
+{
+    enum Mode
+    {
+        BLOCK,  // sleep until an event arrives
+        SPIN,   // poll until an event arrives, never sleeps
+        HYBRID  // poll for spin_ns, then sleep
+    };
+
+    struct Policy
+    {
+        Mode mode = BLOCK;
+        long long spin_ns = 0;
+    };
+
+    // "block", "spin" or "hybrid:US"
+    bool parse_policy(const std::string &text, Policy &policy);
+    std::string to_string(const Policy &policy);
+
+    struct Event
+    {
+        enum Kind { MESSAGE, TIMER, FAILED };
+
+        Kind kind = FAILED;
+        int source = -1;        // id returned by add_queue() or add_timer()
+        ssize_t size = 0;       // received bytes of a MESSAGE
+        long long ready_ns = 0; // monotonic ns (see Logger::now_ns()) when wait() got hold of the event
+    };
+
+    struct Stats
+    {
+        long messages = 0;
+        long timers = 0;
+        long polled = 0;         // events found while polling, without going to sleep
+        long sleeps = 0;         // blocking epoll_wait() calls, after polling found nothing
+        long long cpu_ns = 0;    // receiver CPU time spent inside wait()
+        long wakeups = 0;        // recorded wakeup latencies, see Loop::record()
+        long long mean_ns = 0;
+        long long p50_ns = 0;
+        long long p99_ns = 0;
+        long long max_ns = 0;
+
+        std::string to_string() const;
+
+        // single "key=value ..." line, read back by parse()
+        std::string to_record() const;
+        static bool parse(const std::string &record, Stats &stats);
+    };
+
+    // Not thread safe, owned by the receiving thread
+    class Loop
+    {
+    public:
+        explicit Loop(const Policy &policy);
+        ~Loop();
+
+        bool valid() const { return epoll_fd >= 0; }
+
+        // returns the source id of the queue or -1, the queue must be opened with O_NONBLOCK
+        int add_queue(mqd_t queue);
+
+        // returns the source id of a new disarmed timer or -1
+        int add_timer();
+
+        // fire once at the monotonic time deadline_ns, 0 disarms
+        bool arm(int timer, long long deadline_ns);
+
+        // next message or timer expiration, ready sources are served round robin;
+        // a message is copied to buffer, which must hold mq_msgsize bytes; FAILED without any source
+        Event wait(char *buffer, size_t size);
+
+        // wakeup latency of a received message, measured by the caller from the sender's timestamp to ready_ns
+        void record(long long latency_ns);
+
+        Stats stats() const;
+
+    private:
+        struct Source
+        {
+            int fd;
+            bool timer;
+        };
+
+        Policy policy;
+        int epoll_fd = -1;
+        std::vector<Source> sources;
+        size_t next = 0; // first source considered by the next wait()
+        std::vector<long long> samples;
+        Stats counts;
+    };
+}
+
+#endif //SCZR00_RECEIVER_H
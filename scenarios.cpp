@@ -0,0 +1,373 @@
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "latency.h"
+#include "realtime.h"
+#include "receiver.h"
+
+// Usage: sczr00_scenarios [--policies=LIST] [--receive=LIST] [--cpu-hogs=N] [--mem-thrashers=N] [--thrash-mb=N] [--io-writers=N]
+//                         [--io-dir=DIR] [--interference-cpus=LIST] [--binary=PATH] [--timeout=S] [--csv=FILE]
+//                         [-- sczr00 options]
+// Runs the pipeline once per scheduling policy and receive policy under the same background load and compares the runs.
+
+namespace
+{
+    struct Config
+    {
+        std::vector<std::string> policies{"other", "fifo:50", "rr:50", "deadline:10/30", "deadline:20/30"};
+        std::vector<std::string> receive{"block"};
+        int cpu_hogs = 0;
+        int mem_thrashers = 0;
+        long thrash_mb = 256;
+        int io_writers = 0;
+        std::string io_dir = "/tmp";
+        std::string interference_cpus;
+        std::string binary;
+        int timeout = 120;
+        std::string csv;
+        std::vector<std::string> pipeline{"--frames=300", "--fps=30", "--width=640", "--height=480", "--deadline-ms=33"};
+    };
+
+    struct Run
+    {
+        std::string policy;
+        std::string receive;
+        std::string status; // "ok" or why the run has no results
+        Latency::Summary summary;
+        Receiver::Stats wakeups;
+        double seconds = 0;
+    };
+
+    std::vector<std::string> split(const std::string &list, char separator)
+    {
+        std::vector<std::string> result;
+        size_t pos = 0;
+        while (pos <= list.size())
+        {
+            auto end = list.find(separator, pos);
+            if (end == std::string::npos)
+                end = list.size();
+            if (end > pos)
+                result.push_back(list.substr(pos, end - pos));
+            pos = end + 1;
+        }
+        return result;
+    }
+
+    // sczr00 next to this executable
+    std::string default_binary()
+    {
+        char path[4096];
+        auto length = readlink("/proc/self/exe", path, sizeof(path) - 1);
+        if (length <= 0)
+            return "./sczr00";
+        path[length] = 0;
+        std::string self(path);
+        return self.substr(0, self.rfind('/') + 1) + "sczr00";
+    }
+
+    // ////////////////////////////////////////
+    // interference, one process each so they can be killed at once
+
+    void cpu_hog()
+    {
+        volatile unsigned long counter = 0;
+        while (true)
+            counter++;
+    }
+
+    // streams through a buffer larger than the last level cache
+    void mem_thrasher(long megabytes)
+    {
+        auto size = size_t(megabytes) * 1024 * 1024;
+        auto buffer = (unsigned char *) malloc(size);
+        if (!buffer)
+            _exit(1);
+        memset(buffer, 1, size);
+        while (true)
+        {
+            memmove(buffer, buffer + size / 2, size / 2);
+            memmove(buffer + size / 2, buffer, size / 2);
+        }
+    }
+
+    // buffered writes with periodic fdatasync, keeps the block layer and page cache writeback busy
+    void io_writer(const std::string &dir)
+    {
+        auto path = dir + "/sczr00_io_" + std::to_string(getpid());
+        auto fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+        if (fd < 0)
+            _exit(1);
+        unlink(path.c_str()); // space is released when the writer is killed
+
+        std::vector<char> chunk(1024 * 1024, 'x');
+        long written = 0;
+        while (true)
+        {
+            if (write(fd, chunk.data(), chunk.size()) < 0)
+                _exit(1);
+            written += chunk.size();
+            if (written % (16 * 1024 * 1024) == 0)
+                fdatasync(fd);
+            if (written >= 256L * 1024 * 1024)
+            {
+                lseek(fd, 0, SEEK_SET);
+                written = 0;
+            }
+        }
+    }
+
+    pid_t spawn(const Config &config, void (*work)(const Config &))
+    {
+        auto child = fork();
+        if (child == 0)
+        {
+            if (!config.interference_cpus.empty())
+            {
+                cpu_set_t cpus;
+                if (RealTime::parse_cpus(config.interference_cpus, cpus))
+                    sched_setaffinity(0, sizeof(cpus), &cpus);
+            }
+            work(config);
+            _exit(0);
+        }
+        return child;
+    }
+
+    std::vector<pid_t> start_interference(const Config &config)
+    {
+        std::vector<pid_t> workers;
+        for (int i = 0; i < config.cpu_hogs; i++)
+            workers.push_back(spawn(config, [](const Config &) { cpu_hog(); }));
+        for (int i = 0; i < config.mem_thrashers; i++)
+            workers.push_back(spawn(config, [](const Config &c) { mem_thrasher(c.thrash_mb); }));
+        for (int i = 0; i < config.io_writers; i++)
+            workers.push_back(spawn(config, [](const Config &c) { io_writer(c.io_dir); }));
+        return workers;
+    }
+
+    void stop(std::vector<pid_t> &workers)
+    {
+        for (auto worker : workers)
+            if (worker > 0)
+                kill(worker, SIGKILL);
+        for (auto worker : workers)
+            if (worker > 0)
+                waitpid(worker, nullptr, 0);
+        workers.clear();
+    }
+
+    // ////////////////////////////////////////
+    // pipeline runs
+
+    Run run(const Config &config, const std::string &policy, const std::string &receive)
+    {
+        Run result;
+        result.policy = policy;
+        result.receive = receive;
+        auto results_path = "/tmp/sczr00_results_" + std::to_string(getpid());
+        auto log_path = "/tmp/sczr00_run_" + std::to_string(getpid()) + ".log";
+        unlink(results_path.c_str());
+
+        std::vector<std::string> args{config.binary};
+        args.insert(args.end(), config.pipeline.begin(), config.pipeline.end());
+        args.push_back("--policy=" + policy);
+        args.push_back("--receive=" + receive);
+        args.push_back("--results=" + results_path);
+
+        auto workers = start_interference(config);
+        auto start = std::chrono::steady_clock::now();
+
+        auto child = fork();
+        if (child == 0)
+        {
+            // own process group: the pipeline forks its client, a timeout kills both
+            setpgid(0, 0);
+            auto log = open(log_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (log >= 0)
+            {
+                dup2(log, STDOUT_FILENO);
+                dup2(log, STDERR_FILENO);
+            }
+            std::vector<char *> argv;
+            for (auto &arg : args)
+                argv.push_back((char *) arg.c_str());
+            argv.push_back(nullptr);
+            execv(argv[0], argv.data());
+            _exit(127);
+        }
+        setpgid(child, child);
+
+        int status = 0;
+        auto finished = false;
+        while (!finished)
+        {
+            auto done = waitpid(child, &status, WNOHANG);
+            finished = done == child || (done < 0 && errno != EINTR);
+            if (!finished && std::chrono::steady_clock::now() - start > std::chrono::seconds(config.timeout))
+            {
+                kill(-child, SIGKILL);
+                waitpid(child, &status, 0);
+                result.status = "timeout";
+                break;
+            }
+            if (!finished)
+                usleep(10000);
+        }
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        kill(-child, SIGKILL); // a client left behind would keep the queue busy
+        stop(workers);
+
+        std::ifstream results(results_path);
+        std::string record;
+        if (result.status.empty())
+        {
+            if (WIFEXITED(status) && WEXITSTATUS(status) == 127)
+                result.status = "cannot run " + config.binary;
+            else if (!std::getline(results, record) || !Latency::Summary::parse(record, result.summary))
+                result.status = "no results, see " + log_path;
+            else if (result.summary.policy_errors > 0)
+                result.status = "policy not applied (" + std::to_string(result.summary.policy_errors) + " threads)";
+            else
+                result.status = "ok";
+            // second line, missing if the pipeline predates receive policies
+            if (std::getline(results, record))
+                Receiver::Stats::parse(record, result.wakeups);
+        }
+        unlink(results_path.c_str());
+        return result;
+    }
+
+    void report(const Config &config, const std::vector<Run> &runs)
+    {
+        printf("\ninterference: %d cpu hog(s), %d memory thrasher(s) of %ld MB, %d io writer(s)%s\n",
+               config.cpu_hogs, config.mem_thrashers, config.thrash_mb, config.io_writers,
+               config.interference_cpus.empty() ? "" : (" on cpus " + config.interference_cpus).c_str());
+        std::string pipeline;
+        for (auto &arg : config.pipeline)
+            pipeline += " " + arg;
+        printf("pipeline:%s\n\n", pipeline.c_str());
+
+        // wake columns: producer mq_send() -> receiver holds the message, rx cpu: receiver CPU time spent waiting
+        printf("%-18s %-12s %7s %7s %7s %9s %10s %10s %10s %10s %10s %10s %10s %9s  %s\n",
+               "policy", "receive", "frames", "missed", "dropped", "miss rate", "p50 us", "p90 us", "p99 us", "p99.9 us",
+               "max us", "wake p50", "wake p99", "rx cpu ms", "status");
+        for (auto &run : runs)
+        {
+            auto &s = run.summary;
+            auto &w = run.wakeups;
+            printf("%-18s %-12s %7ld %7ld %7ld %8.2f%% %10lld %10lld %10lld %10lld %10lld %10lld %10lld %9lld  %s\n",
+                   run.policy.c_str(), run.receive.c_str(), s.frames, s.misses, s.dropped, 100 * s.miss_rate(),
+                   s.p50_ns / 1000, s.p90_ns / 1000, s.p99_ns / 1000, s.p999_ns / 1000, s.max_ns / 1000,
+                   w.p50_ns / 1000, w.p99_ns / 1000, w.cpu_ns / 1000000, run.status.c_str());
+        }
+
+        if (config.csv.empty())
+            return;
+        std::ofstream csv(config.csv, std::ios_base::out | std::ios_base::trunc);
+        csv << "policy,receive,cpu_hogs,mem_thrashers,io_writers,frames,misses,dropped,miss_rate,"
+               "mean_ns,p50_ns,p90_ns,p99_ns,p999_ns,max_ns,wakeup_p50_ns,wakeup_p99_ns,wakeup_max_ns,receiver_cpu_ns,"
+               "seconds,status\n";
+        for (auto &run : runs)
+        {
+            auto &s = run.summary;
+            auto &w = run.wakeups;
+            csv << run.policy << "," << run.receive << "," << config.cpu_hogs << "," << config.mem_thrashers << "," << config.io_writers << ","
+                << s.frames << "," << s.misses << "," << s.dropped << "," << s.miss_rate() << ","
+                << s.mean_ns << "," << s.p50_ns << "," << s.p90_ns << "," << s.p99_ns << "," << s.p999_ns << ","
+                << s.max_ns << "," << w.p50_ns << "," << w.p99_ns << "," << w.max_ns << "," << w.cpu_ns << ","
+                << run.seconds << ",\"" << run.status << "\"\n";
+        }
+    }
+
+    bool option(const char *arg, const std::string &name, std::string &value)
+    {
+        auto prefix = "--" + name + "=";
+        if (strncmp(arg, prefix.c_str(), prefix.size()) != 0)
+            return false;
+        value = arg + prefix.size();
+        return true;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    Config config;
+    config.binary = default_binary();
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string value;
+        if (strcmp(argv[i], "--") == 0)
+        {
+            // everything after "--" replaces the default pipeline options
+            config.pipeline.assign(argv + i + 1, argv + argc);
+            break;
+        }
+        else if (option(argv[i], "policies", value))
+            config.policies = split(value, ',');
+        else if (option(argv[i], "receive", value))
+            config.receive = split(value, ',');
+        else if (option(argv[i], "cpu-hogs", value))
+            config.cpu_hogs = atoi(value.c_str());
+        else if (option(argv[i], "mem-thrashers", value))
+            config.mem_thrashers = atoi(value.c_str());
+        else if (option(argv[i], "thrash-mb", value))
+            config.thrash_mb = atol(value.c_str());
+        else if (option(argv[i], "io-writers", value))
+            config.io_writers = atoi(value.c_str());
+        else if (option(argv[i], "io-dir", value))
+            config.io_dir = value;
+        else if (option(argv[i], "interference-cpus", value))
+            config.interference_cpus = value;
+        else if (option(argv[i], "binary", value))
+            config.binary = value;
+        else if (option(argv[i], "timeout", value))
+            config.timeout = atoi(value.c_str());
+        else if (option(argv[i], "csv", value))
+            config.csv = value;
+        else
+        {
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            return 2;
+        }
+    }
+
+    for (auto &receive : config.receive)
+    {
+        Receiver::Policy parsed;
+        if (!Receiver::parse_policy(receive, parsed))
+        {
+            fprintf(stderr, "Invalid receive policy '%s'\n", receive.c_str());
+            return 2;
+        }
+    }
+
+    std::vector<Run> runs;
+    for (auto &policy : config.policies)
+    {
+        RealTime::Policy parsed;
+        if (!RealTime::parse_policy(policy, parsed))
+        {
+            fprintf(stderr, "Invalid policy '%s'\n", policy.c_str());
+            return 2;
+        }
+        for (auto &receive : config.receive)
+        {
+            printf("running %s, receive %s ...\n", policy.c_str(), receive.c_str());
+            fflush(stdout);
+            runs.push_back(run(config, policy, receive));
+        }
+    }
+    report(config, runs);
+    return 0;
+}
@@ -0,0 +1,309 @@
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include "streamserver.h"
+
+// MSG_ZEROCOPY is only implemented for TCP and UDP sockets, on Unix domain sockets the kernel copies once per
+// subscriber anyway; batching several frames per sendmsg() keeps the number of system calls low instead.
+
+namespace StreamServer
+{
+    namespace
+    {
+        auto const DRAIN_MS = 1000;
+    }
+
+    std::string Stats::to_string() const
+    {
+        return "subscribers: " + std::to_string(subscribers) +
+               " (accepted " + std::to_string(accepted) + ", disconnected " + std::to_string(disconnected) + ")" +
+               ", published: " + std::to_string(published) +
+               ", sent: " + std::to_string(sent) +
+               ", dropped: " + std::to_string(dropped) +
+               ", bytes: " + std::to_string(bytes) +
+               ", sendmsg calls: " + std::to_string(writes);
+    }
+
+    Server *Server::start(const Config &config, std::string &error)
+    {
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        if (config.path.empty() || config.path.size() >= sizeof(address.sun_path))
+        {
+            error = "invalid socket path '" + config.path + "'";
+            return nullptr;
+        }
+        strcpy(address.sun_path, config.path.c_str());
+
+        auto server = new Server(config);
+        server->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        unlink(config.path.c_str());
+        if (server->listen_fd < 0 ||
+            bind(server->listen_fd, (sockaddr *) &address, sizeof(address)) != 0 ||
+            listen(server->listen_fd, 16) != 0 ||
+            (server->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0 ||
+            (server->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+        {
+            error = "cannot serve on " + config.path + ": " + strerror(errno);
+            delete server;
+            return nullptr;
+        }
+
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.ptr = nullptr; // listening socket
+        epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, server->listen_fd, &event);
+        event.data.ptr = server;  // wake-up
+        epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, server->wake_fd, &event);
+
+        server->thread = std::thread(&Server::run, server);
+        return server;
+    }
+
+    Server::~Server()
+    {
+        stop();
+        for (auto fd : {listen_fd, wake_fd, epoll_fd})
+            if (fd >= 0)
+                close(fd);
+    }
+
+    void Server::publish(int task_id, Frame frame)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            current.published++;
+            for (auto &subscriber : subscribers)
+            {
+                auto &queue = subscriber->queue;
+                if (queue.size() >= config.queue_frames)
+                {
+                    // drop the oldest frame that has not been started, a partly sent one must be completed
+                    auto oldest = queue.begin() + (subscriber->offset > 0 ? 1 : 0);
+                    if (oldest != queue.end())
+                    {
+                        queue.erase(oldest);
+                        current.dropped++;
+                    }
+                }
+                queue.push_back(Queued{FrameHeader{MAGIC, task_id, uint32_t(frame->size())}, frame});
+            }
+        }
+        uint64_t one = 1;
+        if (write(wake_fd, &one, sizeof(one)) < 0)
+            return; // counter overflow is impossible, the server thread drains it
+    }
+
+    void Server::stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (stopping)
+                return;
+            stopping = true;
+        }
+        uint64_t one = 1;
+        if (wake_fd >= 0 && write(wake_fd, &one, sizeof(one)) < 0)
+            return;
+        if (thread.joinable())
+            thread.join();
+        unlink(config.path.c_str());
+    }
+
+    Stats Server::stats()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return current;
+    }
+
+    void Server::run()
+    {
+        epoll_event events[32];
+        while (true)
+        {
+            auto count = epoll_wait(epoll_fd, events, 32, -1);
+            if (count < 0 && errno != EINTR)
+                break;
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if (stopping)
+                break;
+
+            auto woken = false;
+            for (int i = 0; i < count; i++)
+            {
+                auto &event = events[i];
+                if (event.data.ptr == nullptr)
+                {
+                    accept_subscribers();
+                    continue;
+                }
+                if (event.data.ptr == this)
+                {
+                    uint64_t value;
+                    woken = read(wake_fd, &value, sizeof(value)) > 0 || woken;
+                    continue;
+                }
+
+                auto subscriber = (Subscriber *) event.data.ptr;
+                if (subscriber->fd < 0)
+                    continue;
+                if (event.events & (EPOLLHUP | EPOLLERR | EPOLLRDHUP))
+                {
+                    disconnect(*subscriber);
+                    continue;
+                }
+                if (event.events & EPOLLIN)
+                {
+                    // subscribers have nothing to say, read until empty and watch for the end of the stream
+                    char discard[256];
+                    ssize_t received;
+                    while ((received = recv(subscriber->fd, discard, sizeof(discard), MSG_DONTWAIT)) > 0);
+                    if (received == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+                    {
+                        disconnect(*subscriber);
+                        continue;
+                    }
+                }
+                if (event.events & EPOLLOUT)
+                    flush(*subscriber);
+            }
+
+            // new frames: write to everybody who is not waiting for socket buffer space
+            if (woken)
+                for (auto &subscriber : subscribers)
+                    if (subscriber->fd >= 0 && !subscriber->want_write)
+                        flush(*subscriber);
+
+            subscribers.erase(std::remove_if(subscribers.begin(), subscribers.end(),
+                                             [](const std::unique_ptr<Subscriber> &s) { return s->fd < 0; }),
+                              subscribers.end());
+        }
+
+        // give subscribers up to DRAIN_MS to take the frames that are still queued
+        auto drain_end = std::chrono::steady_clock::now() + std::chrono::milliseconds(DRAIN_MS);
+        std::unique_lock<std::mutex> lock(mutex);
+        while (std::chrono::steady_clock::now() < drain_end)
+        {
+            auto pending = false;
+            for (auto &subscriber : subscribers)
+                if (subscriber->fd >= 0 && flush(*subscriber) && !subscriber->queue.empty())
+                    pending = true;
+            if (!pending)
+                break;
+            lock.unlock();
+            usleep(1000);
+            lock.lock();
+        }
+        for (auto &subscriber : subscribers)
+            disconnect(*subscriber);
+        subscribers.clear();
+    }
+
+    void Server::accept_subscribers()
+    {
+        int fd;
+        while ((fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+        {
+            auto subscriber = new Subscriber;
+            subscriber->fd = fd;
+            subscribers.emplace_back(subscriber);
+
+            epoll_event event{};
+            event.events = EPOLLIN | EPOLLRDHUP;
+            event.data.ptr = subscriber;
+            epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+
+            current.accepted++;
+            current.subscribers++;
+        }
+    }
+
+    void Server::disconnect(Subscriber &subscriber)
+    {
+        if (subscriber.fd < 0)
+            return;
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, subscriber.fd, nullptr);
+        close(subscriber.fd);
+        subscriber.fd = -1;
+        subscriber.queue.clear();
+        current.subscribers--;
+        current.disconnected++;
+    }
+
+    void Server::watch_writes(Subscriber &subscriber, bool enable)
+    {
+        if (subscriber.want_write == enable)
+            return;
+        subscriber.want_write = enable;
+        epoll_event event{};
+        event.events = EPOLLIN | EPOLLRDHUP | (enable ? uint32_t(EPOLLOUT) : 0u);
+        event.data.ptr = &subscriber;
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, subscriber.fd, &event);
+    }
+
+    // write as many queued frames as the socket takes, false if the subscriber is gone
+    bool Server::flush(Subscriber &subscriber)
+    {
+        std::vector<iovec> batch;
+        batch.reserve(config.max_batch);
+
+        while (!subscriber.queue.empty())
+        {
+            // header and payload of each queued frame, skipping what was sent before
+            batch.clear();
+            auto skip = subscriber.offset;
+            for (auto &queued : subscriber.queue)
+            {
+                if (int(batch.size()) + 2 > config.max_batch)
+                    break;
+                auto header = (unsigned char *) &queued.header;
+                auto header_size = sizeof(queued.header);
+                if (skip < header_size)
+                    batch.push_back(iovec{header + skip, header_size - skip});
+                auto payload_skip = skip > header_size ? skip - header_size : 0;
+                if (payload_skip < queued.frame->size())
+                    batch.push_back(iovec{(void *) (queued.frame->data() + payload_skip), queued.frame->size() - payload_skip});
+                skip = 0;
+            }
+
+            msghdr message{};
+            message.msg_iov = batch.data();
+            message.msg_iovlen = batch.size();
+            auto written = sendmsg(subscriber.fd, &message, MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (written < 0)
+            {
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                {
+                    watch_writes(subscriber, true);
+                    return true;
+                }
+                disconnect(subscriber);
+                return false;
+            }
+            current.writes++;
+            current.bytes += written;
+
+            // retire completely written frames, their buffers are freed with the last reference
+            auto remaining = size_t(written) + subscriber.offset;
+            while (!subscriber.queue.empty())
+            {
+                auto size = sizeof(FrameHeader) + subscriber.queue.front().frame->size();
+                if (remaining < size)
+                    break;
+                remaining -= size;
+                subscriber.queue.pop_front();
+                current.sent++;
+            }
+            subscriber.offset = remaining;
+        }
+        watch_writes(subscriber, false);
+        return true;
+    }
+}
@@ -0,0 +1,100 @@
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef SCZR00_STREAMSERVER_H
+#define SCZR00_STREAMSERVER_H
+
+// Publishes encoded frames to any number of local subscribers over a Unix domain stream socket.
+// Every frame is sent as a FrameHeader followed by the JPEG bytes. Subscribers share one reference
+// counted copy of each frame; a subscriber that falls behind loses its oldest queued frames instead of slowing
+// down the pipeline.
+namespace StreamServer
+{
+    auto const MAGIC = 0x47504a53u; // "SJPG" in little endian
+
+    // native byte order
+    struct FrameHeader
+    {
+        uint32_t magic;
+        int32_t task_id;
+        uint32_t length; // JPEG bytes following the header
+    };
+
+    typedef std::shared_ptr<const std::vector<unsigned char>> Frame;
+
+    struct Config
+    {
+        std::string path;         // socket path, replaced if it exists
+        size_t queue_frames = 8;  // per subscriber, the oldest frame is dropped when full
+        int max_batch = 64;       // iovecs per sendmsg(), up to max_batch / 2 frames per call
+    };
+
+    struct Stats
+    {
+        long subscribers = 0;  // currently connected
+        long accepted = 0;
+        long disconnected = 0;
+        long published = 0;
+        long sent = 0;         // frames completely written, summed over subscribers
+        long dropped = 0;      // frames dropped from full subscriber queues
+        long long bytes = 0;
+        long writes = 0;       // sendmsg() calls
+
+        std::string to_string() const;
+    };
+
+    class Server
+    {
+    public:
+        // bind, listen and start the server thread, nullptr with an error message on failure
+        static Server *start(const Config &config, std::string &error);
+        ~Server();
+
+        // queue a frame for every subscriber, never blocks on a subscriber
+        void publish(int task_id, Frame frame);
+
+        // send what is still queued (for at most a second), close all connections and remove the socket
+        void stop();
+
+        Stats stats();
+
+    private:
+        struct Queued
+        {
+            FrameHeader header;
+            Frame frame;
+        };
+
+        struct Subscriber
+        {
+            int fd;
+            std::deque<Queued> queue;
+            size_t offset = 0;     // bytes of the front frame (header included) already sent
+            bool want_write = false; // EPOLLOUT registered after the socket buffer was full
+        };
+
+        explicit Server(const Config &config) : config(config) {}
+        void run();
+        void accept_subscribers();
+        void disconnect(Subscriber &subscriber);
+        bool flush(Subscriber &subscriber);
+        void watch_writes(Subscriber &subscriber, bool enable);
+
+        Config config;
+        int listen_fd = -1;
+        int wake_fd = -1;     // eventfd, signalled by publish() and stop()
+        int epoll_fd = -1;
+        bool stopping = false;
+        std::thread thread;
+        std::mutex mutex;     // guards subscribers and current
+        std::vector<std::unique_ptr<Subscriber>> subscribers;
+        Stats current;
+    };
+}
+
+#endif //SCZR00_STREAMSERVER_H
@@ -0,0 +1,121 @@
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "streamserver.h"
+
+// Usage: sczr00_subscribe SOCKET_PATH [--save=DIR] [--delay-ms=N] [--quiet]
+// Connects to a pipeline started with --serve=SOCKET_PATH and prints every received frame.
+// --delay-ms sleeps after each frame to play a slow consumer, the server drops frames for it instead of waiting.
+
+namespace
+{
+    bool read_fully(int fd, void *buffer, size_t size)
+    {
+        auto bytes = (char *) buffer;
+        while (size > 0)
+        {
+            auto received = read(fd, bytes, size);
+            if (received < 0 && errno == EINTR)
+                continue;
+            if (received <= 0)
+                return false;
+            bytes += received;
+            size -= received;
+        }
+        return true;
+    }
+
+    bool option(const char *arg, const std::string &name, std::string &value)
+    {
+        auto prefix = "--" + name + "=";
+        if (strncmp(arg, prefix.c_str(), prefix.size()) != 0)
+            return false;
+        value = arg + prefix.size();
+        return true;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    std::string path, save_dir;
+    int delay_ms = 0;
+    auto quiet = false;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string value;
+        if (option(argv[i], "save", value))
+            save_dir = value;
+        else if (option(argv[i], "delay-ms", value))
+            delay_ms = atoi(value.c_str());
+        else if (strcmp(argv[i], "--quiet") == 0)
+            quiet = true;
+        else if (argv[i][0] != '-' && path.empty())
+            path = argv[i];
+        else
+        {
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            return 2;
+        }
+    }
+    if (path.empty())
+    {
+        fprintf(stderr, "Usage: %s SOCKET_PATH [--save=DIR] [--delay-ms=N] [--quiet]\n", argv[0]);
+        return 2;
+    }
+
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+    auto fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, (sockaddr *) &address, sizeof(address)) != 0)
+    {
+        fprintf(stderr, "cannot connect to %s: %s\n", path.c_str(), strerror(errno));
+        return 1;
+    }
+
+    long frames = 0, skipped = 0;
+    long long bytes = 0;
+    auto last_task = -1;
+    StreamServer::FrameHeader header{};
+    std::vector<unsigned char> jpeg;
+    while (read_fully(fd, &header, sizeof(header)))
+    {
+        if (header.magic != StreamServer::MAGIC)
+        {
+            fprintf(stderr, "stream out of sync\n");
+            return 1;
+        }
+        jpeg.resize(header.length);
+        if (!read_fully(fd, jpeg.data(), jpeg.size()))
+            break;
+
+        // task ids grow by one per frame, a gap means the server dropped frames for us
+        if (last_task >= 0 && header.task_id > last_task + 1)
+            skipped += header.task_id - last_task - 1;
+        last_task = header.task_id;
+        frames++;
+        bytes += header.length;
+        if (!quiet)
+            printf("frame %d: %u bytes\n", header.task_id, header.length);
+
+        if (!save_dir.empty())
+        {
+            std::ofstream file(save_dir + "/" + std::to_string(header.task_id) + ".jpg",
+                               std::ios_base::out | std::ios_base::binary);
+            file.write((const char *) jpeg.data(), jpeg.size());
+        }
+        if (delay_ms > 0)
+            usleep(delay_ms * 1000);
+    }
+    close(fd);
+
+    printf("received %ld frames, %lld bytes, %ld skipped\n", frames, bytes, skipped);
+    return 0;
+}
@@ -17,6 +17,8 @@
 
 #pragma once
 
+#include <vector>
+
 namespace TooJpeg
 {
   // write one byte (to disk, memory, ...)
@@ -25,15 +27,136 @@ namespace TooJpeg
   // if you prefer stylish C++11 syntax then it can be a lambda, too:
   // auto myOutput = [](unsigned char oneByte) { fputc(oneByte, output); };
 
+  // chroma subsampling of RGB images, Cb and Cr are box filtered (averaged) over the given area
+  enum Sampling : unsigned char
+  {
+    YCbCr444 = 0, // full resolution chroma (JPEG sampling factors 1x1)
+    YCbCr420 = 1, // 2x2 pixels per chroma sample (Y sampled 2x2), smallest files
+    YCbCr422 = 2  // 2x1 pixels per chroma sample (Y sampled 2x1), full vertical chroma resolution for interlaced video
+  };
+
   // output       - callback that stores a single byte (writes to disk, memory, ...)
   // pixels       - stored in RGB format or grayscale, stored from upper-left to lower-right
   // width,height - image size
   // is_RGB        - true if RGB format (3 bytes per pixel); false if grayscale (1 byte per pixel)
   // quality      - between 1 (worst) and 100 (best)
-  // downsample   - if true then YCbCr 4:2:0 format is used (smaller size, minor quality loss) instead of 4:4:4, not relevant for grayscale
+  // sampling     - YCbCr 4:2:0 or 4:2:2 produce smaller files (minor quality loss) than 4:4:4, not relevant for grayscale
   // comment      - optional JPEG comment (0/NULL if no comment), must not contain ASCII code 0xFF
   bool writeJpeg(WRITE_ONE_BYTE output, const void* pixels, unsigned short width, unsigned short height,
-                 bool isRGB = true, unsigned char quality = 90, bool downsample = false, const char* comment = nullptr);
+                 bool isRGB = true, unsigned char quality = 90, Sampling sampling = YCbCr444, const char* comment = nullptr);
+
+  // earlier versions took "bool downsample" instead of sampling: true = YCbCr 4:2:0, false = 4:4:4
+  [[deprecated("pass TooJpeg::YCbCr420 or TooJpeg::YCbCr444 instead of a bool")]]
+  bool writeJpeg(WRITE_ONE_BYTE output, const void* pixels, unsigned short width, unsigned short height,
+                 bool isRGB, unsigned char quality, bool downsample, const char* comment = nullptr);
+
+  // DCT coefficients of a whole image, colour conversion and DCT are done only once by analyzeJpeg()
+  // and the result can be quantized/encoded as often as needed (e.g. to hit a certain file size)
+  struct Coefficients
+  {
+    unsigned short width  = 0;
+    unsigned short height = 0;
+    bool isRGB        = true;
+    Sampling sampling = YCbCr444;
+    std::vector<float> blocks; // 64 coefficients per 8x8 block, blocks are stored in the order of a baseline JPEG
+  };
+
+  // result       - receives the DCT coefficients, memory is reused if the image size doesn't change
+  // other parameters are the same as for writeJpeg()
+  bool analyzeJpeg(Coefficients& result, const void* pixels, unsigned short width, unsigned short height,
+                   bool isRGB = true, Sampling sampling = YCbCr444);
+
+  // quantize and encode coefficients computed by analyzeJpeg(), produces the same output as writeJpeg() with the same parameters
+  bool writeJpeg(WRITE_ONE_BYTE output, const Coefficients& coefficients, unsigned char quality = 90, const char* comment = nullptr);
+
+  // one scan of a progressive JPEG, see writeProgressive()
+  struct Scan
+  {
+    unsigned char components = 1; // bit mask: 1 = Y, 2 = Cb, 4 = Cr; several components only in DC scans (interleaved)
+    unsigned char first      = 0; // spectral selection in zig-zag order: DC scans are 0..0, AC scans lie within 1..63
+    unsigned char last       = 0;
+    unsigned char high       = 0; // successive approximation: point transform of the previous scan of these coefficients (0 = none)
+    unsigned char low        = 0; // point transform: the scan sends the coefficients divided by 2^low (refinements send bit 'low')
+  };
+
+  // a valid script sends every bit of every coefficient exactly once and the DC of each component before its AC bands
+  // default scripts: DC of all components first, then AC bands, optionally refined by successive approximation
+  std::vector<Scan> progressiveScans(bool isRGB = true, bool successiveApproximation = true);
+
+  // jpegtran's scan script syntax, e.g. "0,1,2: 0-0, 0, 1; 0: 1-5, 0, 2; ..." means components (0 = Y): first-last, high, low
+  // where ", high, low" may be omitted (0, 0); returns false on syntax errors and on invalid scripts, scans is left unchanged
+  bool parseScans(const char* script, bool isRGB, std::vector<Scan>& scans);
+
+  // progressive JPEG: the quantized coefficients of the whole image are buffered (128 bytes per 8x8 block) and written
+  // scan by scan, a decoder can show a low resolution preview as soon as the first (DC) scan has arrived
+  // standard Huffman tables, each block ends its own band (no EOB runs across blocks)
+  // returns false if the scans are invalid, see parseScans(); other parameters are the same as for writeJpeg()
+  bool writeProgressive(WRITE_ONE_BYTE output, const void* pixels, unsigned short width, unsigned short height,
+                        const std::vector<Scan>& scans, bool isRGB = true, unsigned char quality = 90,
+                        Sampling sampling = YCbCr444, const char* comment = nullptr);
+
+  // one of several encodings of the same image, see writeJpegs()
+  struct Rendition
+  {
+    unsigned char quality = 90;
+    Sampling sampling     = YCbCr444; // not relevant for grayscale
+    std::vector<Scan> scans;          // empty: baseline, else a progressive JPEG with these scans
+    std::vector<unsigned char> jpeg;  // receives the JPEG file, previous content is replaced
+  };
+
+  // encode an image in several qualities (and subsampling modes) at once, e.g. an archive and a preview copy:
+  // colour conversion and DCT run only once per block for all renditions with the same sampling mode,
+  // then each rendition quantizes and Huffman-codes the block with its own tables
+  // every rendition gets the same bytes as a separate writeJpeg() (or writeProgressive()) call with its parameters
+  bool writeJpegs(std::vector<Rendition>& renditions, const void* pixels, unsigned short width, unsigned short height,
+                  bool isRGB = true, const char* comment = nullptr);
+
+  // same as above, but output can be anything callable with one byte: a lambda with captures, or an object with
+  // operator()(unsigned char) that appends to a buffer, writes to a file descriptor, hashes or counts the bytes ...
+  // the call is resolved at compile time and inlines completely, and all state lives in the sink passed to this call,
+  // so any number of encoders can run concurrently in one process without globals
+  // auto jpeg = std::vector<unsigned char>();
+  // TooJpeg::writeJpeg([&jpeg](unsigned char oneByte) { jpeg.push_back(oneByte); }, mypixels, 1024, 768);
+  template <typename Sink>
+  bool writeJpeg(Sink&& output, const void* pixels, unsigned short width, unsigned short height,
+                 bool isRGB = true, unsigned char quality = 90, Sampling sampling = YCbCr444, const char* comment = nullptr);
+  template <typename Sink>
+  bool writeJpeg(Sink&& output, const Coefficients& coefficients, unsigned char quality = 90, const char* comment = nullptr);
+  template <typename Sink>
+  bool writeProgressive(Sink&& output, const void* pixels, unsigned short width, unsigned short height,
+                        const std::vector<Scan>& scans, bool isRGB = true, unsigned char quality = 90,
+                        Sampling sampling = YCbCr444, const char* comment = nullptr);
+
+  // optional instrumentation (e.g. tracing), set per thread: called whenever colour conversion starts a new MCU row
+  // and with row = -1 after the last one, costs a single branch per row if not set
+  typedef void (*ROW_OBSERVER)(int row);
+  extern thread_local ROW_OBSERVER rowObserver;
+} // namespace TooJpeg
+
+// the templated writeJpeg() overloads are compiled for each sink type, they need the whole encoder
+#include "toojpeg_internal.h"
+
+namespace TooJpeg
+{
+  template <typename Sink>
+  bool writeJpeg(Sink&& output, const void* pixels, unsigned short width, unsigned short height,
+                 bool isRGB, unsigned char quality, Sampling sampling, const char* comment)
+  {
+    return Internal::writeImage(output, pixels, width, height, isRGB, quality, sampling, comment);
+  }
+
+  template <typename Sink>
+  bool writeJpeg(Sink&& output, const Coefficients& coefficients, unsigned char quality, const char* comment)
+  {
+    return Internal::writeCoefficients(output, coefficients, quality, comment);
+  }
+
+  template <typename Sink>
+  bool writeProgressive(Sink&& output, const void* pixels, unsigned short width, unsigned short height,
+                        const std::vector<Scan>& scans, bool isRGB, unsigned char quality, Sampling sampling, const char* comment)
+  {
+    return Internal::writeProgressiveImage(output, pixels, width, height, scans, isRGB, quality, sampling, comment);
+  }
 } // namespace TooJpeg
 
 // My main inspiration was Jon Olick's Minimalistic JPEG writer
@@ -42,10 +165,11 @@ namespace TooJpeg
 // most likely Andreas Ritter's code: https://github.com/eugeneware/jpeg-js/blob/master/lib/encoder.js
 //
 // Therefore I wrote the whole lib from scratch and tried hard to add tons of comments to my code, especially describing where all those magic numbers come from.
-// And I managed to remove the need for any external includes ...
-// yes, that's right: my library has no (!) includes at all, not even #include <stdlib.h>
+// The original library had no includes at all; this version needs <vector> for analyzeJpeg(), writeJpegs() and
+// writeProgressive(), and the encoder includes <emmintrin.h> for its SSE2 kernels on x86.
 // Depending on your callback WRITE_ONE_BYTE, the library writes either to disk, or in-memory, or wherever you wish.
-// Moreover, no dynamic memory allocations are performed, just a few bytes on the stack.
+// writeJpeg() performs no dynamic memory allocations, just a few bytes on the stack; analyzeJpeg(), writeJpegs() and
+// writeProgressive() buffer coefficients or output on the heap.
 //
 // In contrast to Jon's code, compression can be significantly improved in many use cases:
 // a) grayscale JPEG images need just a single Y channel, no need to save the superfluous Cb + Cr channels
@@ -56,7 +180,7 @@ namespace TooJpeg
 //
 // Last but not least you can optionally add a JPEG comment.
 //
-// Your C++ compiler needs to support a reasonable subset of C++11 (g++ 4.7 or Visual C++ 2013 are sufficient).
+// Your C++ compiler needs to support C++17 (g++ 7 or Visual C++ 2017 are sufficient), the encoder's tables are computed at compile time.
 // I haven't tested the code on big-endian systems or anything that smells like an apple.
 //
 // USE AT YOUR OWN RISK. Because you are a brave soul :-)
@@ -0,0 +1,1322 @@
+// //////////////////////////////////////////////////////////
+// toojpeg_internal.h
+// encoder building blocks shared by toojpeg.cpp, the templated writeJpeg() overloads and the benchmarks
+// based on toojpeg.cpp written by Stephan Brumme, 2018-2019
+//
+
+#pragma once
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace TooJpeg
+{
+namespace Internal
+{
+// ////////////////////////////////////////
+// data types
+using uint8_t  = unsigned char;
+using uint16_t = unsigned short;
+using  int16_t =          short;
+using  int32_t =          int; // at least four bytes
+using uint32_t = unsigned int;
+using uint64_t = unsigned long long; // at least eight bytes
+
+// ////////////////////////////////////////
+// constants
+
+// quantization tables from JPEG Standard, Annex K
+inline constexpr uint8_t DefaultQuantLuminance[8*8] =
+    { 16, 11, 10, 16, 24, 40, 51, 61, // there are a few experts proposing slightly more efficient values,
+      12, 12, 14, 19, 26, 58, 60, 55, // e.g. https://www.imagemagick.org/discourse-server/viewtopic.php?t=20333
+      14, 13, 16, 24, 40, 57, 69, 56, // btw: Google's Guetzli project optimizes the quantization tables per image
+      14, 17, 22, 29, 51, 87, 80, 62,
+      18, 22, 37, 56, 68,109,103, 77,
+      24, 35, 55, 64, 81,104,113, 92,
+      49, 64, 78, 87,103,121,120,101,
+      72, 92, 95, 98,112,100,103, 99 };
+inline constexpr uint8_t DefaultQuantChrominance[8*8] =
+    { 17, 18, 24, 47, 99, 99, 99, 99,
+      18, 21, 26, 66, 99, 99, 99, 99,
+      24, 26, 56, 99, 99, 99, 99, 99,
+      47, 66, 99, 99, 99, 99, 99, 99,
+      99, 99, 99, 99, 99, 99, 99, 99,
+      99, 99, 99, 99, 99, 99, 99, 99,
+      99, 99, 99, 99, 99, 99, 99, 99,
+      99, 99, 99, 99, 99, 99, 99, 99 };
+
+// 8x8 blocks are processed in zig-zag order
+// most encoders use a zig-zag "forward" table, I switched to its inverse for performance reasons
+// note: ZigZagInv[ZigZag[i]] = i
+inline constexpr uint8_t ZigZagInv[8*8] =
+    {  0, 1, 8,16, 9, 2, 3,10,   // ZigZag[] =  0, 1, 5, 6,14,15,27,28,
+      17,24,32,25,18,11, 4, 5,   //             2, 4, 7,13,16,26,29,42,
+      12,19,26,33,40,48,41,34,   //             3, 8,12,17,25,30,41,43,
+      27,20,13, 6, 7,14,21,28,   //             9,11,18,24,31,40,44,53,
+      35,42,49,56,57,50,43,36,   //            10,19,23,32,39,45,52,54,
+      29,22,15,23,30,37,44,51,   //            20,22,33,38,46,51,55,60,
+      58,59,52,45,38,31,39,46,   //            21,34,37,47,50,56,59,61,
+      53,60,61,54,47,55,62,63 }; //            35,36,48,49,57,58,62,63
+
+// static Huffman code tables from JPEG standard Annex K
+// - CodesPerBitsize tables define how many Huffman codes will have a certain bitsize (plus 1 because there nothing with zero bits),
+//   e.g. DcLuminanceCodesPerBitsize[2] = 5 because there are 5 Huffman codes being 2+1=3 bits long
+// - Values tables are a list of values ordered by their Huffman code bitsize,
+//   e.g. AcLuminanceValues => Huffman(0x01,0x02 and 0x03) will have 2 bits, Huffman(0x00) will have 3 bits, Huffman(0x04,0x11 and 0x05) will have 4 bits, ...
+
+// Huffman definitions for first DC/AC tables (luminance / Y channel)
+inline constexpr uint8_t DcLuminanceCodesPerBitsize[16]   = { 0,1,5,1,1,1,1,1,1,0,0,0,0,0,0,0 };   // sum = 12
+inline constexpr uint8_t DcLuminanceValues         [12]   = { 0,1,2,3,4,5,6,7,8,9,10,11 };         // => 12 codes
+inline constexpr uint8_t AcLuminanceCodesPerBitsize[16]   = { 0,2,1,3,3,2,4,3,5,5,4,4,0,0,1,125 }; // sum = 162
+inline constexpr uint8_t AcLuminanceValues        [162]   =                                        // => 162 codes
+    { 0x01,0x02,0x03,0x00,0x04,0x11,0x05,0x12,0x21,0x31,0x41,0x06,0x13,0x51,0x61,0x07,0x22,0x71,0x14,0x32,0x81,0x91,0xA1,0x08, // 16*10+2 symbols because
+      0x23,0x42,0xB1,0xC1,0x15,0x52,0xD1,0xF0,0x24,0x33,0x62,0x72,0x82,0x09,0x0A,0x16,0x17,0x18,0x19,0x1A,0x25,0x26,0x27,0x28, // upper 4 bits can be 0..F
+      0x29,0x2A,0x34,0x35,0x36,0x37,0x38,0x39,0x3A,0x43,0x44,0x45,0x46,0x47,0x48,0x49,0x4A,0x53,0x54,0x55,0x56,0x57,0x58,0x59, // while lower 4 bits can be 1..A
+      0x5A,0x63,0x64,0x65,0x66,0x67,0x68,0x69,0x6A,0x73,0x74,0x75,0x76,0x77,0x78,0x79,0x7A,0x83,0x84,0x85,0x86,0x87,0x88,0x89, // plus two special codes 0x00 and 0xF0
+      0x8A,0x92,0x93,0x94,0x95,0x96,0x97,0x98,0x99,0x9A,0xA2,0xA3,0xA4,0xA5,0xA6,0xA7,0xA8,0xA9,0xAA,0xB2,0xB3,0xB4,0xB5,0xB6, // order of these symbols was determined empirically by JPEG committee
+      0xB7,0xB8,0xB9,0xBA,0xC2,0xC3,0xC4,0xC5,0xC6,0xC7,0xC8,0xC9,0xCA,0xD2,0xD3,0xD4,0xD5,0xD6,0xD7,0xD8,0xD9,0xDA,0xE1,0xE2,
+      0xE3,0xE4,0xE5,0xE6,0xE7,0xE8,0xE9,0xEA,0xF1,0xF2,0xF3,0xF4,0xF5,0xF6,0xF7,0xF8,0xF9,0xFA };
+// Huffman definitions for second DC/AC tables (chrominance / Cb and Cr channels)
+inline constexpr uint8_t DcChrominanceCodesPerBitsize[16] = { 0,3,1,1,1,1,1,1,1,1,1,0,0,0,0,0 };   // sum = 12
+inline constexpr uint8_t DcChrominanceValues         [12] = { 0,1,2,3,4,5,6,7,8,9,10,11 };         // => 12 codes (identical to DcLuminanceValues)
+inline constexpr uint8_t AcChrominanceCodesPerBitsize[16] = { 0,2,1,2,4,4,3,4,7,5,4,4,0,1,2,119 }; // sum = 162
+inline constexpr uint8_t AcChrominanceValues        [162] =                                        // => 162 codes
+    { 0x00,0x01,0x02,0x03,0x11,0x04,0x05,0x21,0x31,0x06,0x12,0x41,0x51,0x07,0x61,0x71,0x13,0x22,0x32,0x81,0x08,0x14,0x42,0x91, // same number of symbol, just different order
+      0xA1,0xB1,0xC1,0x09,0x23,0x33,0x52,0xF0,0x15,0x62,0x72,0xD1,0x0A,0x16,0x24,0x34,0xE1,0x25,0xF1,0x17,0x18,0x19,0x1A,0x26, // (which is more efficient for AC coding)
+      0x27,0x28,0x29,0x2A,0x35,0x36,0x37,0x38,0x39,0x3A,0x43,0x44,0x45,0x46,0x47,0x48,0x49,0x4A,0x53,0x54,0x55,0x56,0x57,0x58,
+      0x59,0x5A,0x63,0x64,0x65,0x66,0x67,0x68,0x69,0x6A,0x73,0x74,0x75,0x76,0x77,0x78,0x79,0x7A,0x82,0x83,0x84,0x85,0x86,0x87,
+      0x88,0x89,0x8A,0x92,0x93,0x94,0x95,0x96,0x97,0x98,0x99,0x9A,0xA2,0xA3,0xA4,0xA5,0xA6,0xA7,0xA8,0xA9,0xAA,0xB2,0xB3,0xB4,
+      0xB5,0xB6,0xB7,0xB8,0xB9,0xBA,0xC2,0xC3,0xC4,0xC5,0xC6,0xC7,0xC8,0xC9,0xCA,0xD2,0xD3,0xD4,0xD5,0xD6,0xD7,0xD8,0xD9,0xDA,
+      0xE2,0xE3,0xE4,0xE5,0xE6,0xE7,0xE8,0xE9,0xEA,0xF2,0xF3,0xF4,0xF5,0xF6,0xF7,0xF8,0xF9,0xFA };
+inline constexpr int16_t CodeWordLimit = 2048; // +/-2^11, maximum value after DCT
+
+// ////////////////////////////////////////
+// structs
+
+// represent a single Huffman code
+struct BitCode
+{
+  constexpr BitCode() : code(0), numBits(0) {} // unused Huffman codes and codewords stay zero
+  constexpr BitCode(uint16_t code_, uint8_t numBits_)
+  : code(code_), numBits(numBits_) {}
+  uint16_t code;       // JPEG's Huffman codes are limited to 16 bits
+  uint8_t  numBits;    // number of valid bits
+};
+
+// wrapper for bit output operations
+// Output is anything that can be called like a WRITE_ONE_BYTE callback
+template <typename Output>
+struct BitWriter
+{
+  // user-supplied callback that writes/stores one byte
+  Output output;
+  // initialize writer
+  explicit BitWriter(Output output_) : output(output_) {}
+
+  // store the most recently encoded bits that are not written yet
+  // a 64 bit accumulator is only drained when 32 bits are complete, therefore at most 31 bits are left over
+  // and a single write of up to 32 bits never overflows it
+  struct BitBuffer
+  {
+    uint64_t data    = 0; // at most 63 bits are used, the high bits may contain garbage
+    uint8_t  numBits = 0; // number of valid bits (the right-most bits)
+  } buffer;
+
+  // append up to 32 bits, code must not contain any set bits above numBits
+  void write(uint32_t code, uint8_t numBits)
+  {
+    buffer.numBits += numBits;
+    buffer.data   <<= numBits;
+    buffer.data    |= code;
+
+    // write a full 32 bit word
+    if (buffer.numBits >= 32)
+    {
+      buffer.numBits -= 32;
+      writeWord(uint32_t(buffer.data >> buffer.numBits));
+    }
+  }
+
+  // write Huffman bits stored in BitCode, keep excess bits in BitBuffer
+  BitWriter& operator<<(const BitCode& data)
+  {
+    write(data.code, data.numBits);
+    return *this;
+  }
+
+  // write a Huffman code immediately followed by the bits of its value with a single shift/or
+  // (Huffman codes have at most 16 bits and values at most 11 bits, so 27 bits in total)
+  void write(const BitCode& huffman, const BitCode& value)
+  {
+    write((uint32_t(huffman.code) << value.numBits) | value.code, huffman.numBits + value.numBits);
+  }
+
+  // emit four bytes, big-endian
+  void writeWord(uint32_t word)
+  {
+    // 0xFF has a special meaning for JPEGs (it's a block marker) and must be followed by a zero byte
+    // ~word has a zero byte if and only if word contains 0xFF (classic "haszero" bit trick)
+    auto inverted = ~word;
+    if (((inverted - 0x01010101u) & ~inverted & 0x80808080u) == 0)
+    {
+      // fast path: no byte stuffing required
+      output(uint8_t(word >> 24));
+      output(uint8_t(word >> 16));
+      output(uint8_t(word >>  8));
+      output(uint8_t(word      ));
+      return;
+    }
+
+    for (auto shift = 24; shift >= 0; shift -= 8)
+    {
+      auto oneByte = uint8_t(word >> shift);
+      output(oneByte);
+      if (oneByte == 0xFF) // pad a zero to indicate "nope, this one ain't a marker, it's just a coincidence"
+        output(0);
+    }
+  }
+
+  // write all non-yet-written bits, fill gaps with 1s (that's a strange JPEG thing)
+  void flush()
+  {
+    // at most seven set bits needed to "fill" the last byte: 0x7F = binary 0111 1111
+    write(0x7F, 7);
+
+    // write all remaining "full" bytes, the incomplete one consists of padding bits only
+    while (buffer.numBits >= 8)
+    {
+      buffer.numBits -= 8;
+      auto oneByte = uint8_t(buffer.data >> buffer.numBits);
+      output(oneByte);
+      if (oneByte == 0xFF)
+        output(0);
+    }
+    buffer.numBits = 0;
+  }
+
+  // NOTE: all the following BitWriter functions IGNORE the BitBuffer and write straight to output !
+  // write a single byte
+  BitWriter& operator<<(uint8_t oneByte)
+  {
+    output(oneByte);
+    return *this;
+  }
+
+  // write an array of bytes
+  template <typename T, int Size>
+  BitWriter& operator<<(T (&manyBytes)[Size])
+  {
+    for (auto c : manyBytes)
+      output(c);
+    return *this;
+  }
+
+  // start a new JFIF block
+  void addMarker(uint8_t id, uint16_t length)
+  {
+    output(0xFF); output(id);     // ID, always preceded by 0xFF
+    output(uint8_t(length >> 8)); // length of the block (big-endian, includes the 2 length bytes as well)
+    output(uint8_t(length & 0xFF));
+  }
+};
+
+// ////////////////////////////////////////
+// functions / templates
+
+// same as std::min()
+template <typename Number>
+constexpr Number minimum(Number value, Number maximum)
+{
+  return value <= maximum ? value : maximum;
+}
+
+// restrict a value to the interval [minimum, maximum]
+template <typename Number, typename Limit>
+constexpr Number clamp(Number value, Limit minValue, Limit maxValue)
+{
+  if (value <= minValue) return minValue; // never smaller than the minimum
+  if (value >= maxValue) return maxValue; // never bigger  than the maximum
+  return value;                           // value was inside interval, keep it
+}
+
+// convert from RGB to YCbCr, constants are similar to ITU-R, see https://en.wikipedia.org/wiki/YCbCr#JPEG_conversion
+inline float rgb2y (float r, float g, float b) { return +0.299f   * r +0.587f   * g +0.114f   * b; }
+inline float rgb2cb(float r, float g, float b) { return -0.16874f * r -0.33126f * g +0.5f     * b; }
+inline float rgb2cr(float r, float g, float b) { return +0.5f     * r -0.41869f * g -0.08131f * b; }
+
+// horizontal and vertical number of luminance samples per chroma sample
+inline int samplingX(Sampling sampling) { return sampling == YCbCr444 ? 1 : 2; }
+inline int samplingY(Sampling sampling) { return sampling == YCbCr420 ? 2 : 1; }
+
+// forward DCT computation "in one dimension" (fast AAN algorithm by Arai, Agui and Nakajima: "A fast DCT-SQ scheme for images")
+inline void DCT(float block[8*8], uint8_t stride) // stride must be 1 (=horizontal) or 8 (=vertical)
+{
+  const auto SqrtHalfSqrt = 1.306562965f; //    sqrt((2 + sqrt(2)) / 2) = cos(pi * 1 / 8) * sqrt(2)
+  const auto InvSqrt      = 0.707106781f; // 1 / sqrt(2)                = cos(pi * 2 / 8)
+  const auto HalfSqrtSqrt = 0.382683432f; //     sqrt(2 - sqrt(2)) / 2  = cos(pi * 3 / 8)
+  const auto InvSqrtSqrt  = 0.541196100f; // 1 / sqrt(2 - sqrt(2))      = cos(pi * 3 / 8) * sqrt(2)
+
+  // modify in-place
+  auto& block0 = block[0         ];
+  auto& block1 = block[1 * stride];
+  auto& block2 = block[2 * stride];
+  auto& block3 = block[3 * stride];
+  auto& block4 = block[4 * stride];
+  auto& block5 = block[5 * stride];
+  auto& block6 = block[6 * stride];
+  auto& block7 = block[7 * stride];
+
+  // based on https://dev.w3.org/Amaya/libjpeg/jfdctflt.c , the original variable names can be found in my comments
+  auto add07 = block0 + block7; auto sub07 = block0 - block7; // tmp0, tmp7
+  auto add16 = block1 + block6; auto sub16 = block1 - block6; // tmp1, tmp6
+  auto add25 = block2 + block5; auto sub25 = block2 - block5; // tmp2, tmp5
+  auto add34 = block3 + block4; auto sub34 = block3 - block4; // tmp3, tmp4
+
+  auto add0347 = add07 + add34; auto sub07_34 = add07 - add34; // tmp10, tmp13 ("even part" / "phase 2")
+  auto add1256 = add16 + add25; auto sub16_25 = add16 - add25; // tmp11, tmp12
+
+  block0 = add0347 + add1256; block4 = add0347 - add1256; // "phase 3"
+
+  auto z1 = (sub16_25 + sub07_34) * InvSqrt; // all temporary z-variables kept their original names
+  block2 = sub07_34 + z1; block6 = sub07_34 - z1; // "phase 5"
+
+  auto sub23_45 = sub25 + sub34; // tmp10 ("odd part" / "phase 2")
+  auto sub12_56 = sub16 + sub25; // tmp11
+  auto sub01_67 = sub16 + sub07; // tmp12
+
+  auto z5 = (sub23_45 - sub01_67) * HalfSqrtSqrt;
+  auto z2 = sub23_45 * InvSqrtSqrt  + z5;
+  auto z3 = sub12_56 * InvSqrt;
+  auto z4 = sub01_67 * SqrtHalfSqrt + z5;
+  auto z6 = sub07 + z3; // z11 ("phase 5")
+  auto z7 = sub07 - z3; // z13
+  block1 = z6 + z4; block7 = z6 - z4; // "phase 6"
+  block5 = z7 + z2; block3 = z7 - z2;
+}
+
+// forward DCT of an 8x8 block (in-place), the result is still scaled by the AAN factors
+inline void transformBlock(float block64[8*8])
+{
+  // DCT: rows
+  for (auto offset = 0; offset < 8; offset++)
+    DCT(block64 + offset*8, 1);
+  // DCT: columns
+  for (auto offset = 0; offset < 8; offset++)
+    DCT(block64 + offset*1, 8);
+}
+
+// scale and quantize DCT coefficients, the result is in zig-zag order (quantized[0] is DC)
+// returns offset of the last non-zero AC coefficient (0 if there is none)
+inline int quantizeBlock(const float block64[8*8], const float scaled[8*8], int16_t quantized[8*8])
+{
+  // encode DC (the first coefficient is the "average color" of the 8x8 block)
+  auto dc = block64[0] * scaled[0];
+  quantized[0] = int(dc + (dc >= 0 ? +0.5f : -0.5f)); // C++11's nearbyint() achieves a similar effect
+
+  // quantize and zigzag the other 63 coefficients
+  auto posNonZero = 0; // find last coefficient which is not zero (because trailing zeros are encoded differently)
+  for (auto i = 1; i < 8*8; i++) // start at 1 because block64[0]=DC was already processed
+  {
+    auto value = block64[ZigZagInv[i]] * scaled[ZigZagInv[i]];
+    // round to nearest integer
+    quantized[i] = int(value + (value >= 0 ? +0.5f : -0.5f)); // C++11's nearbyint() achieves a similar effect
+    // remember offset of last non-zero coefficient
+    if (quantized[i] != 0)
+      posNonZero = i;
+  }
+  return posNonZero;
+}
+
+// write Huffman bit codes of a quantized block, returns its DC value
+template <typename Writer>
+int16_t encodeQuantized(Writer& writer, const int16_t quantized[8*8], int posNonZero, int16_t lastDC,
+                        const BitCode huffmanDC[256], const BitCode huffmanAC[256], const BitCode* codewords)
+{
+  auto DC = quantized[0];
+
+  // same "average color" as previous block ?
+  auto diff = DC - lastDC;
+  if (diff == 0)
+    writer << huffmanDC[0x00];   // yes, write a special short symbol
+  else
+  {
+    auto bits = codewords[diff]; // nope, encode the difference to previous block's average color
+    writer.write(huffmanDC[bits.numBits], bits);
+  }
+
+  // encode ACs (quantized[1..63])
+  auto offset = 0; // upper 4 bits count the number of consecutive zeros
+  for (auto i = 1; i <= posNonZero; i++) // quantized[0] was already written, skip all trailing zeros, too
+  {
+    // zeros are encoded in a special way
+    while (quantized[i] == 0) // found another zero ?
+    {
+      offset    += 0x10; // add 1 to the upper 4 bits
+      // split into blocks of at most 16 consecutive zeros
+      if (offset > 0xF0) // remember, the counter is in the upper 4 bits, 0xF = 15
+      {
+        writer << huffmanAC[0xF0]; // 0xF0 is a special code for "16 zeros"
+        offset = 0;
+      }
+      i++;
+    }
+
+    auto encoded = codewords[quantized[i]];
+    // combine number of zeros with the number of bits of the next non-zero value
+    writer.write(huffmanAC[offset + encoded.numBits], encoded); // and the value itself, fused into a single write
+    offset = 0;
+  }
+
+  // send end-of-block code (0x00), only needed if there are trailing zeros
+  if (posNonZero < 8*8 - 1) // = 63
+    writer << huffmanAC[0x00];
+
+  return DC;
+}
+
+// quantize already transformed coefficients and write Huffman bit codes
+template <typename Writer>
+int16_t encodeCoefficients(Writer& writer, const float block64[8*8], const float scaled[8*8], int16_t lastDC,
+                           const BitCode huffmanDC[256], const BitCode huffmanAC[256], const BitCode* codewords)
+{
+  int16_t quantized[8*8];
+  auto posNonZero = quantizeBlock(block64, scaled, quantized);
+  return encodeQuantized(writer, quantized, posNonZero, lastDC, huffmanDC, huffmanAC, codewords);
+}
+
+// run DCT, quantize and write Huffman bit codes
+template <typename Writer>
+int16_t encodeBlock(Writer& writer, float block[8][8], const float scaled[8*8], int16_t lastDC,
+                    const BitCode huffmanDC[256], const BitCode huffmanAC[256], const BitCode* codewords)
+{
+  // "linearize" the 8x8 block, treat it as a flat array of 64 floats
+  auto block64 = (float*) block;
+  transformBlock(block64);
+  return encodeCoefficients(writer, block64, scaled, lastDC, huffmanDC, huffmanAC, codewords);
+}
+
+// Jon's code includes the pre-generated Huffman codes
+// I don't like these "magic constants" and compute them on my own :-)
+// (at compile time for the default tables, see HuffmanLuminanceDC etc. below)
+constexpr void generateHuffmanTable(const uint8_t numCodes[16], const uint8_t* values, BitCode result[256])
+{
+  // process all bitsizes 1 thru 16, no JPEG Huffman code is allowed to exceed 16 bits
+  auto huffmanCode = 0;
+  for (auto numBits = 1; numBits <= 16; numBits++)
+  {
+    // ... and each code of these bitsizes
+    for (auto i = 0; i < numCodes[numBits - 1]; i++) // note: numCodes array starts at zero, but smallest bitsize is 1
+      result[*values++] = BitCode(huffmanCode++, numBits);
+
+    // next Huffman code needs to be one bit wider
+    huffmanCode <<= 1;
+  }
+}
+// adjust quantization tables to desired quality, results are stored in zig-zag order
+constexpr void generateQuantTables(uint8_t quality_, uint8_t quantLuminance[8*8], uint8_t quantChrominance[8*8])
+{
+  // quality level must be in 1 ... 100
+  auto quality = clamp<uint16_t>(quality_, 1, 100);
+  // convert to an internal JPEG quality factor, formula taken from libjpeg
+  quality = quality < 50 ? 5000 / quality : 200 - quality * 2;
+
+  for (auto i = 0; i < 8*8; i++)
+  {
+    int luminance   = (DefaultQuantLuminance  [ZigZagInv[i]] * quality + 50) / 100;
+    int chrominance = (DefaultQuantChrominance[ZigZagInv[i]] * quality + 50) / 100;
+
+    // clamp to 1..255
+    quantLuminance  [i] = clamp(luminance,   1, 255);
+    quantChrominance[i] = clamp(chrominance, 1, 255);
+  }
+}
+
+// scaling constants for AAN DCT algorithm: AanScaleFactors[0] = 1, AanScaleFactors[k=1..7] = cos(k*PI/16) * sqrt(2)
+inline constexpr float AanScaleFactors[8] = { 1, 1.387039845f, 1.306562965f, 1.175875602f, 1, 0.785694958f, 0.541196100f, 0.275899379f };
+
+// adjust a quantization table with AAN scaling factors to simplify DCT
+constexpr void scaleQuantTable(const uint8_t quant[8*8], float scaled[8*8])
+{
+  for (auto i = 0; i < 8*8; i++)
+  {
+    auto row    = ZigZagInv[i] / 8; // same as ZigZagInv[i] >> 3
+    auto column = ZigZagInv[i] % 8; // same as ZigZagInv[i] &  7
+
+    auto factor = 1 / (AanScaleFactors[row] * AanScaleFactors[column] * 8);
+    scaled[ZigZagInv[i]] = factor / quant[i];
+    // if you really want JPEGs that are bitwise identical to Jon Olick's code then you need slightly different formulas (note: sqrt(8) = 2.828427125f)
+    //static const float aasf[] = { 1.0f * 2.828427125f, 1.387039845f * 2.828427125f, 1.306562965f * 2.828427125f, 1.175875602f * 2.828427125f, 1.0f * 2.828427125f, 0.785694958f * 2.828427125f, 0.541196100f * 2.828427125f, 0.275899379f * 2.828427125f }; // line 240 of jo_jpeg.cpp
+    //scaled[ZigZagInv[i]] = 1 / (quant[i] * aasf[row] * aasf[column]); // lines 266-267 of jo_jpeg.cpp
+  }
+}
+
+// precompute JPEG codewords for quantized DCT
+// returns a pointer to the center of codewordsArray, so quantized[i] is found at result[quantized[i]]
+constexpr BitCode* generateCodewords(BitCode codewordsArray[2 * CodeWordLimit])
+{
+  BitCode* codewords = &codewordsArray[CodeWordLimit]; // allow negative indices
+  uint8_t numBits = 1; // each codeword has at least one bit (value == 0 is undefined)
+  int32_t mask    = 1; // mask is always 2^numBits - 1, initial value 2^1-1 = 2-1 = 1
+  for (int16_t value = 1; value < CodeWordLimit; value++)
+  {
+    // numBits = position of highest set bit (ignoring the sign)
+    // mask    = (2^numBits) - 1
+    if (value > mask) // one more bit ?
+    {
+      numBits++;
+      mask = (mask << 1) | 1; // append a set bit
+    }
+    codewords[-value] = BitCode(mask - value, numBits); // note that I use a negative index => codewords[-value] = codewordsArray[CodeWordLimit  value]
+    codewords[+value] = BitCode(       value, numBits);
+  }
+  return codewords;
+}
+
+// ////////////////////////////////////////
+// compile-time tables
+// none of these depend on the image, so they are computed by the compiler and live in read-only memory:
+// every encoder call (and every thread) shares the same copy instead of rebuilding ~20 KB on its stack
+
+// Huffman codes of the four default tables, indexed by the value to encode
+struct HuffmanCodes
+{
+  BitCode codes[256];
+};
+
+constexpr HuffmanCodes makeHuffmanCodes(const uint8_t numCodes[16], const uint8_t* values)
+{
+  HuffmanCodes result;
+  generateHuffmanTable(numCodes, values, result.codes);
+  return result;
+}
+
+inline constexpr HuffmanCodes HuffmanLuminanceDC   = makeHuffmanCodes(DcLuminanceCodesPerBitsize,   DcLuminanceValues);
+inline constexpr HuffmanCodes HuffmanLuminanceAC   = makeHuffmanCodes(AcLuminanceCodesPerBitsize,   AcLuminanceValues);
+inline constexpr HuffmanCodes HuffmanChrominanceDC = makeHuffmanCodes(DcChrominanceCodesPerBitsize, DcChrominanceValues);
+inline constexpr HuffmanCodes HuffmanChrominanceAC = makeHuffmanCodes(AcChrominanceCodesPerBitsize, AcChrominanceValues);
+
+// codewords of all quantized values, quantized[i] is found at codes[quantized[i] + CodeWordLimit]
+struct CodewordTable
+{
+  BitCode codes[2 * CodeWordLimit];
+};
+
+constexpr CodewordTable makeCodewords()
+{
+  CodewordTable result;
+  generateCodewords(result.codes);
+  return result;
+}
+
+inline constexpr CodewordTable CodewordsArray = makeCodewords();
+// allow negative indices, so quantized[i] is at Codewords[quantized[i]]
+inline constexpr const BitCode* Codewords = CodewordsArray.codes + CodeWordLimit;
+
+// quantization tables of a single quality level
+struct QuantPreset
+{
+  uint8_t quantLuminance  [8*8]; // zig-zag order, as written to the JPEG file
+  uint8_t quantChrominance[8*8];
+  float   scaledLuminance  [8*8]; // quantization tables adjusted with AAN scaling factors
+  float   scaledChrominance[8*8];
+};
+
+// every quality level 1..100 (about 64 KB), so no quality needs a runtime fallback
+struct QuantPresets
+{
+  QuantPreset quality[100];
+};
+
+constexpr QuantPresets makeQuantPresets()
+{
+  QuantPresets result = {};
+  for (auto quality = 1; quality <= 100; quality++)
+  {
+    auto& preset = result.quality[quality - 1];
+    generateQuantTables(uint8_t(quality), preset.quantLuminance, preset.quantChrominance);
+    scaleQuantTable(preset.quantLuminance,   preset.scaledLuminance);
+    scaleQuantTable(preset.quantChrominance, preset.scaledChrominance);
+  }
+  return result;
+}
+
+inline constexpr QuantPresets QuantTables = makeQuantPresets();
+
+// ////////////////////////////////////////
+// encoder setup
+
+// quantization, Huffman and codeword tables for a certain quality
+// only refers to the compile-time tables above, so it is cheap to create and to copy
+struct EncoderTables
+{
+  const uint8_t (&quantLuminance)  [8*8]; // zig-zag order, as written to the JPEG file
+  const uint8_t (&quantChrominance)[8*8];
+  const float   (&scaledLuminance)  [8*8]; // quantization tables adjusted with AAN scaling factors
+  const float   (&scaledChrominance)[8*8];
+  const BitCode (&huffmanLuminanceDC)  [256];
+  const BitCode (&huffmanLuminanceAC)  [256];
+  const BitCode (&huffmanChrominanceDC)[256];
+  const BitCode (&huffmanChrominanceAC)[256];
+  const BitCode* codewords; // allow negative indices, so quantized[i] is at codewords[quantized[i]]
+
+  // quality level must be in 1 ... 100, same clamping as generateQuantTables()
+  explicit EncoderTables(uint8_t quality)
+  : EncoderTables(QuantTables.quality[clamp<uint8_t>(quality, 1, 100) - 1]) {}
+
+private:
+  explicit EncoderTables(const QuantPreset& preset)
+  : quantLuminance  (preset.quantLuminance),  quantChrominance (preset.quantChrominance),
+    scaledLuminance (preset.scaledLuminance), scaledChrominance(preset.scaledChrominance),
+    huffmanLuminanceDC  (HuffmanLuminanceDC.codes),   huffmanLuminanceAC  (HuffmanLuminanceAC.codes),
+    huffmanChrominanceDC(HuffmanChrominanceDC.codes), huffmanChrominanceAC(HuffmanChrominanceAC.codes),
+    codewords(Codewords) {}
+};
+
+// write all JFIF headers up to and including the Huffman tables, the frame is baseline (SOF0) or progressive (SOF2)
+template <typename Output>
+void writeFrameHeaders(BitWriter<Output>& bitWriter, uint16_t width, uint16_t height, bool isRGB, Sampling sampling,
+                       const EncoderTables& tables, const char* comment, bool progressive)
+{
+  // number of components
+  const auto numComponents = isRGB ? 3 : 1;
+
+  // ////////////////////////////////////////
+  // JFIF headers
+  const uint8_t HeaderJfif[2+2+16] =
+      { 0xFF,0xD8,         // SOI marker (start of image)
+        0xFF,0xE0,         // JFIF APP0 tag
+        0,16,              // length: 16 bytes (14 bytes payload + 2 bytes for this length field)
+        'J','F','I','F',0, // JFIF identifier, zero-terminated
+        1,1,               // JFIF version 1.1
+        0,                 // no density units specified
+        0,1,0,1,           // density: 1 pixel "per pixel" horizontally and vertically
+        0,0 };             // no thumbnail (size 0 x 0)
+  bitWriter << HeaderJfif;
+
+  // ////////////////////////////////////////
+  // comment (optional)
+  if (comment != nullptr)
+  {
+    // look for zero terminator
+    auto length = 0; // = strlen(comment);
+    while (comment[length] != 0)
+      length++;
+
+    // write COM marker
+    bitWriter.addMarker(0xFE, 2+length); // block size is number of bytes (without zero terminator) + 2 bytes for this length field
+    // ... and write the comment itself
+    for (auto i = 0; i < length; i++)
+      bitWriter << comment[i];
+  }
+
+  // write quantization tables
+  bitWriter.addMarker(0xDB, 2 + (isRGB ? 2 : 1) * (1 + 8*8)); // length: 65 bytes per table + 2 bytes for this length field
+                                                              // each table has 64 entries and is preceded by an ID byte
+
+  bitWriter   << 0x00 << tables.quantLuminance;   // first  quantization table
+  if (isRGB)
+    bitWriter << 0x01 << tables.quantChrominance; // second quantization table, only relevant for color images
+
+  // ////////////////////////////////////////
+  // write image infos (SOF0 - start of frame, SOF2 for progressive JPEGs)
+  bitWriter.addMarker(progressive ? 0xC2 : 0xC0, 2+6+3*numComponents); // length: 6 bytes general info + 3 per channel + 2 bytes for this length field
+
+  // 8 bits per channel
+  bitWriter << 0x08
+  // image dimensions (big-endian)
+            << (height >> 8) << (height & 0xFF)
+            << (width  >> 8) << (width  & 0xFF);
+
+  // sampling and quantization tables for each component
+  bitWriter << numComponents;       // 1 component (grayscale, Y only) or 3 components (Y,Cb,Cr)
+  for (auto id = 1; id <= numComponents; id++)
+    bitWriter <<  id                // component ID (Y=1, Cb=2, Cr=3)
+    // bitmasks for sampling: highest 4 bits: horizontal, lowest 4 bits: vertical
+              << (id == 1 ? (samplingX(sampling) << 4) | samplingY(sampling) : 0x11) // 0x11 is default YCbCr 4:4:4,
+                                                                                  // 0x21 is YCbCr 4:2:2, 0x22 is YCbCr 4:2:0
+              << (id == 1 ? 0 : 1); // use quantization table 0 for Y, table 1 for Cb and Cr
+
+  // ////////////////////////////////////////
+  // Huffman tables
+  // DHT marker - define Huffman tables
+  bitWriter.addMarker(0xC4, isRGB ? (2+208+208) : (2+208));
+                            // 2 bytes for the length field, store chrominance only if needed
+                            //   1+16+12  for the DC luminance
+                            //   1+16+162 for the AC luminance   (208 = 1+16+12 + 1+16+162)
+                            //   1+16+12  for the DC chrominance
+                            //   1+16+162 for the AC chrominance (208 = 1+16+12 + 1+16+162, same as above)
+
+  // store luminance's DC+AC Huffman table definitions
+  bitWriter << 0x00 // highest 4 bits: 0 => DC, lowest 4 bits: 0 => Y (baseline)
+            << DcLuminanceCodesPerBitsize
+            << DcLuminanceValues;
+  bitWriter << 0x10 // highest 4 bits: 1 => AC, lowest 4 bits: 0 => Y (baseline)
+            << AcLuminanceCodesPerBitsize
+            << AcLuminanceValues;
+
+  // chrominance is only relevant for color images
+  if (isRGB)
+  {
+    // store luminance's DC+AC Huffman table definitions
+    bitWriter << 0x01 // highest 4 bits: 0 => DC, lowest 4 bits: 1 => Cr,Cb (baseline)
+              << DcChrominanceCodesPerBitsize
+              << DcChrominanceValues;
+    bitWriter << 0x11 // highest 4 bits: 1 => AC, lowest 4 bits: 1 => Cr,Cb (baseline)
+              << AcChrominanceCodesPerBitsize
+              << AcChrominanceValues;
+  }
+}
+
+// write all JFIF headers up to and including the start of the (single) baseline scan
+template <typename Output>
+void writeHeaders(BitWriter<Output>& bitWriter, uint16_t width, uint16_t height, bool isRGB, Sampling sampling,
+                  const EncoderTables& tables, const char* comment)
+{
+  writeFrameHeaders(bitWriter, width, height, isRGB, sampling, tables, comment, false);
+
+  // number of components
+  const auto numComponents = isRGB ? 3 : 1;
+
+  // ////////////////////////////////////////
+  // start of scan (there is only a single scan for baseline JPEGs)
+  bitWriter.addMarker(0xDA, 2+1+2*numComponents+3); // 2 bytes for the length field, 1 byte for number of components,
+                                                    // then 2 bytes for each component and 3 bytes for spectral selection
+
+  // assign Huffman tables to each component
+  bitWriter << numComponents;
+  for (auto id = 1; id <= numComponents; id++)
+    // highest 4 bits: DC Huffman table, lowest 4 bits: AC Huffman table
+    bitWriter << id << (id == 1 ? 0x00 : 0x11); // Y: tables 0 for DC and AC; Cb + Cr: tables 1 for DC and AC
+
+  // constant values for our baseline JPEGs (which have a single sequential scan)
+  static const uint8_t Spectral[3] = { 0, 63, 0 }; // spectral selection: must be from 0 to 63; successive approximation must be 0
+  bitWriter << Spectral;
+}
+
+// ////////////////////////////////////////
+// colour conversion
+
+// Cb and Cr of 8 chroma samples from 16 RGB pixels (48 bytes) of one row (4:2:2) or two rows (4:2:0, row1 != nullptr),
+// each sample is the average of pixels 2k and 2k+1 (and the two pixels below)
+inline void chromaRowScalar(const uint8_t* row0, const uint8_t* row1, float average, float cb[8], float cr[8])
+{
+  for (auto k = 0; k < 8; k++)
+  {
+    // note: cast from 8 bits to >8 bits to avoid overflows when adding
+    auto pos = 6*k;
+    auto r = short(row0[pos    ]) + row0[pos + 3];
+    auto g = short(row0[pos + 1]) + row0[pos + 4];
+    auto b = short(row0[pos + 2]) + row0[pos + 5];
+    if (row1 != nullptr)
+    {
+      r += row1[pos    ] + row1[pos + 3];
+      g += row1[pos + 1] + row1[pos + 4];
+      b += row1[pos + 2] + row1[pos + 5];
+    }
+    // I still have to divide r,g,b by the number of pixels to get their average values,
+    // it's a bit faster if done AFTER CbCr conversion
+    cb[k] = rgb2cb(r, g, b) * average;
+    cr[k] = rgb2cr(r, g, b) * average;
+  }
+}
+
+// same result, a whole row at once: widen to 16 bits, add the rows, add each pixel's right neighbour (3 channels further),
+// then convert 4 samples per step with the same float operations as rgb2cb() / rgb2cr()
+inline void chromaRow(const uint8_t* row0, const uint8_t* row1, float average, float cb[8], float cr[8])
+{
+#ifdef __SSE2__
+  const auto zero = _mm_setzero_si128();
+  __m128i wide[6];
+  for (auto i = 0; i < 3; i++)
+  {
+    auto bytes = _mm_loadu_si128((const __m128i*)(row0 + 16*i));
+    wide[2*i    ] = _mm_unpacklo_epi8(bytes, zero);
+    wide[2*i + 1] = _mm_unpackhi_epi8(bytes, zero);
+    if (row1 != nullptr)
+    {
+      bytes = _mm_loadu_si128((const __m128i*)(row1 + 16*i));
+      wide[2*i    ] = _mm_add_epi16(wide[2*i    ], _mm_unpacklo_epi8(bytes, zero));
+      wide[2*i + 1] = _mm_add_epi16(wide[2*i + 1], _mm_unpackhi_epi8(bytes, zero));
+    }
+  }
+
+  // pair sums: element 6k + c is channel c of sample k, everything in between is don't care
+  __m128 sums[12];
+  for (auto i = 0; i < 6; i++)
+  {
+    // elements 3..7 of this register followed by 0..2 of the next one (the last pixel pair never needs them)
+    auto next  = i < 5 ? _mm_slli_si128(wide[i + 1], 10) : zero;
+    auto right = _mm_or_si128(_mm_srli_si128(wide[i], 6), next);
+    auto pairs = _mm_add_epi16(wide[i], right);
+    sums[2*i    ] = _mm_cvtepi32_ps(_mm_unpacklo_epi16(pairs, zero));
+    sums[2*i + 1] = _mm_cvtepi32_ps(_mm_unpackhi_epi16(pairs, zero));
+  }
+
+  for (auto half = 0; half < 2; half++)
+  {
+    // samples 4*half .. 4*half+3 start at elements 0, 6, 12, 18 of v => v[0][0..2], v[1][2..3]+v[2][0], v[3][0..2], v[4][2..3]+v[5][0]
+    auto v = sums + 6*half;
+    auto r = _mm_shuffle_ps(_mm_shuffle_ps(v[0], v[1], _MM_SHUFFLE(2,2,0,0)), _mm_shuffle_ps(v[3], v[4], _MM_SHUFFLE(2,2,0,0)), _MM_SHUFFLE(2,0,2,0));
+    auto g = _mm_shuffle_ps(_mm_shuffle_ps(v[0], v[1], _MM_SHUFFLE(3,3,1,1)), _mm_shuffle_ps(v[3], v[4], _MM_SHUFFLE(3,3,1,1)), _MM_SHUFFLE(2,0,2,0));
+    auto b = _mm_shuffle_ps(_mm_shuffle_ps(v[0], v[2], _MM_SHUFFLE(0,0,2,2)), _mm_shuffle_ps(v[3], v[5], _MM_SHUFFLE(0,0,2,2)), _MM_SHUFFLE(2,0,2,0));
+
+    auto blue = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(_mm_set1_ps(-0.16874f), r), _mm_mul_ps(_mm_set1_ps(0.33126f), g)),
+                           _mm_mul_ps(_mm_set1_ps(0.5f), b));
+    auto red  = _mm_sub_ps(_mm_sub_ps(_mm_mul_ps(_mm_set1_ps(0.5f), r), _mm_mul_ps(_mm_set1_ps(0.41869f), g)),
+                           _mm_mul_ps(_mm_set1_ps(0.08131f), b));
+    _mm_storeu_ps(cb + 4*half, _mm_mul_ps(blue, _mm_set1_ps(average)));
+    _mm_storeu_ps(cr + 4*half, _mm_mul_ps(red,  _mm_set1_ps(average)));
+  }
+#else
+  chromaRowScalar(row0, row1, average, cb, cr);
+#endif
+}
+
+// box filter Cb and Cr of the MCU at (mcuX, mcuY): 2x1 (4:2:2) or 2x2 (4:2:0) pixels per chroma sample,
+// pixels beyond the right/bottom border replicate the last column/row (like the luminance blocks)
+inline void downsampleChroma(const uint8_t* pixels, uint16_t width, uint16_t height, int mcuX, int mcuY, Sampling sampling,
+                             float Cb[8][8], float Cr[8][8])
+{
+  const auto rows      = samplingY(sampling);
+  const auto average   = rows == 2 ? 0.25f : 0.5f; // 1 / pixels per chroma sample, exact, same result as a division
+  const auto maxHeight = height - 1;
+
+  // only MCUs at the right border need padding, it's done once per source row instead of checking every pixel
+  const auto available = int(width) - mcuX;
+  const auto padRight  = available < 16;
+  uint8_t padded[2][16*3];
+
+  for (auto deltaY = 0; deltaY < 8; deltaY++)
+  {
+    const uint8_t* source[2] = { nullptr, nullptr };
+    for (auto i = 0; i < rows; i++)
+    {
+      auto row  = minimum(mcuY + rows*deltaY + i, maxHeight);
+      source[i] = pixels + (row * int(width) + mcuX) * 3;
+      if (padRight)
+      {
+        for (auto x = 0; x < 16; x++)
+        {
+          auto from = 3 * minimum(x, available - 1);
+          padded[i][3*x    ] = source[i][from    ];
+          padded[i][3*x + 1] = source[i][from + 1];
+          padded[i][3*x + 2] = source[i][from + 2];
+        }
+        source[i] = padded[i];
+      }
+    }
+
+    chromaRow(source[0], source[1], average, Cb[deltaY], Cr[deltaY]);
+  }
+}
+
+// convert an RGB or grayscale image to 8x8 YCbCr blocks, in the same order as they are stored in a baseline JPEG
+// onBlock(component, block) is invoked for each block: component 0 is Y, 1 is Cb and 2 is Cr
+// the block may be modified in-place by onBlock
+template <typename BlockHandler>
+void processBlocks(const uint8_t* pixels, uint16_t width, uint16_t height, bool isRGB, Sampling sampling, BlockHandler&& onBlock)
+{
+  // the next two variables are frequently used when checking for image borders
+  const auto maxWidth  = width  - 1; // "last row"
+  const auto maxHeight = height - 1; // "bottom line"
+
+  // process MCUs (minimum codes units) => image is subdivided into a grid of 8x8, 16x8 or 16x16 tiles
+  if (!isRGB)
+    sampling = YCbCr444;
+  const auto mcuWidth  = 8 * samplingX(sampling);
+  const auto mcuHeight = 8 * samplingY(sampling);
+
+  // convert from RGB to YCbCr
+  float Y[8][8], Cb[8][8], Cr[8][8];
+
+  const auto observer = rowObserver;
+
+  for (auto mcuY = 0; mcuY < height; mcuY += mcuHeight) // each step is either 8 or 16 (=mcuHeight)
+    for (auto mcuX = 0; mcuX < width; mcuX += mcuWidth)
+    {
+      if (observer && mcuX == 0)
+        observer(mcuY / mcuHeight);
+
+      // YCbCr 4:4:4 format: each MCU is a 8x8 block - the same applies to grayscale images, too
+      // YCbCr 4:2:2 format: each MCU represents a 16x8 block, stored as 2x 8x8 Y-blocks plus 1x 8x8 Cb and 1x 8x8 Cr block
+      // YCbCr 4:2:0 format: each MCU represents a 16x16 block, stored as 4x 8x8 Y-blocks plus 1x 8x8 Cb and 1x 8x8 Cr block
+      for (auto blockY = 0; blockY < mcuHeight; blockY += 8) // iterate once (YCbCr444, YCbCr422 and grayscale) or twice (YCbCr420)
+        for (auto blockX = 0; blockX < mcuWidth; blockX += 8)
+        {
+          // now we finally have an 8x8 block ...
+          for (auto deltaY = 0; deltaY < 8; deltaY++)
+          {
+            auto column = minimum(mcuX + blockX         , maxWidth); // must not exceed image borders, replicate last row/column if needed
+            auto row    = minimum(mcuY + blockY + deltaY, maxHeight);
+            for (auto deltaX = 0; deltaX < 8; deltaX++)
+            {
+              // find actual pixel position within the current image
+              auto pixelPos = row * int(width) + column; // the cast ensures that we don't run into multiplication overflows
+              if (column < maxWidth)
+                column++;
+
+              // grayscale images have solely a Y channel which can be easily derived from the input pixel by shifting it by 128
+              if (!isRGB)
+              {
+                Y[deltaY][deltaX] = pixels[pixelPos] - 128.f;
+                continue;
+              }
+
+              // RGB: 3 bytes per pixel (whereas grayscale images have only 1 byte per pixel)
+              auto r = pixels[3 * pixelPos    ];
+              auto g = pixels[3 * pixelPos + 1];
+              auto b = pixels[3 * pixelPos + 2];
+
+              Y   [deltaY][deltaX] = rgb2y (r, g, b) - 128; // again, the JPEG standard requires Y to be shifted by 128
+              // YCbCr444 is easy - subsampled chroma is computed below in a second pass
+              if (sampling == YCbCr444)
+              {
+                Cb[deltaY][deltaX] = rgb2cb(r, g, b); // standard RGB-to-YCbCr conversion
+                Cr[deltaY][deltaX] = rgb2cr(r, g, b);
+              }
+            }
+          }
+
+        // process Y channel
+        onBlock(0, Y);
+        // Cb and Cr are processed below
+      }
+
+      // grayscale images don't need any Cb and Cr information
+      if (!isRGB)
+        continue;
+
+      // YCbCr420 and YCbCr422: average chrominance of four / two pixels
+      if (sampling != YCbCr444)
+        downsampleChroma(pixels, width, height, mcuX, mcuY, sampling, Cb, Cr);
+
+      // process Cb and Cr
+      onBlock(1, Cb);
+      onBlock(2, Cr);
+    }
+
+  if (observer)
+    observer(-1);
+}
+
+// ////////////////////////////////////////
+// complete encoders for any output type, see the writeJpeg() overloads in toojpeg.h
+// output is held by reference: its state (buffer, file descriptor, hash, counter ...) belongs to this call only
+
+template <typename Output>
+bool writeImage(Output& output, const void* pixels_, uint16_t width, uint16_t height,
+                bool isRGB, uint8_t quality_, Sampling sampling, const char* comment)
+{
+  // reject invalid pointers
+  if (pixels_ == nullptr)
+    return false;
+  // check image format
+  if (width == 0 || height == 0)
+    return false;
+
+  // note: if there is just one component (=grayscale), then only luminance needs to be stored in the file
+  //       thus everything related to chrominance need not to be written to the JPEG
+  //       I still compute a few things, like quantization tables to avoid a complete code mess
+
+  // grayscale images can't be downsampled (because there are no Cb + Cr channels)
+  if (!isRGB)
+    sampling = YCbCr444;
+
+  // wrapper for all output operations
+  BitWriter<Output&> bitWriter(output);
+
+  // quantization tables adjusted to desired quality, Huffman tables and codewords
+  EncoderTables tables(quality_);
+
+  // JFIF headers, quantization and Huffman tables, start of scan
+  writeHeaders(bitWriter, width, height, isRGB, sampling, tables, comment);
+
+  // average color of the previous MCU
+  int16_t lastDC[3] = { 0, 0, 0 };
+
+  // convert from RGB to YCbCr and encode each 8x8 block
+  processBlocks((const uint8_t*)pixels_, width, height, isRGB, sampling, [&](int component, float block[8][8])
+  {
+    if (component == 0)
+      lastDC[0]         = encodeBlock(bitWriter, block, tables.scaledLuminance,   lastDC[0],
+                                      tables.huffmanLuminanceDC,   tables.huffmanLuminanceAC,   tables.codewords);
+    else
+      lastDC[component] = encodeBlock(bitWriter, block, tables.scaledChrominance, lastDC[component],
+                                      tables.huffmanChrominanceDC, tables.huffmanChrominanceAC, tables.codewords);
+  });
+
+  bitWriter.flush(); // now image is completely encoded, write any bits still left in the buffer
+
+  // ///////////////////////////
+  // EOI marker
+  bitWriter << 0xFF << 0xD9; // this marker has no length, therefore I can't use addMarker()
+  return true;
+} // writeImage()
+
+// quantize and encode coefficients computed by analyzeJpeg()
+template <typename Output>
+bool writeCoefficients(Output& output, const Coefficients& coefficients, uint8_t quality_, const char* comment)
+{
+  if (coefficients.blocks.empty())
+    return false;
+
+  BitWriter<Output&> bitWriter(output);
+  EncoderTables tables(quality_);
+  writeHeaders(bitWriter, coefficients.width, coefficients.height, coefficients.isRGB, coefficients.sampling,
+               tables, comment);
+
+  // Y blocks come first in each MCU, followed by a single Cb and a single Cr block (if RGB)
+  const auto numLuminance = samplingX(coefficients.sampling) * samplingY(coefficients.sampling);
+  const auto blocksPerMcu = coefficients.isRGB ? numLuminance + 2 : 1;
+
+  int16_t lastDC[3] = { 0, 0, 0 };
+  const auto numBlocks = coefficients.blocks.size() / (8*8);
+  const auto* block64  = coefficients.blocks.data();
+  for (std::size_t i = 0; i < numBlocks; i++, block64 += 8*8)
+  {
+    auto component = int(i % blocksPerMcu) - numLuminance + 1; // Y = 0, Cb = 1, Cr = 2
+    if (component <= 0)
+      lastDC[0]         = encodeCoefficients(bitWriter, block64, tables.scaledLuminance,   lastDC[0],
+                                             tables.huffmanLuminanceDC,   tables.huffmanLuminanceAC,   tables.codewords);
+    else
+      lastDC[component] = encodeCoefficients(bitWriter, block64, tables.scaledChrominance, lastDC[component],
+                                             tables.huffmanChrominanceDC, tables.huffmanChrominanceAC, tables.codewords);
+  }
+
+  bitWriter.flush();
+  bitWriter << 0xFF << 0xD9; // EOI marker
+  return true;
+}
+
+// ////////////////////////////////////////
+// progressive JPEGs
+
+// quantized coefficients of a whole image, filled block by block in the order of processBlocks()
+// and read by any number of scans
+struct QuantizedImage
+{
+  struct Component
+  {
+    int h, v;                  // sampling factors
+    int blocksWide, blocksHigh; // whole MCUs, including the blocks beyond the right/bottom border
+    int usedWide,   usedHigh;   // blocks covering the component's pixels, only these are part of a non-interleaved scan
+    std::vector<int16_t> blocks; // 64 coefficients per block in zig-zag order, row by row
+  } components[3];
+  int numComponents;
+  int mcusWide, mcusHigh;
+
+  QuantizedImage(uint16_t width, uint16_t height, bool isRGB, Sampling sampling)
+  : numComponents(isRGB ? 3 : 1)
+  {
+    if (!isRGB)
+      sampling = YCbCr444;
+    const auto maxH = samplingX(sampling);
+    const auto maxV = samplingY(sampling);
+    mcusWide = (width  + 8*maxH - 1) / (8*maxH);
+    mcusHigh = (height + 8*maxV - 1) / (8*maxV);
+    for (auto id = 0; id < numComponents; id++)
+    {
+      auto& component = components[id];
+      component.h = id == 0 ? maxH : 1;
+      component.v = id == 0 ? maxV : 1;
+      component.blocksWide = mcusWide * component.h;
+      component.blocksHigh = mcusHigh * component.v;
+      // component size is the image size scaled by its sampling factors (rounded up), then whole blocks
+      component.usedWide = ((width  * component.h + maxH - 1) / maxH + 7) / 8;
+      component.usedHigh = ((height * component.v + maxV - 1) / maxV + 7) / 8;
+      component.blocks.resize(std::size_t(component.blocksWide) * component.blocksHigh * 8*8);
+    }
+  }
+
+  // storage of the next block delivered by processBlocks()
+  int16_t* nextBlock(int id)
+  {
+    auto& component = components[id];
+    auto x = (mcu % mcusWide) * component.h;
+    auto y = (mcu / mcusWide) * component.v;
+    if (id == 0) // 1, 2 or 4 Y blocks per MCU, row by row
+    {
+      x += luminanceInMcu % component.h;
+      y += luminanceInMcu / component.h;
+      luminanceInMcu++;
+    }
+    auto result = block(id, x, y);
+    // each MCU ends with its Cr block (or its only Y block if grayscale)
+    if (id == numComponents - 1 && (id > 0 || luminanceInMcu == component.h * component.v))
+    {
+      mcu++;
+      luminanceInMcu = 0;
+    }
+    return result;
+  }
+
+  int16_t* block(int id, int x, int y)
+  {
+    return &components[id].blocks[(std::size_t(y) * components[id].blocksWide + x) * 8*8];
+  }
+  const int16_t* block(int id, int x, int y) const
+  {
+    return &components[id].blocks[(std::size_t(y) * components[id].blocksWide + x) * 8*8];
+  }
+
+  // memory of all coefficients
+  std::size_t bytes() const
+  {
+    std::size_t result = 0;
+    for (auto id = 0; id < numComponents; id++)
+      result += components[id].blocks.size() * sizeof(int16_t);
+    return result;
+  }
+
+private:
+  int mcu = 0;            // position of the next block
+  int luminanceInMcu = 0;
+};
+
+// a script is valid if it sends every bit of every coefficient exactly once, each component's DC before its AC
+// and AC bands of a single component only (interleaved scans may contain DC only)
+inline bool checkScans(const std::vector<Scan>& scans, int numComponents)
+{
+  // point transform of the latest scan of each coefficient, -1 = not sent yet
+  int8_t sent[3][8*8];
+  for (auto& component : sent)
+    for (auto& coefficient : component)
+      coefficient = -1;
+
+  for (auto& scan : scans)
+  {
+    if (scan.components == 0 || scan.components >= (1 << numComponents))
+      return false;
+    auto numScanComponents = (scan.components & 1) + ((scan.components >> 1) & 1) + ((scan.components >> 2) & 1);
+    if (scan.first > scan.last || scan.last > 63 || scan.low > 13)
+      return false;
+    if (scan.first == 0 ? scan.last != 0 : numScanComponents != 1)
+      return false;
+    // refinements send exactly one more bit
+    if (scan.high != 0 && scan.high != scan.low + 1)
+      return false;
+
+    for (auto id = 0; id < numComponents; id++)
+    {
+      if ((scan.components & (1 << id)) == 0)
+        continue;
+      if (scan.first > 0 && sent[id][0] < 0)
+        return false;
+      for (auto i = scan.first; i <= scan.last; i++)
+      {
+        if (sent[id][i] != (scan.high == 0 ? -1 : scan.high))
+          return false;
+        sent[id][i] = scan.low;
+      }
+    }
+  }
+
+  // complete ?
+  for (auto id = 0; id < numComponents; id++)
+    for (auto i = 0; i < 8*8; i++)
+      if (sent[id][i] != 0)
+        return false;
+  return true;
+}
+
+// first DC scan of a block: difference of the point transformed values, same codes as baseline
+template <typename Writer>
+int16_t encodeFirstDC(Writer& writer, const int16_t quantized[8*8], int low, int16_t lastDC,
+                      const BitCode huffmanDC[256], const BitCode* codewords)
+{
+  int16_t DC = quantized[0] >> low; // arithmetic shift, as required by the standard
+  auto diff = DC - lastDC;
+  if (diff == 0)
+    writer << huffmanDC[0x00];
+  else
+  {
+    auto bits = codewords[diff];
+    writer.write(huffmanDC[bits.numBits], bits);
+  }
+  return DC;
+}
+
+// first AC scan of a band: like baseline, but magnitudes are divided by 2^low (rounded towards zero)
+template <typename Writer>
+void encodeFirstAC(Writer& writer, const int16_t quantized[8*8], int first, int last, int low,
+                   const BitCode huffmanAC[256], const BitCode* codewords)
+{
+  auto offset = 0; // upper 4 bits count the number of consecutive zeros
+  for (auto i = first; i <= last; i++)
+  {
+    int value = quantized[i];
+    value = value >= 0 ? value >> low : -(-value >> low);
+    if (value == 0)
+    {
+      offset += 0x10;
+      continue;
+    }
+
+    // split into blocks of at most 16 consecutive zeros
+    while (offset > 0xF0)
+    {
+      writer << huffmanAC[0xF0];
+      offset -= 0x100;
+    }
+    auto encoded = codewords[value];
+    writer.write(huffmanAC[offset + encoded.numBits], encoded);
+    offset = 0;
+  }
+
+  // end-of-band: an EOB run of a single block, longer runs would need symbols the standard AC tables don't have
+  if (offset > 0)
+    writer << huffmanAC[0x00];
+}
+
+// refinement AC scan of a band: one more bit of each coefficient (see G.1.2.3 of the JPEG standard),
+// coefficients becoming non-zero are sent as run/size 1 symbols, the others as raw correction bits
+template <typename Writer>
+void encodeRefineAC(Writer& writer, const int16_t quantized[8*8], int first, int last, int low, const BitCode huffmanAC[256])
+{
+  // magnitudes after the point transform, the last coefficient becoming non-zero (magnitude 1) ends the zero runs
+  uint16_t magnitude[8*8];
+  auto lastNew = first - 1;
+  for (auto i = first; i <= last; i++)
+  {
+    magnitude[i] = uint16_t((quantized[i] >= 0 ? quantized[i] : -quantized[i]) >> low);
+    if (magnitude[i] == 1)
+      lastNew = i;
+  }
+
+  // correction bits of coefficients that were already non-zero, sent after the next symbol
+  uint8_t corrections[8*8];
+  auto numCorrections = 0;
+  auto writeCorrections = [&]()
+  {
+    for (auto i = 0; i < numCorrections; i++)
+      writer.write(corrections[i], 1);
+    numCorrections = 0;
+  };
+
+  auto zeros = 0;
+  for (auto i = first; i <= last; i++)
+  {
+    if (magnitude[i] == 0)
+    {
+      zeros++;
+      continue;
+    }
+    // long zero runs before a new coefficient, behind the last one they are part of the end-of-band
+    while (zeros > 15 && i <= lastNew)
+    {
+      writer << huffmanAC[0xF0];
+      zeros -= 16;
+      writeCorrections();
+    }
+    if (magnitude[i] > 1)
+    {
+      corrections[numCorrections++] = magnitude[i] & 1;
+      continue;
+    }
+    writer << huffmanAC[(zeros << 4) + 1];
+    writer.write(quantized[i] < 0 ? 0 : 1, 1); // sign
+    writeCorrections();
+    zeros = 0;
+  }
+
+  if (zeros > 0 || numCorrections > 0)
+  {
+    writer << huffmanAC[0x00];
+    writeCorrections();
+  }
+}
+
+// write a complete scan: SOS marker and the entropy coded blocks
+template <typename Output>
+void writeScan(BitWriter<Output>& bitWriter, const QuantizedImage& image, const Scan& scan, const EncoderTables& tables)
+{
+  auto numScanComponents = 0;
+  for (auto id = 0; id < image.numComponents; id++)
+    if (scan.components & (1 << id))
+      numScanComponents++;
+
+  bitWriter.addMarker(0xDA, 2+1+2*numScanComponents+3);
+  bitWriter << numScanComponents;
+  for (auto id = 0; id < image.numComponents; id++)
+    if (scan.components & (1 << id))
+      bitWriter << (id + 1) << (id == 0 ? 0x00 : 0x11); // same Huffman tables as baseline
+  bitWriter << scan.first << scan.last << ((scan.high << 4) | scan.low);
+
+  int16_t lastDC[3] = { 0, 0, 0 };
+  auto encode = [&](int id, const int16_t* quantized)
+  {
+    auto huffmanDC = id == 0 ? tables.huffmanLuminanceDC : tables.huffmanChrominanceDC;
+    auto huffmanAC = id == 0 ? tables.huffmanLuminanceAC : tables.huffmanChrominanceAC;
+    if (scan.first == 0 && scan.high == 0)
+      lastDC[id] = encodeFirstDC(bitWriter, quantized, scan.low, lastDC[id], huffmanDC, tables.codewords);
+    else if (scan.first == 0)
+      bitWriter.write((quantized[0] >> scan.low) & 1, 1);
+    else if (scan.high == 0)
+      encodeFirstAC(bitWriter, quantized, scan.first, scan.last, scan.low, huffmanAC, tables.codewords);
+    else
+      encodeRefineAC(bitWriter, quantized, scan.first, scan.last, scan.low, huffmanAC);
+  };
+
+  if (numScanComponents > 1)
+  {
+    // interleaved: MCU by MCU, like baseline
+    for (auto mcuY = 0; mcuY < image.mcusHigh; mcuY++)
+      for (auto mcuX = 0; mcuX < image.mcusWide; mcuX++)
+        for (auto id = 0; id < image.numComponents; id++)
+        {
+          if ((scan.components & (1 << id)) == 0)
+            continue;
+          auto& component = image.components[id];
+          for (auto y = 0; y < component.v; y++)
+            for (auto x = 0; x < component.h; x++)
+              encode(id, image.block(id, mcuX * component.h + x, mcuY * component.v + y));
+        }
+  }
+  else
+  {
+    // non-interleaved: only the blocks covering the component, row by row
+    auto id = scan.components == 1 ? 0 : scan.components == 2 ? 1 : 2;
+    auto& component = image.components[id];
+    for (auto y = 0; y < component.usedHigh; y++)
+      for (auto x = 0; x < component.usedWide; x++)
+        encode(id, image.block(id, x, y));
+  }
+
+  bitWriter.flush();
+}
+
+template <typename Output>
+bool writeProgressiveImage(Output& output, const void* pixels_, uint16_t width, uint16_t height, const std::vector<Scan>& scans,
+                           bool isRGB, uint8_t quality_, Sampling sampling, const char* comment)
+{
+  // same restrictions as writeImage()
+  if (pixels_ == nullptr || width == 0 || height == 0)
+    return false;
+  if (!checkScans(scans, isRGB ? 3 : 1))
+    return false;
+  if (!isRGB)
+    sampling = YCbCr444;
+
+  BitWriter<Output&> bitWriter(output);
+  EncoderTables tables(quality_);
+  writeFrameHeaders(bitWriter, width, height, isRGB, sampling, tables, comment, true);
+
+  // colour conversion, DCT and quantization once, all scans read the same coefficients
+  QuantizedImage image(width, height, isRGB, sampling);
+  processBlocks((const uint8_t*)pixels_, width, height, isRGB, sampling, [&](int component, float block[8][8])
+  {
+    auto block64 = (float*) block;
+    transformBlock(block64);
+    quantizeBlock(block64, component == 0 ? tables.scaledLuminance : tables.scaledChrominance, image.nextBlock(component));
+  });
+
+  for (auto& scan : scans)
+    writeScan(bitWriter, image, scan, tables);
+
+  bitWriter << 0xFF << 0xD9; // EOI marker
+  return true;
+}
+
+} // namespace Internal
+} // namespace TooJpeg
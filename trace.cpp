@@ -0,0 +1,309 @@
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <mutex>
+#include <vector>
+#include "edf.h"
+#include "logger.h"
+#include "toojpeg.h"
+#include "trace.h"
+
+namespace Trace
+{
+    bool active = false;
+
+    namespace
+    {
+        // events per chunk, a thread allocates a new chunk only when the current one is full
+        auto const CHUNK_EVENTS = 512;
+
+        struct Event
+        {
+            const char *name;
+            long long begin_ns;
+            long long end_ns;
+            int task;
+            int arg;
+            char phase;
+        };
+
+        struct Chunk
+        {
+            Event events[CHUNK_EVENTS];
+            std::atomic<int> count{0};        // published by the owning thread
+            std::atomic<Chunk *> next{nullptr};
+            int written = 0;                  // events already in the file, guarded by file_mutex
+        };
+
+        struct Buffer
+        {
+            long tid = 0;
+            std::atomic<const char *> name{nullptr};
+            bool name_written = false;
+            Chunk *head = nullptr;
+            Chunk *tail = nullptr;            // only touched by the owning thread
+        };
+
+        std::string file_path;
+        std::string process;
+        bool process_written = false;
+        std::mutex file_mutex;                // serializes writes to the file
+        std::mutex buffers_mutex;             // guards the list and the free chunks, not the buffers
+        std::vector<Buffer *> buffers;
+        std::vector<Chunk *> free_chunks;     // written chunks of finished threads, reused by new ones
+
+        // Writes and retires the buffer of the calling thread when it ends, see retire()
+        struct Owner
+        {
+            Buffer *buffer = nullptr;
+            ~Owner();
+        };
+        thread_local Owner owner;
+
+        // caller holds buffers_mutex
+        Chunk *new_chunk()
+        {
+            if (free_chunks.empty())
+                return new Chunk;
+            auto chunk = free_chunks.back();
+            free_chunks.pop_back();
+            chunk->count.store(0, std::memory_order_relaxed);
+            chunk->next.store(nullptr, std::memory_order_relaxed);
+            chunk->written = 0;
+            return chunk;
+        }
+
+        Buffer *thread_buffer()
+        {
+            if (!owner.buffer)
+            {
+                auto own = new Buffer;
+                own->tid = gettid();
+                std::lock_guard<std::mutex> lock(buffers_mutex);
+                own->head = own->tail = new_chunk();
+                buffers.push_back(own);
+                owner.buffer = own;
+            }
+            return owner.buffer;
+        }
+
+        void record(const char *name, char phase, long long begin_ns, long long end_ns, int task, int arg)
+        {
+            auto own = thread_buffer();
+            auto chunk = own->tail;
+            auto count = chunk->count.load(std::memory_order_relaxed);
+            if (count == CHUNK_EVENTS)
+            {
+                Chunk *next;
+                {
+                    std::lock_guard<std::mutex> lock(buffers_mutex);
+                    next = new_chunk();
+                }
+                chunk->next.store(next, std::memory_order_release);
+                own->tail = chunk = next;
+                count = 0;
+            }
+            chunk->events[count] = Event{name, begin_ns, end_ns, task, arg, phase};
+            chunk->count.store(count + 1, std::memory_order_release);
+        }
+
+        void append(std::string &out, const Event &event, long tid)
+        {
+            char line[256];
+            auto pid = getpid();
+            if (event.phase == 'X')
+                snprintf(line, sizeof(line),
+                         R"({"name":"%s","cat":"sczr00","ph":"X","pid":%d,"tid":%ld,"ts":%.3f,"dur":%.3f,"args":{"task":%d,"arg":%d}},)" "\n",
+                         event.name, pid, tid, event.begin_ns / 1e3, (event.end_ns - event.begin_ns) / 1e3, event.task, event.arg);
+            else
+                snprintf(line, sizeof(line),
+                         R"({"name":"frame","cat":"sczr00","ph":"%c","id":%d,"bp":"e","pid":%d,"tid":%ld,"ts":%.3f},)" "\n",
+                         event.phase, event.task, pid, tid, event.begin_ns / 1e3);
+            out += line;
+        }
+
+        void metadata(std::string &out, const char *kind, long tid, const char *name)
+        {
+            char line[256];
+            snprintf(line, sizeof(line), R"({"name":"%s","ph":"M","pid":%d,"tid":%ld,"args":{"name":"%s"}},)" "\n",
+                     kind, getpid(), tid, name);
+            out += line;
+        }
+
+        // Events of one buffer recorded since the last write, caller holds file_mutex
+        void collect(std::string &out, Buffer *own)
+        {
+            if (!process_written)
+            {
+                metadata(out, "process_name", getpid(), process.c_str());
+                process_written = true;
+            }
+            auto name = own->name.load();
+            if (name && !own->name_written)
+            {
+                metadata(out, "thread_name", own->tid, name);
+                own->name_written = true;
+            }
+            for (auto chunk = own->head; chunk; chunk = chunk->next.load(std::memory_order_acquire))
+            {
+                auto count = chunk->count.load(std::memory_order_acquire);
+                for (; chunk->written < count; chunk->written++)
+                    append(out, chunk->events[chunk->written], own->tid);
+            }
+        }
+
+        // One append per write-out, the processes of a pipeline share the file; caller holds file_mutex
+        void write_out(const std::string &out)
+        {
+            if (out.empty())
+                return;
+            auto fd = open(file_path.c_str(), O_WRONLY | O_APPEND);
+            if (fd < 0)
+                return;
+            for (size_t done = 0; done < out.size();)
+            {
+                auto written = write(fd, out.data() + done, out.size() - done);
+                if (written <= 0)
+                    break;
+                done += written;
+            }
+            close(fd);
+        }
+
+        // Append everything recorded since the last write, the writers keep running
+        void write_events()
+        {
+            std::lock_guard<std::mutex> lock(file_mutex);
+            std::vector<Buffer *> snapshot;
+            {
+                std::lock_guard<std::mutex> list_lock(buffers_mutex);
+                snapshot = buffers;
+            }
+            std::string out;
+            for (auto own : snapshot)
+                collect(out, own);
+            write_out(out);
+        }
+
+        // The client starts a thread per frame: a finished thread writes its last events and hands its chunks
+        // to the next thread instead of keeping a mostly empty buffer until the process ends
+        Owner::~Owner()
+        {
+            if (!buffer)
+                return;
+            std::lock_guard<std::mutex> lock(file_mutex);
+            std::string out;
+            collect(out, buffer);
+            write_out(out);
+
+            std::lock_guard<std::mutex> list_lock(buffers_mutex);
+            buffers.erase(std::find(buffers.begin(), buffers.end(), buffer));
+            for (auto chunk = buffer->head; chunk;)
+            {
+                auto next = chunk->next.load(std::memory_order_relaxed);
+                free_chunks.push_back(chunk);
+                chunk = next;
+            }
+            delete buffer;
+            buffer = nullptr;
+        }
+
+        void *signal_thread(void *)
+        {
+            sigset_t signals;
+            sigemptyset(&signals);
+            sigaddset(&signals, SIGUSR2);
+            int signal;
+            while (sigwait(&signals, &signal) == 0)
+                write_events();
+            return nullptr;
+        }
+
+        // Row spans of the current thread, see observe_rows()
+        thread_local int row_task = NO_TASK;
+        thread_local int row = NO_TASK;
+        thread_local long long row_begin = 0;
+
+        void row_observer(int next)
+        {
+            auto now = Logger::now_ns();
+            if (row >= 0)
+                complete("mcu row", row_begin, now, row_task, row);
+            row = next;
+            row_begin = now;
+        }
+    }
+
+    bool create(const std::string &path)
+    {
+        // JSON array format: the closing bracket is optional, so processes can append events until they exit
+        auto file = fopen(path.c_str(), "w");
+        if (!file)
+            return false;
+        fputs("[\n", file);
+        fclose(file);
+        return true;
+    }
+
+    void start(const std::string &path, const std::string &process_name)
+    {
+        file_path = path;
+        process = process_name;
+
+        // threads created later inherit the mask, only signal_thread receives SIGUSR2
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGUSR2);
+        pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+        pthread_t thread;
+        if (pthread_create(&thread, nullptr, signal_thread, nullptr) == 0)
+            pthread_detach(thread);
+
+        active = true;
+    }
+
+    void stop()
+    {
+        if (!active)
+            return;
+        write_events();
+    }
+
+    void name_thread(const char *name)
+    {
+        if (active)
+            thread_buffer()->name = name;
+    }
+
+    void complete(const char *name, long long begin_ns, long long end_ns, int task, int arg)
+    {
+        if (active)
+            record(name, 'X', begin_ns, end_ns, task, arg);
+    }
+
+    void flow(char phase, int id)
+    {
+        if (active)
+        {
+            auto now = Logger::now_ns();
+            record("frame", phase, now, now, id, NO_TASK);
+        }
+    }
+
+    long long Span::now()
+    {
+        return Logger::now_ns();
+    }
+
+    void observe_rows(int task)
+    {
+        if (!active)
+            return;
+        row_task = task;
+        row = NO_TASK;
+        TooJpeg::rowObserver = task == NO_TASK ? nullptr : row_observer;
+    }
+}
@@ -0,0 +1,66 @@
+#include <string>
+
+#ifndef SCZR00_TRACE_H
+#define SCZR00_TRACE_H
+
+// Per-frame tracing in Chrome trace / Perfetto JSON format (open the file in ui.perfetto.dev or chrome://tracing).
+// Every thread records into its own buffer without locks; the buffers are written at exit, on SIGUSR2 and when
+// their thread ends.
+// All processes of a pipeline append to the same file, timestamps come from the shared monotonic clock.
+namespace Trace
+{
+    auto const NO_TASK = -1;
+
+    // set by start(), checked before anything else is done
+    extern bool active;
+
+    inline bool enabled() { return active; }
+
+    // Truncate the trace file and write the array header, before fork()
+    bool create(const std::string &path);
+
+    // Enable tracing in the calling process, must run before it creates other threads:
+    // SIGUSR2 is blocked and handled by a helper thread which writes the events recorded so far
+    void start(const std::string &path, const std::string &process_name);
+
+    // Write the remaining events of all threads
+    void stop();
+
+    // Track name of the calling thread
+    void name_thread(const char *name);
+
+    // Span with explicit timestamps (Logger::now_ns()), name must be a string literal
+    void complete(const char *name, long long begin_ns, long long end_ns, int task = NO_TASK, int arg = NO_TASK);
+
+    // Flow arrows connecting the spans of one frame across threads and processes:
+    // 's' starts, 't' continues and 'f' ends the flow with the given id, bound to the enclosing span
+    void flow(char phase, int id);
+
+    // Records a span from construction to destruction
+    class Span
+    {
+    public:
+        explicit Span(const char *name, int task = NO_TASK, int arg = NO_TASK)
+                : name(name), task(task), arg(arg), begin(active ? now() : 0) {}
+        ~Span()
+        {
+            if (begin)
+                complete(name, begin, now(), task, arg);
+        }
+
+        Span(const Span &) = delete;
+        Span &operator=(const Span &) = delete;
+
+    private:
+        static long long now();
+
+        const char *name;
+        int task, arg;
+        long long begin;
+    };
+
+    // TooJpeg::ROW_OBSERVER recording one span per MCU row for the task set by observe_rows()
+    void observe_rows(int task);
+}
+
+#endif //SCZR00_TRACE_H
@@ -0,0 +1,152 @@
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+#include "jpegtransform.h"
+
+// Usage: sczr00_transform INPUT OUTPUT [--rotate=90|180|270] [--flip=horizontal|vertical] [--transpose] [--crop=WxH+X+Y]
+// Crops, rotates and flips archived frames without decoding them to pixels, see jpegtransform.h.
+// Rotation or flipping happens first, the crop rectangle refers to the rotated/flipped image.
+
+namespace
+{
+    bool option(const char *arg, const std::string &name, std::string &value)
+    {
+        auto prefix = "--" + name + "=";
+        if (strncmp(arg, prefix.c_str(), prefix.size()) != 0)
+            return false;
+        value = arg + prefix.size();
+        return true;
+    }
+
+    double ms_since(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    bool is_rotation(JpegTransform::Operation operation)
+    {
+        return operation == JpegTransform::ROTATE_90 || operation == JpegTransform::ROTATE_180 ||
+               operation == JpegTransform::ROTATE_270;
+    }
+
+    bool is_flip(JpegTransform::Operation operation)
+    {
+        return operation == JpegTransform::FLIP_HORIZONTAL || operation == JpegTransform::FLIP_VERTICAL;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    std::vector<std::string> files;
+    auto operation = JpegTransform::NONE;
+    JpegTransform::Crop rectangle;
+    auto cropped = false;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string value;
+        auto rotate = option(argv[i], "rotate", value);
+        auto flip = !rotate && option(argv[i], "flip", value);
+        auto transpose = strcmp(argv[i], "--transpose") == 0;
+        if ((rotate || flip || transpose) && operation != JpegTransform::NONE)
+        {
+            // one lossless operation per run, a second one would silently replace the first
+            fprintf(stderr, "Only one of --rotate, --flip and --transpose can be given: %s\n", argv[i]);
+            return 2;
+        }
+
+        if (rotate || flip)
+        {
+            if (!JpegTransform::parse_operation(value, operation) || (rotate && !is_rotation(operation)) ||
+                (flip && !is_flip(operation)))
+            {
+                fprintf(stderr, rotate ? "Invalid rotation '%s', expected 90, 180 or 270\n"
+                                       : "Invalid flip '%s', expected horizontal or vertical\n", value.c_str());
+                return 2;
+            }
+        }
+        else if (transpose)
+            operation = JpegTransform::TRANSPOSE;
+        else if (option(argv[i], "crop", value))
+        {
+            if (cropped)
+            {
+                fprintf(stderr, "--crop can only be given once\n");
+                return 2;
+            }
+            cropped = true;
+            if (!JpegTransform::parse_crop(value, rectangle))
+            {
+                fprintf(stderr, "Invalid crop '%s', expected WxH+X+Y\n", value.c_str());
+                return 2;
+            }
+        }
+        else if (argv[i][0] == '-' && argv[i][1] == '-')
+        {
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            return 2;
+        }
+        else
+            files.push_back(argv[i]);
+    }
+    if (files.size() != 2)
+    {
+        fprintf(stderr, "Usage: %s INPUT OUTPUT [--rotate=90|180|270] [--flip=horizontal|vertical] [--transpose] "
+                        "[--crop=WxH+X+Y]\n", argv[0]);
+        return 2;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::ifstream in(files[0], std::ios_base::binary);
+    std::vector<uint8_t> input((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    if (!in.good() && !in.eof())
+    {
+        fprintf(stderr, "Cannot read %s\n", files[0].c_str());
+        return 1;
+    }
+    auto read_ms = ms_since(start);
+
+    start = std::chrono::steady_clock::now();
+    JpegTransform::Image image;
+    std::string error;
+    if (!JpegTransform::decode(input.data(), input.size(), image, error))
+    {
+        fprintf(stderr, "%s: %s\n", files[0].c_str(), error.c_str());
+        return 1;
+    }
+    auto width = image.width, height = image.height;
+    auto decode_ms = ms_since(start);
+
+    start = std::chrono::steady_clock::now();
+    if (!JpegTransform::apply(image, operation, error) || !JpegTransform::crop(image, rectangle, error))
+    {
+        fprintf(stderr, "%s: %s\n", files[0].c_str(), error.c_str());
+        return 1;
+    }
+    auto transform_ms = ms_since(start);
+
+    start = std::chrono::steady_clock::now();
+    std::vector<uint8_t> output;
+    JpegTransform::encode(image, output);
+    auto encode_ms = ms_since(start);
+
+    start = std::chrono::steady_clock::now();
+    std::ofstream out(files[1], std::ios_base::binary | std::ios_base::trunc);
+    out.write((const char *) output.data(), output.size());
+    out.close();
+    if (!out)
+    {
+        fprintf(stderr, "Cannot write %s\n", files[1].c_str());
+        return 1;
+    }
+    auto write_ms = ms_since(start);
+
+    printf("%s: %dx%d, %zu bytes -> %s: %dx%d, %zu bytes\n", files[0].c_str(), width, height, input.size(),
+           files[1].c_str(), image.width, image.height, output.size());
+    printf("read %.2f ms, entropy decode %.2f ms, transform %.2f ms, entropy encode %.2f ms, write %.2f ms\n",
+           read_ms, decode_ms, transform_ms, encode_ms, write_ms);
+    return 0;
+}